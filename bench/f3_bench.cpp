@@ -0,0 +1,265 @@
+#include "f3_launcher.h"
+#include "f3_output.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QTime>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+#ifndef F3_BENCH_CORPUS
+#define F3_BENCH_CORPUS "corpus"
+#endif
+
+#define F3_BENCH_MIN_TIME 200
+#define F3_BENCH_MAX_ITERATIONS 100000000
+
+// Every allocation made by the process is counted, the benchmarks read the
+// difference around their loop
+static std::atomic<quint64> f3_bench_allocations(0);
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void __libc_free(void *pointer);
+
+void *malloc(size_t size)
+{
+    f3_bench_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    f3_bench_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    f3_bench_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer)
+{
+    __libc_free(pointer);
+}
+}
+#else
+// Elsewhere only what goes through operator new is seen, which is most of
+// what Qt containers do
+void *operator new(size_t size)
+{
+    f3_bench_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+#endif
+
+struct f3_bench_transcript
+{
+    QString name;
+    int stage;
+    QString mode;
+    QByteArray output;
+};
+
+class f3_bench
+{
+public:
+    f3_bench(const QString& filter, qint64 minTime) :
+        filter(filter),
+        minTime(minTime),
+        out(stdout)
+    {
+        out << QString("%1 %2 %3 %4\n")
+               .arg(QString("benchmark"), -56)
+               .arg(QString("iterations"), 12)
+               .arg(QString("ns/op"), 12)
+               .arg(QString("allocs/op"), 10);
+    }
+
+    // Runs the body often enough to fill minTime, a few iterations first to
+    // estimate how many that takes
+    void run(const QString& name, const std::function<void()>& body)
+    {
+        if (!filter.isEmpty() && !name.contains(filter))
+            return;
+
+        qint64 iterations = 1;
+        qint64 elapsed = 0;
+        quint64 allocations = 0;
+        forever
+        {
+            QElapsedTimer timer;
+            quint64 before = f3_bench_allocations.load();
+            timer.start();
+            for (qint64 i = 0; i < iterations; i++)
+                body();
+            elapsed = timer.nsecsElapsed();
+            allocations = f3_bench_allocations.load() - before;
+            if (elapsed >= minTime * 1000000 || iterations >= F3_BENCH_MAX_ITERATIONS)
+                break;
+            qint64 next = elapsed > 0 ? iterations * minTime * 1100000 / elapsed : iterations * 100;
+            iterations = qBound(iterations * 2, next, iterations * 100);
+        }
+
+        out << QString("%1 %2 %3 %4\n")
+               .arg(name, -56)
+               .arg(iterations, 12)
+               .arg(double(elapsed) / iterations, 12, 'f', 1)
+               .arg(double(allocations) / iterations, 10, 'f', 2);
+        out.flush();
+    }
+
+private:
+    QString filter;
+    qint64 minTime;
+    QTextStream out;
+};
+
+// The tool and the f3 version are in the name, e.g. f3probe-8.0-limbo.txt
+static bool f3_bench_load(const QFileInfo& file, f3_bench_transcript& transcript)
+{
+    QFile input(file.filePath());
+    if (!input.open(QFile::ReadOnly))
+        return false;
+
+    transcript.name = file.completeBaseName();
+    transcript.output = input.readAll();
+    QString tool = transcript.name.section('-', 0, 0);
+    if (tool == "f3write")
+    {
+        transcript.stage = 1;
+        transcript.mode = "legacy";
+    }
+    else if (tool == "f3read")
+    {
+        transcript.stage = 2;
+        transcript.mode = "legacy";
+    }
+    else if (tool == "f3probe")
+    {
+        transcript.stage = 11;
+        transcript.mode = "quick";
+    }
+    else
+        return false;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("f3-qt-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the output parsing and reporting of f3-qt "
+                                     "on recorded f3 transcripts.");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"corpus", "Directory holding the f3 transcripts.", "dir", F3_BENCH_CORPUS},
+        {"filter", "Only run benchmarks whose name contains <text>.", "text"},
+        {"min-time", "Minimum time spent on each benchmark in milliseconds.", "ms",
+         QString::number(F3_BENCH_MIN_TIME)},
+    });
+    parser.process(app);
+
+    QTextStream err(stderr);
+    QDir corpus(parser.value("corpus"));
+    QVector<f3_bench_transcript> transcripts;
+    const QFileInfoList files = corpus.entryInfoList(QStringList("*.txt"), QDir::Files, QDir::Name);
+    for (const QFileInfo& file : files)
+    {
+        f3_bench_transcript transcript;
+        if (f3_bench_load(file, transcript))
+            transcripts.append(transcript);
+        else
+            err << "Skipping " << file.fileName() << "\n";
+    }
+    if (transcripts.isEmpty())
+    {
+        err << "No transcripts found in " << corpus.path() << "\n";
+        return 1;
+    }
+
+    f3_bench bench(parser.value("filter"), qMax(1LL, parser.value("min-time").toLongLong()));
+    volatile qint64 sink = 0;
+
+    // Lines as the launcher keeps them, the result tags sit near the end
+    const QString writeLine = "Average writing speed: 18.23 MB/s";
+    const QString readLine = "Average reading speed: 19.07 MB/s";
+    const QString probeOutput = "Announced size: 15.00 GB (31457280 sectors)\n"
+                                "*Usable* size: 7.51 GB (15740928 sectors)\n"
+                                "Physical block size: 512.00 Byte (2^9 Bytes)\n";
+    bench.run("f3_get_line_result/write-speed", [&]() {
+        sink += f3_get_line_result(writeLine, "Average writing speed:").size();
+    });
+    bench.run("f3_get_line_result/read-speed", [&]() {
+        sink += f3_get_line_result(readLine, "Average reading speed:").size();
+    });
+    bench.run("f3_get_line_result/usable-size", [&]() {
+        sink += f3_get_line_result(probeOutput, "*Usable* size:").size();
+    });
+    bench.run("f3_capacity_ratio", [&]() {
+        sink += qint64(f3_capacity_ratio("7.51 GB", "15.00 GB") * 100);
+    });
+    bench.run("f3_capacity_string", [&]() {
+        sink += f3_capacity_string(Q_INT64_C(8064655360)).size();
+    });
+    bench.run("f3_operation_speed/write", [&]() {
+        sink += f3_operation_speed("32.37s / 28802 = 1.12ms", 512).size();
+    });
+    bench.run("f3_operation_speed/read", [&]() {
+        sink += f3_operation_speed("1'08\" / 259072 = 262us", 512).size();
+    });
+
+    const QByteArray progress = "Validating file 3.h2w ...  32.50% -- 18.52 MB/s -- 0:50";
+    bench.run("f3_parse_progress", [&]() {
+        sink += f3_parse_progress(progress);
+    });
+
+    f3_launcher launcher;
+    for (const f3_bench_transcript& transcript : transcripts)
+    {
+        f3_output_tokenizer tokenizer;
+        bench.run("tokenizer/" + transcript.name, [&]() {
+            tokenizer.clear();
+            tokenizer.feed(transcript.output, [&](const QByteArray& line) {
+                sink += line.size();
+            });
+            tokenizer.flush([&](const QByteArray& line) {
+                sink += line.size();
+            });
+        });
+
+        launcher.setOption("mode", transcript.mode);
+        bench.run("parse/" + transcript.name, [&]() {
+            launcher.loadTranscript(transcript.stage, transcript.output, QByteArray(), 0);
+        });
+        bench.run("report/" + transcript.name, [&]() {
+            sink += launcher.getReport().ActualFree.size();
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,349 @@
+#include "f3_broadcast.h"
+#include "f3_checkpoint.h"
+#include "f3_io.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// Where write() is with one target
+struct f3_broadcast_state
+{
+    int fd = -1;
+    qint64 total = 0;       // free space, aligned
+    qint64 written = 0;
+    qint64 expected = 0;    // of the file being written
+    qint64 size = 0;        // less than expected once the disk is full
+    bool done = false;
+    f3_file_stats stats;
+    f3_checkpoint checkpoint;
+};
+
+f3_broadcast::f3_broadcast() :
+    blockSize(F3_ENGINE_DEFAULT_BLOCK),
+    directIO(true),
+    queueDepth(F3_IO_DEFAULT_DEPTH),
+    backend("auto"),
+    cancelled(false),
+    errorNumber(0)
+{
+}
+
+void f3_broadcast::setTargets(const QStringList& paths)
+{
+    targets.clear();
+    for (const QString& path : paths)
+    {
+        f3_broadcast_target target;
+        target.path = path;
+        targets.append(target);
+    }
+}
+
+void f3_broadcast::setBlockSize(qint64 size)
+{
+    size -= size % F3_ENGINE_ALIGNMENT;
+    if (size > 0)
+        blockSize = size;
+}
+
+void f3_broadcast::setDirectIO(bool enabled)
+{
+    directIO = enabled;
+}
+
+// Blocks filled ahead; each has a request in flight per target
+void f3_broadcast::setQueueDepth(int depth)
+{
+    queueDepth = qBound(1, depth, F3_IO_MAX_DEPTH);
+}
+
+void f3_broadcast::setBackend(const QString& name)
+{
+    backend = name;
+}
+
+void f3_broadcast::setCallbacks(const f3_broadcast_callbacks& callbacks)
+{
+    this->callbacks = callbacks;
+}
+
+void f3_broadcast::cancel()
+{
+    cancelled = true;
+}
+
+int f3_broadcast::getError() const
+{
+    return errorNumber;
+}
+
+const QVector<f3_broadcast_target>& f3_broadcast::getTargets() const
+{
+    return targets;
+}
+
+bool f3_broadcast::fail(int error)
+{
+    errorNumber = error;
+    return false;
+}
+
+bool f3_broadcast::write()
+{
+    cancelled = false;
+    errorNumber = 0;
+    const int count = targets.size();
+    if (count == 0)
+        return fail(EINVAL);
+
+    // Each target starts over like f3_engine::write() without resume, but
+    // always keeps a checkpoint to hand the verify over with
+    QVector<f3_broadcast_state> states(count);
+    qint64 total = 0;
+    for (int t = 0; t < count; t++)
+    {
+        f3_broadcast_target& target = targets[t];
+        f3_broadcast_state& state = states[t];
+        target = f3_broadcast_target{target.path};
+        QDir dir(target.path);
+        if (!dir.exists())
+        {
+            target.error = QFileInfo::exists(target.path) ? ENOTDIR : ENOENT;
+            continue;
+        }
+        for (qint64 number : f3_engine_file_numbers(dir))
+            dir.remove(f3_engine_file_name(number));
+        f3_checkpoint::discard(target.path);
+
+        QStorageInfo storage(target.path);
+        storage.refresh();
+        if (!state.checkpoint.create(target.path, storage.bytesAvailable()))
+        {
+            target.error = EIO;
+            continue;
+        }
+        storage.refresh();
+        target.freeSpace = storage.bytesAvailable();
+        state.checkpoint.setFreeSpace(target.freeSpace);
+        state.checkpoint.save();
+        state.total = target.freeSpace - target.freeSpace % F3_ENGINE_ALIGNMENT;
+        if (state.total <= 0)
+            target.error = ENOSPC;
+        else
+            total += state.total;
+    }
+
+    f3_engine_buffers buffers;
+    if (!buffers.allocate(queueDepth, blockSize))
+        return fail(ENOMEM);
+    QScopedPointer<f3_io> io(f3_io_create(backend, queueDepth * count));
+    io->registerBuffers(buffers.data(), buffers.count(), blockSize);
+    const int depth = io->getQueueDepth();
+    QVector<f3_io_request> requests(depth);
+    QVector<int> requestTarget(depth);
+    QVector<int> pending(buffers.count());
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 transferred = 0;
+    for (qint64 number = 1; !cancelled; number++)
+    {
+        qint64 longest = 0;
+        for (int t = 0; t < count; t++)
+        {
+            f3_broadcast_state& state = states[t];
+            if (state.done || targets.at(t).error != 0)
+                continue;
+            state.expected = qMin<qint64>(F3_FILE_SIZE, state.total - state.written);
+            state.size = state.expected;
+            state.stats = f3_file_stats();
+            state.stats.number = number;
+            bool direct = directIO;
+            state.fd = f3_engine_open(QDir(targets.at(t).path).filePath(f3_engine_file_name(number)),
+                                      O_WRONLY | O_CREAT | O_TRUNC, direct);
+            if (state.fd < 0)
+                targets[t].error = errno;
+            else
+                longest = qMax(longest, state.size);
+        }
+        if (longest == 0)
+            break;
+
+        QElapsedTimer fileTimer;
+        fileTimer.start();
+        const quint64 base = f3_file_offset(number);
+        QVector<int> idle;
+        for (int i = buffers.count() - 1; i >= 0; i--)
+            idle.append(i);
+        QVector<int> freeRequests;
+        for (int i = depth - 1; i >= 0; i--)
+            freeRequests.append(i);
+        int current = -1;
+        qint64 currentOffset = 0;
+        qint64 currentSize = 0;
+        int nextTarget = 0;
+        qint64 next = 0;
+        int inflight = 0;
+
+        forever
+        {
+            while (inflight < depth && !cancelled)
+            {
+                // The pattern of a block is made once, the shorter files
+                // take a prefix of it
+                if (current < 0)
+                {
+                    if (idle.isEmpty() || next >= longest)
+                        break;
+                    current = idle.takeLast();
+                    currentOffset = next;
+                    currentSize = qMin(blockSize, longest - next);
+                    f3_pattern_fill(buffers.at(current), currentSize, base + quint64(next));
+                    next += currentSize;
+                    nextTarget = 0;
+                }
+                while (nextTarget < count &&
+                       (states.at(nextTarget).fd < 0 || targets.at(nextTarget).error != 0 ||
+                        currentOffset >= states.at(nextTarget).size))
+                    nextTarget++;
+                if (nextTarget == count)
+                {
+                    if (pending.at(current) == 0)
+                        idle.append(current);
+                    current = -1;
+                    continue;
+                }
+
+                const int t = nextTarget++;
+                const int index = freeRequests.takeLast();
+                f3_io_request& request = requests[index];
+                request.fd = states.at(t).fd;
+                request.write = true;
+                request.buffer = buffers.at(current);
+                request.bufferIndex = current;
+                request.size = qMin(currentSize, states.at(t).size - currentOffset);
+                request.offset = currentOffset;
+                request.tag = quint64(index);
+                requestTarget[index] = t;
+                int error = io->submit(request);
+                if (error != 0)
+                {
+                    freeRequests.append(index);
+                    targets[t].error = error;
+                    continue;
+                }
+                pending[current]++;
+                inflight++;
+            }
+            // Requests still in flight own their buffers, wait for them even
+            // after a failure or a cancel
+            if (inflight == 0)
+                break;
+
+            f3_io_completion completion;
+            int failure = io->complete(completion);
+            if (failure != 0)
+            {
+                for (f3_broadcast_state& state : states)
+                {
+                    if (state.fd >= 0)
+                        ::close(state.fd);
+                }
+                return fail(failure);
+            }
+            inflight--;
+            const int index = int(completion.tag);
+            const f3_io_request& request = requests.at(index);
+            const int t = requestTarget.at(index);
+            f3_broadcast_state& state = states[t];
+            qint64 done = completion.result;
+            if ((done == -EINTR || done == -EAGAIN) && targets.at(t).error == 0 && !cancelled)
+            {
+                int error = io->submit(request);
+                if (error == 0)
+                {
+                    inflight++;
+                    continue;
+                }
+                targets[t].error = error;
+            }
+            else if (done < 0 && done != -ENOSPC)
+                targets[t].error = int(-done);
+            else
+            {
+                // Like f3_engine, the file ends where the first write fell short
+                done = qMax<qint64>(done, 0);
+                if (done < request.size)
+                    state.size = qMin(state.size, request.offset + done);
+                state.stats.size += done;
+                transferred += done;
+                if (done > 0 && callbacks.progress)
+                    callbacks.progress(transferred, total);
+            }
+
+            const int buffer = request.bufferIndex;
+            if (--pending[buffer] == 0 && buffer != current)
+                idle.append(buffer);
+            freeRequests.append(index);
+        }
+
+        for (int t = 0; t < count; t++)
+        {
+            f3_broadcast_state& state = states[t];
+            f3_broadcast_target& target = targets[t];
+            if (state.fd < 0)
+                continue;
+            // A dropped target keeps its checkpoint at the last whole file
+            if (target.error != 0 || cancelled)
+            {
+                ::close(state.fd);
+                state.fd = -1;
+                continue;
+            }
+            // Writes past the point where the disk filled up may still have
+            // landed, drop them so the file has no holes
+            if (state.stats.size > state.size)
+            {
+                transferred -= state.stats.size - state.size;
+                state.stats.size = state.size;
+                if (ftruncate(state.fd, state.size) != 0)
+                    target.error = errno;
+            }
+            fdatasync(state.fd);
+            f3_engine_drop_cache(state.fd);
+            ::close(state.fd);
+            state.fd = -1;
+            if (target.error != 0)
+                continue;
+
+            state.stats.elapsedMs = fileTimer.elapsed();
+            state.written += state.stats.size;
+            target.bytesWritten = state.written;
+            if (callbacks.fileWritten)
+                callbacks.fileWritten(t, state.stats);
+            state.checkpoint.fileWritten(state.stats);
+            if (state.size < state.expected || state.written >= state.total)
+            {
+                state.done = true;
+                state.checkpoint.setWriteComplete();
+                target.writeMs = timer.elapsed();
+            }
+            state.checkpoint.save();
+        }
+    }
+
+    if (cancelled)
+        return fail(ECANCELED);
+    for (const f3_broadcast_target& target : targets)
+    {
+        if (target.error == 0)
+            return true;
+    }
+    return fail(targets.at(0).error);
+}
@@ -0,0 +1,61 @@
+#ifndef F3_BROADCAST_H
+#define F3_BROADCAST_H
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <atomic>
+#include <functional>
+#include "f3_engine.h"
+
+struct f3_broadcast_target
+{
+    QString path;
+    int error = 0;          // errno that dropped the target, 0 if none
+    qint64 freeSpace = 0;
+    qint64 bytesWritten = 0;
+    qint64 writeMs = 0;     // until its last file was closed
+};
+
+// Called from the thread running f3_broadcast::write().
+struct f3_broadcast_callbacks
+{
+    std::function<void(qint64 done, qint64 total)> progress;
+    std::function<void(int target, const f3_file_stats& stats)> fileWritten;
+};
+
+// Native write pass to several directories at once. The pattern only
+// depends on the offset, so each block is filled once and the same buffer
+// goes to every target that still has room for it; filling costs the same
+// for one device or thirty. Each target gets the *.h2w files f3_engine
+// would write and a finished f3_checkpoint, an f3_engine resuming from it
+// goes straight to the verify. A target that fails is dropped and its
+// checkpoint keeps what it had written, the others carry on.
+class f3_broadcast
+{
+public:
+    f3_broadcast();
+    void setTargets(const QStringList& paths);
+    void setBlockSize(qint64 size);
+    void setDirectIO(bool enabled);
+    void setQueueDepth(int depth);
+    void setBackend(const QString& name);
+    void setCallbacks(const f3_broadcast_callbacks& callbacks);
+    bool write();
+    void cancel();
+    int getError() const;
+    const QVector<f3_broadcast_target>& getTargets() const;
+
+private:
+    qint64 blockSize;
+    bool directIO;
+    int queueDepth;
+    QString backend;
+    std::atomic<bool> cancelled;
+    std::atomic<int> errorNumber;
+    f3_broadcast_callbacks callbacks;
+    QVector<f3_broadcast_target> targets;
+
+    bool fail(int error);
+};
+
+#endif // F3_BROADCAST_H
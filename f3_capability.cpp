@@ -0,0 +1,191 @@
+#include "f3_capability.h"
+#include "f3_launcher.h"
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QStringList>
+
+#define F3_VERSION_TAG1 "Copyright (C)"
+#define F3_VERSION_TAG2 "F3 read"
+
+#define F3_CAPABILITY_GROUP "capabilities"
+#define F3_CAPABILITY_MISSING 255
+
+enum
+{
+    F3_CAPABILITY_WRITE = 0,
+    F3_CAPABILITY_READ,
+    F3_CAPABILITY_PROBE,
+    F3_CAPABILITY_FIX,
+    F3_CAPABILITY_COUNT
+};
+
+static const char *f3_capability_commands[F3_CAPABILITY_COUNT] = {
+    F3_WRITE_COMMAND, F3_READ_COMMAND, F3_PROBE_COMMAND, F3_FIX_COMMAND
+};
+
+
+f3_capability *f3_capability::instance()
+{
+    static f3_capability *capability = new f3_capability;
+    return capability;
+}
+
+f3_capability::f3_capability(QObject *parent) :
+    QObject(parent),
+    ready(false),
+    probing(false),
+    pending(0)
+{
+    // Same lookup order as always: next to the program first, then PATH
+    capabilities.path = "./";
+    if (resolve(capabilities.path, F3_WRITE_COMMAND).isEmpty() ||
+        resolve(capabilities.path, F3_READ_COMMAND).isEmpty())
+        capabilities.path = "";
+    cacheKey = makeCacheKey(capabilities.path);
+    ready = loadCache();
+}
+
+bool f3_capability::isReady()
+{
+    return ready;
+}
+
+f3_capabilities f3_capability::get()
+{
+    return capabilities;
+}
+
+void f3_capability::probe()
+{
+    if (ready)
+    {
+        QMetaObject::invokeMethod(this, [this]() {
+            emit f3_capability_ready(capabilities);
+        }, Qt::QueuedConnection);
+        return;
+    }
+    if (probing)
+        return;
+
+    probing = true;
+    processes.fill(nullptr, F3_CAPABILITY_COUNT);
+    exitCodes.fill(F3_CAPABILITY_MISSING, F3_CAPABILITY_COUNT);
+    versionOutput.clear();
+    pending = F3_CAPABILITY_COUNT;
+    for (int i = 0; i < F3_CAPABILITY_COUNT; i++)
+    {
+        if (resolve(capabilities.path, f3_capability_commands[i]).isEmpty())
+        {
+            pending--;
+            continue;
+        }
+
+        QProcess *process = new QProcess(this);
+        processes[i] = process;
+#if (QT_VERSION >= QT_VERSION_CHECK(5,6,0))
+        connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, [this, i](int exitCode) {
+            finishProcess(i, exitCode);
+        });
+#else
+        connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, [this, i](int exitCode) {
+            finishProcess(i, exitCode);
+        });
+#endif
+        connect(process, &QProcess::errorOccurred, this, [this, i](QProcess::ProcessError error) {
+            if (error == QProcess::FailedToStart)
+                finishProcess(i, F3_CAPABILITY_MISSING);
+        });
+        process->start(QString(f3_capability_commands[i]).prepend(capabilities.path), QStringList());
+    }
+    if (pending == 0)
+        complete();
+}
+
+QString f3_capability::resolve(const QString& prefix, const QString& command)
+{
+    if (prefix.isEmpty())
+        return QStandardPaths::findExecutable(command);
+    QFileInfo info(prefix + command);
+    if (info.isFile() && info.isExecutable())
+        return info.absoluteFilePath();
+    return QString();
+}
+
+QString f3_capability::makeCacheKey(const QString& prefix)
+{
+    QStringList parts;
+    for (const char *command : f3_capability_commands)
+    {
+        QString file = resolve(prefix, command);
+        if (file.isEmpty())
+            parts << QString("-");
+        else
+            parts << file + '@' + QString::number(QFileInfo(file).lastModified().toMSecsSinceEpoch());
+    }
+    return parts.join('|');
+}
+
+bool f3_capability::loadCache()
+{
+    QSettings settings("ChickenLegsOz", "F3-Qt");
+    settings.beginGroup(F3_CAPABILITY_GROUP);
+    if (settings.value("key").toString() != cacheKey)
+        return false;
+    capabilities.version = settings.value("version").toFloat();
+    capabilities.quick = settings.value("quick").toBool();
+    capabilities.fix = settings.value("fix").toBool();
+    capabilities.progress = settings.value("progress").toBool();
+    return true;
+}
+
+void f3_capability::saveCache()
+{
+    QSettings settings("ChickenLegsOz", "F3-Qt");
+    settings.beginGroup(F3_CAPABILITY_GROUP);
+    settings.setValue("key", cacheKey);
+    settings.setValue("version", capabilities.version);
+    settings.setValue("quick", capabilities.quick);
+    settings.setValue("fix", capabilities.fix);
+    settings.setValue("progress", capabilities.progress);
+}
+
+void f3_capability::finishProcess(int index, int exitCode)
+{
+    QProcess *process = processes[index];
+    if (!process)
+        return;
+    processes[index] = nullptr;
+
+    exitCodes[index] = exitCode;
+    if (index == F3_CAPABILITY_READ)
+        versionOutput = process->readAllStandardError();
+    process->deleteLater();
+
+    if (--pending == 0)
+        complete();
+}
+
+void f3_capability::complete()
+{
+    float version = 0;
+    if (exitCodes[F3_CAPABILITY_WRITE] != F3_CAPABILITY_MISSING &&
+        exitCodes[F3_CAPABILITY_READ] != F3_CAPABILITY_MISSING)
+    {
+        // Versions before 6.1 do not print a header
+        if (versionOutput.indexOf(F3_VERSION_TAG1) > 0)
+            version = f3_get_line_result(versionOutput, F3_VERSION_TAG2).toFloat();
+        else
+            version = 6.1f;
+    }
+
+    capabilities.version = version;
+    capabilities.quick = version >= 4.0f && exitCodes[F3_CAPABILITY_PROBE] != F3_CAPABILITY_MISSING;
+    capabilities.fix = version >= 5.0f && exitCodes[F3_CAPABILITY_FIX] != F3_CAPABILITY_MISSING;
+    capabilities.progress = version > 6.0f;
+    probing = false;
+    ready = true;
+    saveCache();
+    emit f3_capability_ready(capabilities);
+}
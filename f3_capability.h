@@ -0,0 +1,58 @@
+#ifndef F3_CAPABILITY_H
+#define F3_CAPABILITY_H
+#include <QObject>
+#include <QString>
+#include <QProcess>
+#include <QVector>
+
+#define F3_READ_COMMAND "f3read"
+#define F3_WRITE_COMMAND "f3write"
+#define F3_PROBE_COMMAND "f3probe"
+#define F3_FIX_COMMAND "f3fix"
+
+struct f3_capabilities
+{
+    QString path;           // prefix the f3 commands are started with
+    float version = 0;      // 0 if f3write/f3read cannot be run
+    bool quick = false;
+    bool fix = false;
+    bool progress = false;
+};
+
+// Finds out which f3 tools are installed and what they support. The answer
+// is kept on disk keyed by the path and mtime of each binary, so only the
+// first start after f3 changed has to launch the tools, all at once and
+// without blocking.
+class f3_capability : public QObject
+{
+    Q_OBJECT
+
+public:
+    static f3_capability *instance();
+    bool isReady();
+    f3_capabilities get();
+    void probe();
+
+signals:
+    void f3_capability_ready(const f3_capabilities& capabilities);
+
+private:
+    explicit f3_capability(QObject *parent = nullptr);
+    bool ready;
+    bool probing;
+    f3_capabilities capabilities;
+    QString cacheKey;
+    QVector<QProcess*> processes;
+    QVector<int> exitCodes;
+    QString versionOutput;
+    int pending;
+
+    QString resolve(const QString& prefix, const QString& command);
+    QString makeCacheKey(const QString& prefix);
+    bool loadCache();
+    void saveCache();
+    void finishProcess(int index, int exitCode);
+    void complete();
+};
+
+#endif // F3_CAPABILITY_H
@@ -0,0 +1,195 @@
+#include "f3_chart.h"
+#include "f3_launcher.h"
+#include <QPainter>
+#include <QPainterPath>
+
+#define F3_CHART_MARGIN 6
+#define F3_CHART_WRITE_COLOR QColor(52, 120, 210)
+#define F3_CHART_READ_COLOR QColor(60, 180, 90)
+#define F3_CHART_LOST_COLOR QColor(220, 60, 60, 80)
+#define F3_CHART_STRIP_HEIGHT 6
+
+
+static QColor f3_chart_region_color(F3Region kind)
+{
+    switch(kind)
+    {
+        case F3Region::Good:
+            return QColor(75, 226, 110);
+        case F3Region::Changed:
+            return QColor(240, 200, 60);
+        case F3Region::Overwritten:
+            return QColor(240, 130, 40);
+        case F3Region::Corrupted:
+            return QColor(220, 60, 60);
+        default:
+            return QColor(200, 200, 200);
+    }
+}
+
+
+f3_chart::f3_chart(QWidget *parent) :
+    QWidget(parent),
+    buckets(F3_CHART_BUCKETS),
+    bucketSpan(F3_FILE_SIZE),
+    end(0)
+{
+}
+
+void f3_chart::clear()
+{
+    buckets.fill(bucket());
+    strip.clear();
+    bucketSpan = F3_FILE_SIZE;
+    end = 0;
+    update();
+}
+
+void f3_chart::addWrite(qint64 offset, qint64 size, qint64 ms)
+{
+    bucket& target = bucketAt(offset, size);
+    target.writeBytes += size;
+    target.writeMs += ms;
+    update();
+}
+
+void f3_chart::addRead(qint64 offset, qint64 size, qint64 ms, qint64 lostBytes)
+{
+    bucket& target = bucketAt(offset, size);
+    target.readBytes += size;
+    target.readMs += ms;
+    target.lostBytes += lostBytes;
+    update();
+}
+
+void f3_chart::setRegions(const f3_region_map& regions)
+{
+    strip = regions.summarize(F3_CHART_BUCKETS);
+    if (regions.isEmpty())
+        strip.clear();
+    update();
+}
+
+QSize f3_chart::sizeHint() const
+{
+    return QSize(360, 140);
+}
+
+QSize f3_chart::minimumSizeHint() const
+{
+    return QSize(160, 80);
+}
+
+// A file goes into the bucket it starts in, f3 files are never smaller
+// than a bucket
+f3_chart::bucket& f3_chart::bucketAt(qint64 offset, qint64 size)
+{
+    end = qMax(end, offset + size);
+    while (offset / bucketSpan >= buckets.size())
+        fold();
+    return buckets[int(offset / bucketSpan)];
+}
+
+void f3_chart::fold()
+{
+    const int half = buckets.size() / 2;
+    for (int i = 0; i < half; i++)
+    {
+        bucket& merged = buckets[i];
+        merged = buckets.at(i * 2);
+        const bucket& next = buckets.at(i * 2 + 1);
+        merged.writeBytes += next.writeBytes;
+        merged.writeMs += next.writeMs;
+        merged.readBytes += next.readBytes;
+        merged.readMs += next.readMs;
+        merged.lostBytes += next.lostBytes;
+    }
+    for (int i = half; i < buckets.size(); i++)
+        buckets[i] = bucket();
+    bucketSpan *= 2;
+}
+
+void f3_chart::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+    QRect area = rect().adjusted(F3_CHART_MARGIN, F3_CHART_MARGIN, -F3_CHART_MARGIN, -F3_CHART_MARGIN);
+    painter.fillRect(rect(), palette().base());
+    if (!strip.isEmpty())
+    {
+        const double slot = double(area.width()) / strip.size();
+        for (int i = 0; i < strip.size(); i++)
+            painter.fillRect(QRectF(area.left() + slot * i, area.bottom() - F3_CHART_STRIP_HEIGHT,
+                                    slot + 1, F3_CHART_STRIP_HEIGHT),
+                             f3_chart_region_color(strip.at(i)));
+        area.setBottom(area.bottom() - F3_CHART_STRIP_HEIGHT - 2);
+    }
+    painter.setPen(palette().mid().color());
+    painter.drawRect(area);
+
+    const int used = int((end + bucketSpan - 1) / bucketSpan);
+    qint64 top = 0;
+    for (int i = 0; i < used; i++)
+    {
+        const bucket& current = buckets.at(i);
+        if (current.writeMs > 0)
+            top = qMax(top, current.writeBytes * 1000 / current.writeMs);
+        if (current.readMs > 0)
+            top = qMax(top, current.readBytes * 1000 / current.readMs);
+    }
+    painter.setPen(palette().text().color());
+    // The probes have a region map but no per-file throughput
+    if (top == 0)
+    {
+        if (strip.isEmpty())
+            painter.drawText(area, Qt::AlignCenter, "Waiting for data...");
+        return;
+    }
+
+    // Buckets stretch over the width, the fastest one reaches the top
+    const double width = double(area.width()) / used;
+    auto pointAt = [&](int i, qint64 speed) {
+        return QPointF(area.left() + width * (i + 0.5),
+                       area.bottom() - double(area.height()) * speed / top);
+    };
+    QPainterPath writePath;
+    QPainterPath readPath;
+    for (int i = 0; i < used; i++)
+    {
+        const bucket& current = buckets.at(i);
+        if (current.lostBytes > 0)
+            painter.fillRect(QRectF(area.left() + width * i, area.top(), width, area.height()),
+                             F3_CHART_LOST_COLOR);
+        if (current.writeMs > 0)
+        {
+            QPointF point = pointAt(i, current.writeBytes * 1000 / current.writeMs);
+            if (writePath.elementCount() == 0)
+                writePath.moveTo(point);
+            else
+                writePath.lineTo(point);
+        }
+        if (current.readMs > 0)
+        {
+            QPointF point = pointAt(i, current.readBytes * 1000 / current.readMs);
+            if (readPath.elementCount() == 0)
+                readPath.moveTo(point);
+            else
+                readPath.lineTo(point);
+        }
+    }
+    painter.setPen(QPen(F3_CHART_WRITE_COLOR, 2));
+    painter.drawPath(writePath);
+    painter.setPen(QPen(F3_CHART_READ_COLOR, 2));
+    painter.drawPath(readPath);
+
+    QRect labels = area.adjusted(4, 2, -4, -2);
+    painter.setPen(palette().text().color());
+    painter.drawText(labels, Qt::AlignLeft | Qt::AlignTop, f3_capacity_string(top).append("/s"));
+    painter.drawText(labels, Qt::AlignRight | Qt::AlignBottom, f3_capacity_string(end));
+    painter.setPen(F3_CHART_WRITE_COLOR);
+    painter.drawText(labels, Qt::AlignRight | Qt::AlignTop, "Write");
+    painter.setPen(F3_CHART_READ_COLOR);
+    painter.drawText(labels.adjusted(0, painter.fontMetrics().height(), 0, 0),
+                     Qt::AlignRight | Qt::AlignTop, "Read");
+}
@@ -0,0 +1,48 @@
+#ifndef F3_CHART_H
+#define F3_CHART_H
+#include <QWidget>
+#include <QVector>
+#include "f3_region_map.h"
+
+#define F3_CHART_BUCKETS 512
+
+// Write and read throughput against the offset on the device, drawn as
+// the files come in. The offsets are kept in a fixed number of buckets;
+// once they run out two neighbours are merged and each bucket covers
+// twice the space, so any size of device costs the same memory. A strip
+// along the bottom shows the region map of a finished check.
+class f3_chart : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit f3_chart(QWidget *parent = nullptr);
+    void clear();
+    void addWrite(qint64 offset, qint64 size, qint64 ms);
+    void addRead(qint64 offset, qint64 size, qint64 ms, qint64 lostBytes);
+    void setRegions(const f3_region_map& regions);
+    QSize sizeHint() const override;
+    QSize minimumSizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    struct bucket
+    {
+        qint64 writeBytes = 0;
+        qint64 writeMs = 0;
+        qint64 readBytes = 0;
+        qint64 readMs = 0;
+        qint64 lostBytes = 0;
+    };
+    QVector<bucket> buckets;
+    QVector<F3Region> strip;
+    qint64 bucketSpan;
+    qint64 end;
+
+    bucket& bucketAt(qint64 offset, qint64 size);
+    void fold();
+};
+
+#endif // F3_CHART_H
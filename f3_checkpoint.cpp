@@ -0,0 +1,229 @@
+#include "f3_checkpoint.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <unistd.h>
+
+// Room for one written and one verified entry per file
+#define F3_CHECKPOINT_ENTRY_SIZE 256
+#define F3_CHECKPOINT_MIN_SIZE 4096
+
+
+static QJsonObject f3_checkpoint_entry(const f3_file_stats& stats, bool sectors)
+{
+    QJsonObject entry;
+    entry["number"] = double(stats.number);
+    entry["size"] = double(stats.size);
+    entry["ms"] = double(stats.elapsedMs);
+    if (sectors)
+    {
+        entry["ok"] = double(stats.sectors.ok);
+        entry["corrupted"] = double(stats.sectors.corrupted);
+        entry["changed"] = double(stats.sectors.changed);
+        entry["overwritten"] = double(stats.sectors.overwritten);
+    }
+    return entry;
+}
+
+static f3_file_stats f3_checkpoint_stats(const QJsonObject& entry)
+{
+    f3_file_stats stats;
+    stats.number = qint64(entry["number"].toDouble());
+    stats.size = qint64(entry["size"].toDouble());
+    stats.elapsedMs = qint64(entry["ms"].toDouble());
+    stats.sectors.ok = qint64(entry["ok"].toDouble());
+    stats.sectors.corrupted = qint64(entry["corrupted"].toDouble());
+    stats.sectors.changed = qint64(entry["changed"].toDouble());
+    stats.sectors.overwritten = qint64(entry["overwritten"].toDouble());
+    return stats;
+}
+
+f3_checkpoint::f3_checkpoint() :
+    freeSpace(0),
+    reserved(0),
+    writeComplete(false)
+{
+}
+
+bool f3_checkpoint::exists(const QString& path)
+{
+    return QFileInfo::exists(QDir(path).filePath(F3_CHECKPOINT_FILE));
+}
+
+void f3_checkpoint::discard(const QString& path)
+{
+    QFile::remove(QDir(path).filePath(F3_CHECKPOINT_FILE));
+}
+
+// Only the files still there as they were written are kept, counting up
+// from 1.h2w without a gap; anything after that gets written again
+bool f3_checkpoint::load(const QString& path)
+{
+    QDir dir(path);
+    fileName = dir.filePath(F3_CHECKPOINT_FILE);
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    reserved = file.size();
+    QJsonDocument document = QJsonDocument::fromJson(file.readAll());
+    QJsonObject manifest = document.object();
+    if (manifest["format"].toInt() != F3_CHECKPOINT_FORMAT)
+        return false;
+
+    freeSpace = qint64(manifest["freeSpace"].toDouble());
+    writeComplete = manifest["writeComplete"].toBool();
+    written.clear();
+    verified.clear();
+    const QJsonArray writtenList = manifest["written"].toArray();
+    for (const QJsonValue& value : writtenList)
+    {
+        f3_file_stats stats = f3_checkpoint_stats(value.toObject());
+        written.insert(stats.number, stats);
+    }
+    const QJsonArray verifiedList = manifest["verified"].toArray();
+    for (const QJsonValue& value : verifiedList)
+    {
+        f3_file_stats stats = f3_checkpoint_stats(value.toObject());
+        verified.insert(stats.number, stats);
+    }
+
+    qint64 number = 1;
+    for (auto i = written.constBegin(); i != written.constEnd(); ++i, number++)
+    {
+        QFileInfo info(dir.filePath(QString::number(number).append(".h2w")));
+        if (i.key() != number || !info.exists() || info.size() != i.value().size)
+            break;
+    }
+    while (!written.isEmpty() && written.lastKey() >= number)
+    {
+        written.remove(written.lastKey());
+        writeComplete = false;
+    }
+    while (!verified.isEmpty() && !written.contains(verified.lastKey()))
+        verified.remove(verified.lastKey());
+    return !written.isEmpty();
+}
+
+bool f3_checkpoint::create(const QString& path, qint64 freeSpace)
+{
+    fileName = QDir(path).filePath(F3_CHECKPOINT_FILE);
+    this->freeSpace = freeSpace;
+    writeComplete = false;
+    written.clear();
+    verified.clear();
+    reserved = qMax<qint64>(F3_CHECKPOINT_MIN_SIZE,
+                            (freeSpace / F3_FILE_SIZE + 2) * F3_CHECKPOINT_ENTRY_SIZE);
+    QFile::remove(fileName);
+    return save();
+}
+
+// Padded with blanks to the reserved size, so a later save needs no new
+// blocks on a full disk. A save cut short leaves a manifest that no longer
+// loads, the next check then starts over.
+bool f3_checkpoint::save()
+{
+    if (fileName.isEmpty())
+        return false;
+
+    QJsonArray writtenList;
+    for (const f3_file_stats& stats : written)
+        writtenList.append(f3_checkpoint_entry(stats, false));
+    QJsonArray verifiedList;
+    for (const f3_file_stats& stats : verified)
+        verifiedList.append(f3_checkpoint_entry(stats, true));
+    QJsonObject manifest;
+    manifest["format"] = F3_CHECKPOINT_FORMAT;
+    manifest["freeSpace"] = double(freeSpace);
+    manifest["writeComplete"] = writeComplete;
+    manifest["written"] = writtenList;
+    manifest["verified"] = verifiedList;
+    QByteArray data = QJsonDocument(manifest).toJson(QJsonDocument::Compact);
+    reserved = qMax<qint64>(reserved, data.size());
+    data.append(QByteArray(int(reserved - data.size()), ' '));
+
+    QFile file(fileName);
+    if (!file.open(QFile::ReadWrite))
+        return false;
+    bool ok = file.write(data) == data.size() && file.flush();
+    ok = ok && fdatasync(file.handle()) == 0;
+    file.close();
+    return ok;
+}
+
+qint64 f3_checkpoint::getFreeSpace() const
+{
+    return freeSpace;
+}
+
+void f3_checkpoint::setFreeSpace(qint64 size)
+{
+    freeSpace = size;
+}
+
+bool f3_checkpoint::isWriteComplete() const
+{
+    return writeComplete;
+}
+
+void f3_checkpoint::setWriteComplete()
+{
+    writeComplete = true;
+}
+
+// First file still to be written
+qint64 f3_checkpoint::resumeAt() const
+{
+    return written.isEmpty() ? 1 : written.lastKey() + 1;
+}
+
+// First written file still to be verified
+qint64 f3_checkpoint::verifyAt() const
+{
+    for (auto i = written.constBegin(); i != written.constEnd(); ++i)
+    {
+        if (!verified.contains(i.key()))
+            return i.key();
+    }
+    return resumeAt();
+}
+
+qint64 f3_checkpoint::writtenSize() const
+{
+    qint64 size = 0;
+    for (const f3_file_stats& stats : written)
+        size += stats.size;
+    return size;
+}
+
+bool f3_checkpoint::isVerified(qint64 number) const
+{
+    return verified.contains(number);
+}
+
+f3_file_stats f3_checkpoint::getVerified(qint64 number) const
+{
+    return verified.value(number);
+}
+
+f3_sector_stats f3_checkpoint::verifiedSectors() const
+{
+    f3_sector_stats sectors;
+    for (const f3_file_stats& stats : verified)
+        sectors += stats.sectors;
+    return sectors;
+}
+
+void f3_checkpoint::fileWritten(const f3_file_stats& stats)
+{
+    written.insert(stats.number, stats);
+    // Written again, an earlier result no longer holds
+    verified.remove(stats.number);
+}
+
+void f3_checkpoint::fileVerified(const f3_file_stats& stats)
+{
+    verified.insert(stats.number, stats);
+}
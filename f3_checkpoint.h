@@ -0,0 +1,46 @@
+#ifndef F3_CHECKPOINT_H
+#define F3_CHECKPOINT_H
+#include <QString>
+#include <QMap>
+#include "f3_engine.h"
+
+#define F3_CHECKPOINT_FILE "f3_qt_checkpoint.json"
+#define F3_CHECKPOINT_FORMAT 1
+
+// Manifest kept next to the *.h2w files: which ones were written in full
+// and which were verified with what result, so an interrupted check picks
+// up where it stopped. The disk is full by the time the last files are
+// written, so it is rewritten in place within space reserved up front.
+class f3_checkpoint
+{
+public:
+    f3_checkpoint();
+    bool load(const QString& path);
+    bool create(const QString& path, qint64 freeSpace);
+    bool save();
+    static bool exists(const QString& path);
+    static void discard(const QString& path);
+
+    qint64 getFreeSpace() const;
+    void setFreeSpace(qint64 size);
+    bool isWriteComplete() const;
+    void setWriteComplete();
+    qint64 resumeAt() const;
+    qint64 verifyAt() const;
+    qint64 writtenSize() const;
+    bool isVerified(qint64 number) const;
+    f3_file_stats getVerified(qint64 number) const;
+    f3_sector_stats verifiedSectors() const;
+    void fileWritten(const f3_file_stats& stats);
+    void fileVerified(const f3_file_stats& stats);
+
+private:
+    QString fileName;
+    qint64 freeSpace;
+    qint64 reserved;
+    bool writeComplete;
+    QMap<qint64, f3_file_stats> written;
+    QMap<qint64, f3_file_stats> verified;
+};
+
+#endif // F3_CHECKPOINT_H
@@ -0,0 +1,254 @@
+#include "f3_devices.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSocketNotifier>
+#include <QStorageInfo>
+#include <cstring>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#endif
+
+#define F3_DEVICES_UEVENT_SIZE 8192
+
+
+static QString f3_devices_read(const QDir& dir, const QString& fileName)
+{
+    QFile file(dir.filePath(fileName));
+    if (!file.open(QFile::ReadOnly))
+        return QString();
+    return QString::fromUtf8(file.readAll()).trimmed();
+}
+
+f3_devices::f3_devices(QObject *parent) :
+    QObject(parent),
+    sysRoot(F3_DEVICES_SYS_ROOT),
+    monitorFd(-1)
+{
+}
+
+f3_devices::~f3_devices()
+{
+    stopMonitor();
+}
+
+void f3_devices::setSysRoot(const QString& path)
+{
+    sysRoot = path;
+}
+
+QString f3_devices::getSysRoot() const
+{
+    return sysRoot;
+}
+
+void f3_devices::rescan()
+{
+    QMap<QString, f3_device> found;
+    const QStringList names = QDir(QDir(sysRoot).filePath("block")).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString& name : names)
+    {
+        f3_device device;
+        if (readDevice(sysRoot, name, device))
+            found[name] = device;
+    }
+
+    const QStringList known = devices.keys();
+    devices = found;
+    for (const QString& name : known)
+    {
+        if (!devices.contains(name))
+            emit f3_devices_removed(name);
+    }
+    for (auto i = devices.constBegin(); i != devices.constEnd(); ++i)
+        emit f3_devices_updated(i.key());
+}
+
+QVector<f3_device> f3_devices::getDevices() const
+{
+    QVector<f3_device> list;
+    for (const f3_device& device : devices)
+        list.append(device);
+    return list;
+}
+
+bool f3_devices::getDevice(const QString& name, f3_device& device) const
+{
+    auto i = devices.constFind(name);
+    if (i == devices.constEnd())
+        return false;
+    device = i.value();
+    return true;
+}
+
+// The USB device is the first directory up the device's real path that has
+// a bus number; the one above it is the hub it is plugged into
+bool f3_devices::readDevice(const QString& sysRoot, const QString& name, f3_device& device)
+{
+    const QDir block(QDir(sysRoot).filePath(QString("block/%1").arg(name)));
+    if (!block.exists("device"))
+        return false;
+
+    device = f3_device();
+    device.name = name;
+    device.path = QString("/dev/%1").arg(name);
+    // Always counted in 512 byte units, whatever the sector size
+    device.size = f3_devices_read(block, "size").toLongLong() * 512;
+    device.removable = f3_devices_read(block, "removable") == "1";
+    device.vendor = f3_devices_read(block, "device/vendor");
+    device.model = f3_devices_read(block, "device/model");
+    // SD cards behind mmc only have a name
+    if (device.model.isEmpty())
+        device.model = f3_devices_read(block, "device/name");
+    device.serial = f3_devices_read(block, "device/serial");
+
+    const QString root = QFileInfo(sysRoot).canonicalFilePath();
+    QString path = QFileInfo(block.filePath("device")).canonicalFilePath();
+    while (!root.isEmpty() && path.length() > root.length() && path.startsWith(root))
+    {
+        QDir dir(path);
+        if (dir.exists("busnum") && dir.exists("speed"))
+        {
+            device.usbBus = f3_devices_read(dir, "busnum").toInt();
+            // Low speed is "1.5"
+            device.usbSpeed = int(f3_devices_read(dir, "speed").toDouble());
+            device.usbBusSpeed = f3_devices_read(QDir(sysRoot),
+                QString("bus/usb/devices/usb%1/speed").arg(device.usbBus)).toInt();
+            device.usbPort = dir.dirName();
+            if (device.serial.isEmpty())
+                device.serial = f3_devices_read(dir, "serial");
+            if (device.vendor.isEmpty())
+                device.vendor = f3_devices_read(dir, "manufacturer");
+            if (device.model.isEmpty())
+                device.model = f3_devices_read(dir, "product");
+            QDir hub(QFileInfo(path).path());
+            if (hub.exists("busnum"))
+                device.usbHub = hub.dirName();
+            break;
+        }
+        path = QFileInfo(path).path();
+    }
+    return true;
+}
+
+// The disk a device node, a partition or a mounted directory is on,
+// empty when there is none
+QString f3_devices::diskName(const QString& sysRoot, const QString& path)
+{
+    QString node = QFileInfo(path).canonicalFilePath();
+    if (QFileInfo(node).isDir())
+        node = QString::fromLocal8Bit(QStorageInfo(node).device());
+    if (!node.startsWith("/dev/"))
+        return QString();
+
+    const QString entry = QDir(sysRoot).filePath(QString("class/block/%1").arg(node.section('/', -1)));
+    const QString real = QFileInfo(entry).canonicalFilePath();
+    if (real.isEmpty())
+        return QString();
+    QDir block(real);
+    // A partition sits in the directory of its disk
+    if (block.exists("partition"))
+        block.cdUp();
+    return block.dirName();
+}
+
+void f3_devices::refresh(const QString& name)
+{
+    f3_device device;
+    if (readDevice(sysRoot, name, device))
+    {
+        devices[name] = device;
+        emit f3_devices_updated(name);
+    }
+    else if (devices.remove(name) > 0)
+        emit f3_devices_removed(name);
+}
+
+// A kernel uevent: "action@devpath" and then KEY=value strings, each ended
+// by a NUL. Only whole disks are followed, "change" comes with a card put
+// into a reader.
+void f3_devices::handleUevent(const QByteArray& message)
+{
+    QMap<QByteArray, QByteArray> values;
+    const QList<QByteArray> fields = message.split('\0');
+    for (const QByteArray& field : fields)
+    {
+        int equals = field.indexOf('=');
+        if (equals > 0)
+            values[field.left(equals)] = field.mid(equals + 1);
+    }
+    if (values.value("SUBSYSTEM") != "block" || values.value("DEVTYPE") != "disk")
+        return;
+
+    QString name = QString::fromUtf8(values.value("DEVNAME"));
+    if (name.isEmpty())
+        name = QString::fromUtf8(values.value("DEVPATH")).section('/', -1);
+    name = name.section('/', -1);
+    if (name.isEmpty())
+        return;
+
+    if (values.value("ACTION") == "remove")
+    {
+        if (devices.remove(name) > 0)
+            emit f3_devices_removed(name);
+    }
+    else
+        refresh(name);
+}
+
+// Kernel uevents straight from netlink, no udev needed
+bool f3_devices::startMonitor()
+{
+#ifdef Q_OS_LINUX
+    if (monitorFd >= 0)
+        return true;
+    monitorFd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (monitorFd < 0)
+        return false;
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = 1;      // the kernel's own events
+    if (::bind(monitorFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        ::close(monitorFd);
+        monitorFd = -1;
+        return false;
+    }
+    monitor.reset(new QSocketNotifier(monitorFd, QSocketNotifier::Read));
+    connect(monitor.data(), &QSocketNotifier::activated, this, &f3_devices::readUevents);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void f3_devices::stopMonitor()
+{
+    monitor.reset();
+    if (monitorFd >= 0)
+        ::close(monitorFd);
+    monitorFd = -1;
+}
+
+void f3_devices::readUevents()
+{
+#ifdef Q_OS_LINUX
+    char buffer[F3_DEVICES_UEVENT_SIZE];
+    forever
+    {
+        struct sockaddr_nl sender;
+        socklen_t length = sizeof(sender);
+        ssize_t got = recvfrom(monitorFd, buffer, sizeof(buffer), 0,
+                               reinterpret_cast<struct sockaddr *>(&sender), &length);
+        if (got <= 0)
+            break;
+        // Anyone may send to the group, only the kernel is believed
+        if (sender.nl_pid != 0)
+            continue;
+        handleUevent(QByteArray(buffer, int(got)));
+    }
+#endif
+}
@@ -0,0 +1,66 @@
+#ifndef F3_DEVICES_H
+#define F3_DEVICES_H
+#include <QObject>
+#include <QMap>
+#include <QScopedPointer>
+#include <QString>
+#include <QVector>
+
+#define F3_DEVICES_SYS_ROOT "/sys"
+
+class QSocketNotifier;
+
+struct f3_device
+{
+    QString name;           // "sdb"
+    QString path;           // "/dev/sdb"
+    QString vendor;
+    QString model;
+    QString serial;
+    qint64 size = 0;
+    bool removable = false;
+    int usbBus = 0;         // 0 when not on USB
+    int usbSpeed = 0;       // negotiated link speed, Mbit/s
+    int usbBusSpeed = 0;    // of the root hub, what all devices on the bus share
+    QString usbPort;        // "2-1.3"
+    QString usbHub;         // the hub it hangs off, "2-1" or the root hub "usb2"
+};
+
+// Disks as sysfs describes them, read once and then kept up to date from
+// the kernel's uevents, so listing them costs nothing. Only block devices
+// with a device behind them count; loop, ram and device-mapper ones have
+// none. The root defaults to /sys and may be any directory laid out like
+// it, uevents can be fed in by hand the same way.
+class f3_devices : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit f3_devices(QObject *parent = nullptr);
+    ~f3_devices();
+    void setSysRoot(const QString& path);
+    QString getSysRoot() const;
+    void rescan();
+    bool startMonitor();
+    void stopMonitor();
+    QVector<f3_device> getDevices() const;
+    bool getDevice(const QString& name, f3_device& device) const;
+    void handleUevent(const QByteArray& message);
+    static bool readDevice(const QString& sysRoot, const QString& name, f3_device& device);
+    static QString diskName(const QString& sysRoot, const QString& path);
+
+signals:
+    void f3_devices_updated(const QString& name);
+    void f3_devices_removed(const QString& name);
+
+private:
+    QString sysRoot;
+    QMap<QString, f3_device> devices;
+    QScopedPointer<QSocketNotifier> monitor;
+    int monitorFd;
+
+    void refresh(const QString& name);
+    void readUevents();
+};
+
+#endif // F3_DEVICES_H
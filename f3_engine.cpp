@@ -0,0 +1,950 @@
+#include "f3_engine.h"
+#include "f3_checkpoint.h"
+#include "f3_io.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QQueue>
+#include <QRandomGenerator>
+#include <QScopedPointer>
+#include <QThread>
+#include <QWaitCondition>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#define F3_ENGINE_FILE_FILTER "*.h2w"
+#define F3_ENGINE_FILE_SUFFIX ".h2w"
+#define F3_ENGINE_SPOT_SIZE (Q_INT64_C(64) << 10)
+
+
+// Blocks that lost sectors are gone over once more sector by sector to
+// tell where
+static void f3_engine_map_block(f3_region_map& regions, const void *buffer, qint64 size,
+                                quint64 offset, const f3_sector_stats& block)
+{
+    size -= size % F3_SECTOR_SIZE;
+    if (block.lost() == 0)
+    {
+        regions.mark(qint64(offset), size, F3Region::Good);
+        return;
+    }
+    const char *p = static_cast<const char *>(buffer);
+    for (qint64 sector = 0; sector < size; sector += F3_SECTOR_SIZE)
+    {
+        f3_sector_stats stats;
+        f3_pattern_check(p + sector, F3_SECTOR_SIZE, offset + quint64(sector), stats);
+        F3Region kind = F3Region::Corrupted;
+        if (stats.ok > 0)
+            kind = F3Region::Good;
+        else if (stats.changed > 0)
+            kind = F3Region::Changed;
+        else if (stats.overwritten > 0)
+            kind = F3Region::Overwritten;
+        regions.mark(qint64(offset) + sector, F3_SECTOR_SIZE, kind);
+    }
+}
+
+int f3_engine_open(const QString& fileName, int flags, bool& direct)
+{
+    QByteArray name = QFile::encodeName(fileName);
+#ifdef O_DIRECT
+    if (direct)
+    {
+        int fd = ::open(name.constData(), flags | O_DIRECT, 0644);
+        // Filesystems like tmpfs refuse O_DIRECT, fall back to the page cache
+        if (fd >= 0 || errno != EINVAL)
+            return fd;
+    }
+#endif
+    direct = false;
+    return ::open(name.constData(), flags, 0644);
+}
+
+// Opened exclusively, so it cannot be mounted while the pattern replaces
+// its contents; fails with EBUSY if it already is
+static int f3_engine_open_device(const QString& device, int flags, bool direct, qint64& size)
+{
+    QByteArray name = QFile::encodeName(device);
+    struct stat info;
+    if (stat(name.constData(), &info) != 0)
+        return -1;
+    if (!S_ISBLK(info.st_mode))
+    {
+        errno = S_ISDIR(info.st_mode) ? EISDIR : ENOTBLK;
+        return -1;
+    }
+    flags |= O_EXCL;
+#ifdef O_DIRECT
+    if (direct)
+        flags |= O_DIRECT;
+#else
+    Q_UNUSED(direct);
+#endif
+    int fd = ::open(name.constData(), flags);
+    if (fd < 0)
+        return -1;
+
+#ifdef Q_OS_LINUX
+    quint64 bytes = 0;
+    if (ioctl(fd, BLKGETSIZE64, &bytes) != 0)
+    {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return -1;
+    }
+    size = qint64(bytes);
+#else
+    size = lseek(fd, 0, SEEK_END);
+#endif
+    size -= size % F3_SECTOR_SIZE;
+    return fd;
+}
+
+void f3_engine_drop_cache(int fd)
+{
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    Q_UNUSED(fd);
+#endif
+}
+
+QVector<qint64> f3_engine_file_numbers(const QDir& dir)
+{
+    QVector<qint64> numbers;
+    const QStringList fileList = dir.entryList(QStringList(F3_ENGINE_FILE_FILTER), QDir::Files);
+    for (const QString& fileName : fileList)
+    {
+        bool ok = false;
+        qint64 number = fileName.left(fileName.length() - int(strlen(F3_ENGINE_FILE_SUFFIX))).toLongLong(&ok);
+        if (ok && number > 0)
+            numbers.append(number);
+    }
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+QString f3_engine_file_name(qint64 number)
+{
+    return QString::number(number).append(F3_ENGINE_FILE_SUFFIX);
+}
+
+// Verifies the files handed over by f3_engine::write() on a thread of its
+// own, in the order they were written, and reports each right away. Later
+// writes may still hit the files verified before writing stopped, those
+// are read again in full by f3_engine::verify().
+class f3_engine_pipeline
+{
+public:
+    f3_engine_pipeline(f3_engine *engine, const QString& path,
+                       const std::function<void(const f3_file_stats& stats)>& fileVerified) :
+        engine(engine),
+        path(path),
+        fileVerified(fileVerified),
+        writing(true),
+        lostAt(-1),
+        error(0)
+    {
+        worker = QThread::create([this]() {
+            run();
+        });
+        worker->start();
+    }
+
+    ~f3_engine_pipeline()
+    {
+        mutex.lock();
+        queue.clear();
+        mutex.unlock();
+        finish();
+        delete worker;
+    }
+
+    void push(qint64 number)
+    {
+        QMutexLocker locker(&mutex);
+        queue.enqueue(number);
+        ready.wakeOne();
+    }
+
+    // Waits for the files still queued
+    void finish()
+    {
+        mutex.lock();
+        writing = false;
+        ready.wakeOne();
+        mutex.unlock();
+        worker->wait();
+    }
+
+    qint64 getLostAt()
+    {
+        QMutexLocker locker(&mutex);
+        return lostAt;
+    }
+
+    int getError()
+    {
+        QMutexLocker locker(&mutex);
+        return error;
+    }
+
+    // Only what was verified once writing had stopped
+    const QMap<qint64, f3_file_stats>& getVerifiedAfterWrite() const
+    {
+        return verifiedAfterWrite;
+    }
+
+private:
+    f3_engine *engine;
+    QString path;
+    std::function<void(const f3_file_stats& stats)> fileVerified;
+    QThread *worker;
+    QMutex mutex;
+    QWaitCondition ready;
+    QQueue<qint64> queue;
+    QMap<qint64, f3_file_stats> verifiedAfterWrite;
+    bool writing;
+    qint64 lostAt;
+    int error;
+
+    void run()
+    {
+        forever
+        {
+            mutex.lock();
+            while (queue.isEmpty() && writing)
+                ready.wait(&mutex);
+            if (queue.isEmpty())
+            {
+                mutex.unlock();
+                return;
+            }
+            qint64 number = queue.dequeue();
+            bool afterWrite = !writing;
+            mutex.unlock();
+
+            f3_file_stats stats;
+            int failure = engine->verifyFile(path, number, stats);
+            QMutexLocker locker(&mutex);
+            if (failure != 0)
+            {
+                error = failure;
+                return;
+            }
+            if (afterWrite)
+                verifiedAfterWrite.insert(number, stats);
+            if (stats.sectors.lost() > 0 && lostAt < 0)
+                lostAt = qint64(f3_file_offset(number)) + stats.sectors.ok * F3_SECTOR_SIZE;
+            if (fileVerified)
+                fileVerified(stats);
+        }
+    }
+};
+
+f3_engine::f3_engine() :
+    blockSize(F3_ENGINE_DEFAULT_BLOCK),
+    directIO(true),
+    queueDepth(F3_IO_DEFAULT_DEPTH),
+    backend("auto"),
+    failFast(false),
+    pipelined(false),
+    resume(false),
+    cancelled(false),
+    errorNumber(0)
+{
+}
+
+void f3_engine::setBlockSize(qint64 size)
+{
+    size -= size % F3_ENGINE_ALIGNMENT;
+    blockSize = qMax<qint64>(size, F3_ENGINE_ALIGNMENT);
+}
+
+qint64 f3_engine::getBlockSize() const
+{
+    return blockSize;
+}
+
+void f3_engine::setDirectIO(bool enabled)
+{
+    directIO = enabled;
+}
+
+void f3_engine::setQueueDepth(int depth)
+{
+    queueDepth = qBound(1, depth, F3_IO_MAX_DEPTH);
+}
+
+int f3_engine::getQueueDepth() const
+{
+    return queueDepth;
+}
+
+void f3_engine::setBackend(const QString& name)
+{
+    backend = name;
+}
+
+// Backend the last run ended up with, after any fallback
+QString f3_engine::getBackend() const
+{
+    return backendUsed;
+}
+
+void f3_engine::setFailFast(bool enabled)
+{
+    failFast = enabled;
+}
+
+void f3_engine::setPipelined(bool enabled)
+{
+    pipelined = enabled;
+}
+
+void f3_engine::setResume(bool enabled)
+{
+    resume = enabled;
+}
+
+void f3_engine::setCallbacks(const f3_engine_callbacks& callbacks)
+{
+    this->callbacks = callbacks;
+}
+
+void f3_engine::cancel()
+{
+    cancelled = true;
+}
+
+int f3_engine::getError() const
+{
+    return errorNumber;
+}
+
+const f3_engine_result& f3_engine::getResult() const
+{
+    return result;
+}
+
+bool f3_engine::fail(int error)
+{
+    errorNumber = error;
+    return false;
+}
+
+// The file is at position in fd, 0 but for the pieces of a raw device
+int f3_engine::transferFile(f3_io *io, const f3_engine_buffers& buffers, int fd, qint64 number,
+                            qint64 position, bool writing, qint64& size, qint64& transferred,
+                            qint64 total, f3_file_stats& stats)
+{
+    const int depth = qMin(buffers.count(), io->getQueueDepth());
+    const quint64 base = f3_file_offset(number);
+    QVector<f3_io_request> requests(depth);
+    QVector<int> idle;
+    for (int i = depth - 1; i >= 0; i--)
+        idle.append(i);
+    qint64 next = 0;
+    int inflight = 0;
+    int error = 0;
+
+    forever
+    {
+        while (!idle.isEmpty() && next < size && error == 0 && !cancelled)
+        {
+            int index = idle.takeLast();
+            f3_io_request& request = requests[index];
+            request.fd = fd;
+            request.write = writing;
+            request.buffer = buffers.at(index);
+            request.bufferIndex = index;
+            request.size = qMin(blockSize, size - next);
+            request.offset = position + next;
+            request.tag = quint64(index);
+            if (writing)
+                f3_pattern_fill(request.buffer, request.size, base + next);
+            error = io->submit(request);
+            if (error != 0)
+            {
+                idle.append(index);
+                break;
+            }
+            next += request.size;
+            inflight++;
+        }
+        // Requests still in flight own their buffers, wait for them even
+        // after a failure or a cancel
+        if (inflight == 0)
+            break;
+
+        f3_io_completion completion;
+        int failure = io->complete(completion);
+        if (failure != 0)
+            return failure;
+        inflight--;
+        int index = int(completion.tag);
+        f3_io_request& request = requests[index];
+        qint64 done = completion.result;
+        const quint64 at = base + quint64(request.offset - position);
+        bool resubmit = false;
+        if (done == -EINTR || done == -EAGAIN)
+            resubmit = true;
+        else if (writing)
+        {
+            if (done < 0 && done != -ENOSPC)
+                error = int(-done);
+            else
+            {
+                // The free space estimate was optimistic, the disk is full now.
+                // The file ends where the first write fell short.
+                done = qMax<qint64>(done, 0);
+                if (done < request.size)
+                    size = qMin(size, request.offset - position + done);
+                stats.size += done;
+                transferred += done;
+            }
+        }
+        else
+        {
+            if (done < 0)
+            {
+                // Unreadable block, count it as corrupted and move on like f3read
+                done = request.size;
+                stats.sectors.corrupted += done / F3_SECTOR_SIZE;
+                result.regions.mark(qint64(at), done, F3Region::Corrupted);
+            }
+            else
+            {
+                f3_sector_stats block;
+                f3_pattern_check(request.buffer, done, at, block);
+                stats.sectors += block;
+                f3_engine_map_block(result.regions, request.buffer, done, at, block);
+            }
+            stats.size += done;
+            transferred += done;
+
+            // Short read, fetch the rest of the block into the same buffer
+            if (done > 0 && done < request.size)
+            {
+                request.buffer = static_cast<char *>(request.buffer) + done;
+                request.offset += done;
+                request.size -= done;
+                resubmit = true;
+            }
+        }
+        if (done > 0 && total > 0 && callbacks.progress)
+            callbacks.progress(transferred, total);
+
+        if (resubmit && error == 0 && !cancelled)
+        {
+            error = io->submit(request);
+            if (error == 0)
+            {
+                inflight++;
+                continue;
+            }
+        }
+        idle.append(index);
+    }
+
+    if (error != 0)
+        return error;
+    if (cancelled)
+        return ECANCELED;
+    // Writes past the point where the disk filled up may still have landed,
+    // drop them so the file has no holes; a device has nothing to cut
+    if (writing && stats.size > size)
+    {
+        transferred -= stats.size - size;
+        stats.size = size;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && ftruncate(fd, size) != 0)
+            return errno;
+    }
+    return 0;
+}
+
+bool f3_engine::write(const QString& path)
+{
+    cancelled = false;
+    errorNumber = 0;
+    result = f3_engine_result();
+
+    QDir dir(path);
+    if (!dir.exists())
+        return fail(QFileInfo::exists(path) ? ENOTDIR : ENOENT);
+
+    settled.clear();
+    f3_checkpoint checkpoint;
+    qint64 first = 1;
+    qint64 resumed = 0;
+    if (resume && checkpoint.load(path))
+    {
+        // Whole files of the interrupted run stay, the rest is written again
+        first = checkpoint.resumeAt();
+        for (qint64 number : f3_engine_file_numbers(dir))
+        {
+            if (number >= first)
+                dir.remove(f3_engine_file_name(number));
+        }
+        resumed = checkpoint.writtenSize();
+        result.freeSpace = checkpoint.getFreeSpace();
+    }
+    else
+    {
+        // Like f3write, start over instead of appending to an earlier run
+        for (qint64 number : f3_engine_file_numbers(dir))
+            dir.remove(f3_engine_file_name(number));
+        f3_checkpoint::discard(path);
+
+        QStorageInfo storage(path);
+        storage.refresh();
+        // The manifest takes its room before the free space is measured
+        if (resume && checkpoint.create(path, storage.bytesAvailable()))
+            storage.refresh();
+        result.freeSpace = storage.bytesAvailable();
+        checkpoint.setFreeSpace(result.freeSpace);
+        checkpoint.save();
+    }
+    qint64 total = result.freeSpace - result.freeSpace % F3_ENGINE_ALIGNMENT;
+    if (total <= 0)
+        return fail(ENOSPC);
+
+    f3_engine_buffers buffers;
+    if (!buffers.allocate(queueDepth, blockSize))
+        return fail(ENOMEM);
+    QScopedPointer<f3_io> io(f3_io_create(backend, queueDepth));
+    backendUsed = io->getName();
+    io->registerBuffers(buffers.data(), buffers.count(), blockSize);
+    QScopedPointer<f3_engine_pipeline> pipeline;
+    if (pipelined)
+        pipeline.reset(new f3_engine_pipeline(this, path, callbacks.fileVerified));
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 written = resumed;
+    bool full = checkpoint.isWriteComplete();
+    for (qint64 number = first; written < total && !full; number++)
+    {
+        const qint64 expected = qMin<qint64>(F3_FILE_SIZE, total - written);
+        qint64 size = expected;
+        f3_file_stats stats;
+        stats.number = number;
+
+        QElapsedTimer fileTimer;
+        fileTimer.start();
+        bool direct = directIO;
+        int fd = f3_engine_open(dir.filePath(f3_engine_file_name(number)),
+                                O_WRONLY | O_CREAT | O_TRUNC, direct);
+        if (fd < 0)
+            return fail(errno);
+
+        int error = transferFile(io.data(), buffers, fd, number, 0, true, size, written, total, stats);
+        if (error != 0)
+        {
+            ::close(fd);
+            return fail(error);
+        }
+        full = size < expected;
+        result.bytesWritten = written - resumed;
+
+        fdatasync(fd);
+        f3_engine_drop_cache(fd);
+        ::close(fd);
+        stats.elapsedMs = fileTimer.elapsed();
+        if (callbacks.fileWritten)
+            callbacks.fileWritten(stats);
+        checkpoint.fileWritten(stats);
+        checkpoint.save();
+        if (pipeline)
+        {
+            if (pipeline->getError() != 0)
+                return fail(pipeline->getError());
+            pipeline->push(number);
+        }
+
+        if (failFast)
+        {
+            result.lostAt = spotCheck(path, number);
+            if (result.lostAt < 0 && pipeline)
+                result.lostAt = pipeline->getLostAt();
+            if (result.lostAt >= 0)
+                break;
+        }
+    }
+    result.writeMs = timer.elapsed();
+    if (result.lostAt < 0)
+    {
+        checkpoint.setWriteComplete();
+        checkpoint.save();
+    }
+
+    if (pipeline && result.lostAt < 0)
+    {
+        pipeline->finish();
+        if (pipeline->getError() != 0)
+            return fail(pipeline->getError());
+        if (failFast)
+            result.lostAt = pipeline->getLostAt();
+        if (result.lostAt < 0)
+            settlePipelined(path, pipeline->getVerifiedAfterWrite());
+    }
+    return true;
+}
+
+// The files verified once the last write was done are taken as they were,
+// the start of each and a random spot are sampled again in case the drive
+// still moved data around. Anything else is read in full by verify().
+void f3_engine::settlePipelined(const QString& path, const QMap<qint64, f3_file_stats>& verified)
+{
+    f3_engine_buffers buffers;
+    if (!buffers.allocate(1, F3_ENGINE_SPOT_SIZE))
+        return;
+    const QDir dir(path);
+    for (auto i = verified.constBegin(); i != verified.constEnd() && !cancelled; ++i)
+    {
+        if (checkSample(dir, i.key(), false, buffers.at(0)) < 0 &&
+            checkSample(dir, i.key(), true, buffers.at(0)) < 0)
+            settled.insert(i.key(), i.value());
+    }
+}
+
+bool f3_engine::verify(const QString& path)
+{
+    cancelled = false;
+    errorNumber = 0;
+    result.bytesRead = 0;
+    result.readMs = 0;
+    result.sectors = f3_sector_stats();
+    result.files.clear();
+    result.lostAt = -1;
+
+    QDir dir(path);
+    if (!dir.exists())
+        return fail(QFileInfo::exists(path) ? ENOTDIR : ENOENT);
+
+    const QVector<qint64> numbers = f3_engine_file_numbers(dir);
+    f3_checkpoint checkpoint;
+    bool tracked = resume && checkpoint.load(path);
+    qint64 total = 0;
+    qint64 settledSize = 0;
+    for (qint64 number : numbers)
+    {
+        qint64 size = QFileInfo(dir.filePath(f3_engine_file_name(number))).size();
+        total += size;
+        if (settled.contains(number) || (tracked && checkpoint.isVerified(number)))
+            settledSize += size;
+    }
+    if (result.freeSpace == 0)
+        result.freeSpace = tracked ? checkpoint.getFreeSpace() : total;
+
+    // Files left by a run without a manifest get one from here on
+    if (resume && !tracked && checkpoint.create(path, result.freeSpace))
+    {
+        for (qint64 number : numbers)
+        {
+            f3_file_stats stats;
+            stats.number = number;
+            stats.size = QFileInfo(dir.filePath(f3_engine_file_name(number))).size();
+            checkpoint.fileWritten(stats);
+        }
+        checkpoint.setWriteComplete();
+        checkpoint.save();
+    }
+    // Progress only counts what is read again
+    total -= settledSize;
+
+    f3_engine_buffers buffers;
+    if (!buffers.allocate(queueDepth, blockSize))
+        return fail(ENOMEM);
+    QScopedPointer<f3_io> io(f3_io_create(backend, queueDepth));
+    backendUsed = io->getName();
+    io->registerBuffers(buffers.data(), buffers.count(), blockSize);
+
+    QElapsedTimer timer;
+    timer.start();
+    for (qint64 number : numbers)
+    {
+        f3_file_stats stats;
+        if (settled.contains(number))
+            stats = settled.value(number);
+        else if (tracked && checkpoint.isVerified(number))
+        {
+            // Verified before the interruption, only the counts are left
+            stats = checkpoint.getVerified(number);
+            result.regions.markCounts(qint64(f3_file_offset(number)), stats.sectors);
+        }
+        else
+        {
+            stats.number = number;
+            int error = readFile(io.data(), buffers, dir.filePath(f3_engine_file_name(number)),
+                                 result.bytesRead, total, stats);
+            if (error != 0)
+                return fail(error);
+        }
+        if (!checkpoint.isVerified(number))
+        {
+            checkpoint.fileVerified(stats);
+            checkpoint.save();
+        }
+        result.sectors += stats.sectors;
+        result.files.append(stats);
+        // The pipeline has reported the settled ones already
+        if (callbacks.fileVerified && !settled.contains(number))
+            callbacks.fileVerified(stats);
+
+        if (failFast && stats.sectors.lost() > 0)
+        {
+            result.lostAt = qint64(f3_file_offset(number)) + stats.sectors.ok * F3_SECTOR_SIZE;
+            break;
+        }
+    }
+    result.readMs = timer.elapsed();
+    // Done, nothing left to resume
+    if (resume && result.lostAt < 0)
+        f3_checkpoint::discard(path);
+    return true;
+}
+
+// Raw mode: the pattern goes straight onto the device, cut into pieces of
+// F3_FILE_SIZE numbered like the *.h2w files would be, so every announced
+// sector is covered, whatever a filesystem would have kept for itself.
+// There is no checkpoint and no spot checking here.
+bool f3_engine::writeDevice(const QString& device)
+{
+    cancelled = false;
+    errorNumber = 0;
+    result = f3_engine_result();
+    settled.clear();
+
+    qint64 total = 0;
+    int fd = f3_engine_open_device(device, O_WRONLY, directIO, total);
+    if (fd < 0)
+        return fail(errno);
+    result.freeSpace = total;
+    if (total <= 0)
+    {
+        ::close(fd);
+        return fail(ENOSPC);
+    }
+
+    f3_engine_buffers buffers;
+    if (!buffers.allocate(queueDepth, blockSize))
+    {
+        ::close(fd);
+        return fail(ENOMEM);
+    }
+    QScopedPointer<f3_io> io(f3_io_create(backend, queueDepth));
+    backendUsed = io->getName();
+    io->registerBuffers(buffers.data(), buffers.count(), blockSize);
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 written = 0;
+    for (qint64 number = 1; written < total; number++)
+    {
+        const qint64 expected = qMin<qint64>(F3_FILE_SIZE, total - written);
+        qint64 size = expected;
+        f3_file_stats stats;
+        stats.number = number;
+        QElapsedTimer fileTimer;
+        fileTimer.start();
+        int error = transferFile(io.data(), buffers, fd, number, qint64(f3_file_offset(number)),
+                                 true, size, written, total, stats);
+        if (error != 0)
+        {
+            ::close(fd);
+            return fail(error);
+        }
+        result.bytesWritten = written;
+        stats.elapsedMs = fileTimer.elapsed();
+        if (callbacks.fileWritten)
+            callbacks.fileWritten(stats);
+        // The device took less than it announced
+        if (size < expected)
+            break;
+    }
+    fdatasync(fd);
+    ::close(fd);
+    result.writeMs = timer.elapsed();
+    return true;
+}
+
+bool f3_engine::verifyDevice(const QString& device)
+{
+    cancelled = false;
+    errorNumber = 0;
+    result.bytesRead = 0;
+    result.readMs = 0;
+    result.sectors = f3_sector_stats();
+    result.files.clear();
+    result.lostAt = -1;
+
+    qint64 total = 0;
+    int fd = f3_engine_open_device(device, O_RDONLY, directIO, total);
+    if (fd < 0)
+        return fail(errno);
+    result.freeSpace = total;
+    // Nothing of the write may be served back from the page cache
+    f3_engine_drop_cache(fd);
+
+    f3_engine_buffers buffers;
+    if (!buffers.allocate(queueDepth, blockSize))
+    {
+        ::close(fd);
+        return fail(ENOMEM);
+    }
+    QScopedPointer<f3_io> io(f3_io_create(backend, queueDepth));
+    backendUsed = io->getName();
+    io->registerBuffers(buffers.data(), buffers.count(), blockSize);
+
+    QElapsedTimer timer;
+    timer.start();
+    for (qint64 number = 1; qint64(f3_file_offset(number)) < total; number++)
+    {
+        qint64 size = qMin<qint64>(F3_FILE_SIZE, total - qint64(f3_file_offset(number)));
+        f3_file_stats stats;
+        stats.number = number;
+        QElapsedTimer fileTimer;
+        fileTimer.start();
+        int error = transferFile(io.data(), buffers, fd, number, qint64(f3_file_offset(number)),
+                                 false, size, result.bytesRead, total, stats);
+        if (error != 0)
+        {
+            ::close(fd);
+            return fail(error);
+        }
+        stats.elapsedMs = fileTimer.elapsed();
+        result.sectors += stats.sectors;
+        result.files.append(stats);
+        if (callbacks.fileVerified)
+            callbacks.fileVerified(stats);
+
+        if (failFast && stats.sectors.lost() > 0)
+        {
+            result.lostAt = qint64(f3_file_offset(number)) + stats.sectors.ok * F3_SECTOR_SIZE;
+            break;
+        }
+    }
+    ::close(fd);
+    result.readMs = timer.elapsed();
+    return true;
+}
+
+int f3_engine::readFile(f3_io *io, const f3_engine_buffers& buffers, const QString& fileName,
+                        qint64& transferred, qint64 total, f3_file_stats& stats)
+{
+    qint64 fileSize = QFileInfo(fileName).size();
+    QElapsedTimer fileTimer;
+    fileTimer.start();
+    bool direct = directIO;
+    int fd = f3_engine_open(fileName, O_RDONLY, direct);
+    if (fd < 0)
+        return errno;
+    if (!direct)
+        f3_engine_drop_cache(fd);
+
+    int error = transferFile(io, buffers, fd, stats.number, 0, false, fileSize, transferred, total, stats);
+    ::close(fd);
+    stats.elapsedMs = fileTimer.elapsed();
+    return error;
+}
+
+// Verifies a single file with buffers and a backend of its own, leaving the
+// result and the error alone apart from the region map, so it can run next
+// to write(). Returns 0 or an errno value.
+int f3_engine::verifyFile(const QString& path, qint64 number, f3_file_stats& stats)
+{
+    f3_engine_buffers buffers;
+    if (!buffers.allocate(queueDepth, blockSize))
+        return ENOMEM;
+    QScopedPointer<f3_io> io(f3_io_create(backend, queueDepth));
+    io->registerBuffers(buffers.data(), buffers.count(), blockSize);
+
+    qint64 transferred = 0;
+    stats.number = number;
+    return readFile(io.data(), buffers, QDir(path).filePath(f3_engine_file_name(number)),
+                    transferred, 0, stats);
+}
+
+// Reads a few samples back from files 1..last: the start of the first and
+// the newest file, where wrapping and dropping fakes lose data first, and a
+// random spot of the newest and of an earlier file. Returns the offset of
+// the first lost sector found, -1 when all samples are intact.
+qint64 f3_engine::spotCheck(const QString& path, qint64 last)
+{
+    QDir dir(path);
+    QRandomGenerator *random = QRandomGenerator::global();
+    qint64 earlier = last > 1 ? 1 + qint64(random->generate64() % quint64(last - 1)) : last;
+    const QPair<qint64, bool> samples[] = {
+        {1, false}, {last, false}, {last, true}, {earlier, true}
+    };
+
+    f3_engine_buffers buffers;
+    if (!buffers.allocate(1, F3_ENGINE_SPOT_SIZE))
+        return -1;
+
+    qint64 lostAt = -1;
+    for (const QPair<qint64, bool>& sample : samples)
+    {
+        qint64 lost = checkSample(dir, sample.first, sample.second, buffers.at(0));
+        if (lost >= 0 && (lostAt < 0 || lost < lostAt))
+            lostAt = lost;
+    }
+    return lostAt;
+}
+
+// Reads F3_ENGINE_SPOT_SIZE bytes of a file, at its start or at a random
+// spot, into buffer. Returns where the first lost sector is in the checked
+// space, -1 when all is intact or the file cannot be read.
+qint64 f3_engine::checkSample(const QDir& dir, qint64 number, bool randomSpot, void *buffer)
+{
+    QRandomGenerator *random = QRandomGenerator::global();
+    const QString fileName = dir.filePath(f3_engine_file_name(number));
+    qint64 fileSize = QFileInfo(fileName).size();
+    if (fileSize < F3_SECTOR_SIZE)
+        return -1;
+    qint64 offset = 0;
+    if (randomSpot && fileSize > F3_ENGINE_SPOT_SIZE)
+    {
+        offset = qint64(random->generate64() % quint64(fileSize - F3_ENGINE_SPOT_SIZE));
+        offset -= offset % F3_ENGINE_ALIGNMENT;
+    }
+    qint64 size = qMin(F3_ENGINE_SPOT_SIZE, fileSize - offset);
+    size -= size % F3_SECTOR_SIZE;
+
+    bool direct = directIO;
+    int fd = f3_engine_open(fileName, O_RDONLY, direct);
+    if (fd < 0)
+        return -1;
+    if (!direct)
+        f3_engine_drop_cache(fd);
+    ssize_t done = pread(fd, buffer, size_t(size), offset);
+    ::close(fd);
+
+    const quint64 base = f3_file_offset(number) + quint64(offset);
+    if (done < F3_SECTOR_SIZE)
+        return qint64(base);
+    for (qint64 sector = 0; sector < done / F3_SECTOR_SIZE; sector++)
+    {
+        f3_sector_stats stats;
+        f3_pattern_check(static_cast<char *>(buffer) + sector * F3_SECTOR_SIZE, F3_SECTOR_SIZE,
+                         base + quint64(sector * F3_SECTOR_SIZE), stats);
+        if (stats.lost() > 0)
+            return qint64(base) + sector * F3_SECTOR_SIZE;
+    }
+    return -1;
+}
@@ -0,0 +1,158 @@
+#ifndef F3_ENGINE_H
+#define F3_ENGINE_H
+#include <QDir>
+#include <QString>
+#include <QVector>
+#include <QMap>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include "f3_pattern.h"
+#include "f3_region_map.h"
+
+#define F3_ENGINE_ALIGNMENT 4096
+#define F3_ENGINE_DEFAULT_BLOCK (Q_INT64_C(1) << 20)
+
+class f3_io;
+class f3_engine_pipeline;
+
+struct f3_file_stats
+{
+    qint64 number = 0;      // "<number>.h2w"
+    qint64 size = 0;
+    qint64 elapsedMs = 0;
+    f3_sector_stats sectors;
+};
+
+// Called from the thread running f3_engine::write()/verify(), a pipelined
+// write reports verified files from the thread verifying them.
+struct f3_engine_callbacks
+{
+    std::function<void(qint64 done, qint64 total)> progress;
+    std::function<void(const f3_file_stats& stats)> fileWritten;
+    std::function<void(const f3_file_stats& stats)> fileVerified;
+};
+
+struct f3_engine_result
+{
+    qint64 freeSpace = 0;
+    qint64 bytesWritten = 0;
+    qint64 writeMs = 0;
+    qint64 bytesRead = 0;
+    qint64 readMs = 0;
+    f3_sector_stats sectors;
+    QVector<f3_file_stats> files;
+    qint64 lostAt = -1;     // first lost byte seen by a fail-fast run
+    f3_region_map regions;  // which verified sectors held their data
+};
+
+// Aligned blocks shared with the I/O backend, one per request in flight
+class f3_engine_buffers
+{
+public:
+    ~f3_engine_buffers()
+    {
+        for (void *buffer : buffers)
+            free(buffer);
+    }
+
+    bool allocate(int count, qint64 size)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            void *buffer = nullptr;
+            if (posix_memalign(&buffer, F3_ENGINE_ALIGNMENT, size_t(size)) != 0)
+                return false;
+            buffers.append(buffer);
+        }
+        return true;
+    }
+
+    int count() const
+    {
+        return buffers.size();
+    }
+
+    void *at(int index) const
+    {
+        return buffers.at(index);
+    }
+
+    void * const *data() const
+    {
+        return buffers.constData();
+    }
+
+private:
+    QVector<void*> buffers;
+};
+
+// File handling shared by f3_engine and f3_broadcast. f3_engine_open()
+// clears direct when the filesystem refuses O_DIRECT.
+int f3_engine_open(const QString& fileName, int flags, bool& direct);
+void f3_engine_drop_cache(int fd);
+QVector<qint64> f3_engine_file_numbers(const QDir& dir);
+QString f3_engine_file_name(qint64 number);
+
+// Native replacement for f3write/f3read: writes and validates the same
+// *.h2w files, bypassing the page cache where the filesystem allows it.
+// Up to getQueueDepth() blocks are kept in flight through an f3_io backend.
+// With fail-fast on, the files written so far are spot checked after each
+// one and both passes stop at the first lost sector, see result.lostAt.
+// Pipelined, each file is verified while the next one is written; the
+// verify pass still rereads every file verified before writing stopped,
+// later writes may have hit it.
+// Resuming, both passes keep an f3_checkpoint and skip what it has done.
+// writeDevice()/verifyDevice() do the same on a whole block device, with
+// no filesystem in between.
+class f3_engine
+{
+public:
+    f3_engine();
+    void setBlockSize(qint64 size);
+    qint64 getBlockSize() const;
+    void setDirectIO(bool enabled);
+    void setQueueDepth(int depth);
+    int getQueueDepth() const;
+    void setBackend(const QString& name);
+    QString getBackend() const;
+    void setFailFast(bool enabled);
+    void setPipelined(bool enabled);
+    void setResume(bool enabled);
+    void setCallbacks(const f3_engine_callbacks& callbacks);
+    bool write(const QString& path);
+    bool verify(const QString& path);
+    bool writeDevice(const QString& device);
+    bool verifyDevice(const QString& device);
+    qint64 spotCheck(const QString& path, qint64 last);
+    int verifyFile(const QString& path, qint64 number, f3_file_stats& stats);
+    void cancel();
+    int getError() const;
+    const f3_engine_result& getResult() const;
+
+private:
+    qint64 blockSize;
+    bool directIO;
+    int queueDepth;
+    QString backend;
+    QString backendUsed;
+    bool failFast;
+    bool pipelined;
+    bool resume;
+    std::atomic<bool> cancelled;
+    std::atomic<int> errorNumber;
+    f3_engine_callbacks callbacks;
+    f3_engine_result result;
+    QMap<qint64, f3_file_stats> settled;
+
+    bool fail(int error);
+    int transferFile(f3_io *io, const f3_engine_buffers& buffers, int fd, qint64 number,
+                     qint64 position, bool writing, qint64& size, qint64& transferred,
+                     qint64 total, f3_file_stats& stats);
+    int readFile(f3_io *io, const f3_engine_buffers& buffers, const QString& fileName,
+                 qint64& transferred, qint64 total, f3_file_stats& stats);
+    qint64 checkSample(const QDir& dir, qint64 number, bool randomSpot, void *buffer);
+    void settlePipelined(const QString& path, const QMap<qint64, f3_file_stats>& verified);
+};
+
+#endif // F3_ENGINE_H
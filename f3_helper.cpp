@@ -0,0 +1,366 @@
+#include "f3_helper.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+bool f3_helper_send(int socketFd, const QByteArray& line, int passFd)
+{
+    QByteArray data = line;
+    if (!data.endsWith('\n'))
+        data.append('\n');
+    const char *p = data.constData();
+    size_t left = size_t(data.size());
+    while (left > 0)
+    {
+        struct iovec part;
+        part.iov_base = const_cast<char *>(p);
+        part.iov_len = left;
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        char control[CMSG_SPACE(sizeof(int))];
+        if (passFd >= 0)
+        {
+            memset(control, 0, sizeof(control));
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(header), &passFd, sizeof(int));
+        }
+        ssize_t sent = sendmsg(socketFd, &message, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        // The descriptor went along with the first part
+        passFd = -1;
+        p += sent;
+        left -= size_t(sent);
+    }
+    return true;
+}
+
+// Reads what is there without blocking. Returns the bytes added to buffer,
+// 0 once the other end has closed, -1 with errno set otherwise (EAGAIN
+// when there is nothing more for now).
+int f3_helper_receive(int socketFd, QByteArray& buffer, QQueue<int>& fds)
+{
+    char data[4096];
+    struct iovec part;
+    part.iov_base = data;
+    part.iov_len = sizeof(data);
+    char control[CMSG_SPACE(sizeof(int) * 4)];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t got = recvmsg(socketFd, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (got < 0)
+        return -1;
+    for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr;
+         header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+        const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            fds.enqueue(fd);
+        }
+    }
+    buffer.append(data, int(got));
+    return int(got);
+}
+
+
+f3_helper::f3_helper(QObject *parent) :
+    QObject(parent),
+    listenFd(-1),
+    socketFd(-1),
+    nextId(1)
+{
+#if (QT_VERSION >= QT_VERSION_CHECK(5,6,0))
+    connect(&process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, [this](int exitCode) {
+#else
+    connect(&process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, [this](int exitCode) {
+#endif
+        // sudo answers a wrong password on stderr
+        QString error = QString::fromUtf8(process.readAllStandardError()).trimmed();
+        if (error.isEmpty())
+            error = QString("%1 exited with code %2").arg(F3_HELPER_COMMAND).arg(exitCode);
+        bool ready = isReady();
+        stop();
+        if (!ready)
+            emit f3_helper_failed(error);
+        failPending(error);
+    });
+    connect(&process, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart)
+            return;
+        stop();
+        emit f3_helper_failed("sudo is not available.");
+        failPending("sudo is not available.");
+    });
+}
+
+f3_helper::~f3_helper()
+{
+    // Closing the socket is what tells the helper to quit
+    disconnect(&process, nullptr, this, nullptr);
+    stop();
+    process.waitForFinished(1000);
+}
+
+// The password goes to sudo once, the helper keeps running until stop()
+bool f3_helper::start(const QString& password)
+{
+    if (isStarted())
+        return true;
+
+    QString helperPath = QStandardPaths::findExecutable(F3_HELPER_COMMAND,
+                                                        QStringList(QCoreApplication::applicationDirPath()));
+    if (helperPath.isEmpty())
+        helperPath = QStandardPaths::findExecutable(F3_HELPER_COMMAND);
+    if (helperPath.isEmpty())
+        return false;
+
+    // QTemporaryDir makes it 0700, nobody else can reach the socket
+    socketDir.reset(new QTemporaryDir(QDir::temp().filePath("f3-qt-XXXXXX")));
+    if (!socketDir->isValid())
+        return false;
+    const QString socketPath = socketDir->filePath(F3_HELPER_SOCKET);
+    const QByteArray name = QFile::encodeName(socketPath);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (size_t(name.size()) >= sizeof(address.sun_path))
+    {
+        socketDir.reset();
+        return false;
+    }
+    memcpy(address.sun_path, name.constData(), size_t(name.size()));
+
+    listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 ||
+        ::bind(listenFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(listenFd, 1) != 0)
+    {
+        stop();
+        return false;
+    }
+    listenNotifier.reset(new QSocketNotifier(listenFd, QSocketNotifier::Read));
+    connect(listenNotifier.data(), &QSocketNotifier::activated, this, &f3_helper::acceptHelper);
+
+    // -k so the password is always read, -p "" keeps the prompt out of stderr
+    process.start("sudo", QStringList() << "-S" << "-k" << "-p" << ""
+                                        << helperPath << F3_HELPER_OPTION_CONNECT << socketPath);
+    process.write(password.toUtf8().append('\n'));
+    process.closeWriteChannel();
+    return true;
+}
+
+void f3_helper::stop()
+{
+    // May be called from the notifiers' own slots
+    if (!listenNotifier.isNull())
+    {
+        listenNotifier->setEnabled(false);
+        listenNotifier.take()->deleteLater();
+    }
+    if (!readNotifier.isNull())
+    {
+        readNotifier->setEnabled(false);
+        readNotifier.take()->deleteLater();
+    }
+    if (listenFd >= 0)
+        ::close(listenFd);
+    if (socketFd >= 0)
+        ::close(socketFd);
+    listenFd = socketFd = -1;
+    socketDir.reset();
+    while (!fds.isEmpty())
+        ::close(fds.dequeue());
+    incoming.clear();
+    queued.clear();
+    if (process.state() != QProcess::NotRunning)
+        process.terminate();
+}
+
+bool f3_helper::isStarted() const
+{
+    return socketFd >= 0 || process.state() != QProcess::NotRunning;
+}
+
+bool f3_helper::isReady() const
+{
+    return socketFd >= 0;
+}
+
+// The helper follows no symbolic links, /dev/disk/by-id/... included
+static QString f3_helper_real_path(const QString& path)
+{
+    const QString real = QFileInfo(path).canonicalFilePath();
+    return real.isEmpty() ? path : real;
+}
+
+int f3_helper::mount(const QString& device, const QString& mountPoint)
+{
+    QJsonObject arguments;
+    arguments["path"] = f3_helper_real_path(device);
+    arguments["target"] = f3_helper_real_path(mountPoint);
+    return request("mount", arguments);
+}
+
+int f3_helper::unmount(const QString& mountPoint)
+{
+    QJsonObject arguments;
+    arguments["path"] = f3_helper_real_path(mountPoint);
+    return request("unmount", arguments);
+}
+
+int f3_helper::chmod(const QString& path)
+{
+    QJsonObject arguments;
+    arguments["path"] = f3_helper_real_path(path);
+    return request("chmod", arguments);
+}
+
+int f3_helper::openDevice(const QString& path, bool writable)
+{
+    QJsonObject arguments;
+    arguments["path"] = f3_helper_real_path(path);
+    arguments["write"] = writable;
+    return request("open", arguments);
+}
+
+int f3_helper::listPartitions()
+{
+    return request("partitions", QJsonObject());
+}
+
+// Requests made before the helper has connected wait for it
+int f3_helper::request(const QString& op, QJsonObject request)
+{
+    const int id = nextId++;
+    request["id"] = id;
+    request["op"] = op;
+    const QByteArray line = QJsonDocument(request).toJson(QJsonDocument::Compact);
+    pending[id] = op;
+    if (socketFd >= 0 && f3_helper_send(socketFd, line))
+        return id;
+    if (socketFd < 0 && isStarted())
+    {
+        queued.enqueue(line);
+        return id;
+    }
+
+    // The caller gets the id before the failure
+    QString error = isStarted() ? QString(strerror(errno)) : QString("The helper is not running.");
+    QMetaObject::invokeMethod(this, [this, id, error]() {
+        if (pending.remove(id) > 0)
+            emit f3_helper_finished(id, false, error, -1);
+    }, Qt::QueuedConnection);
+    return id;
+}
+
+void f3_helper::acceptHelper()
+{
+    int fd = ::accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+        return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_PEERCRED
+    // Only root, which the helper runs as, may take the requests
+    struct ucred peer;
+    socklen_t length = sizeof(peer);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0 || peer.uid != 0)
+    {
+        ::close(fd);
+        return;
+    }
+#endif
+    listenNotifier->setEnabled(false);
+    listenNotifier.take()->deleteLater();
+    ::close(listenFd);
+    listenFd = -1;
+    // The connection outlives the socket file
+    socketDir.reset();
+
+    socketFd = fd;
+    readNotifier.reset(new QSocketNotifier(socketFd, QSocketNotifier::Read));
+    connect(readNotifier.data(), &QSocketNotifier::activated, this, &f3_helper::readReplies);
+    while (!queued.isEmpty())
+        f3_helper_send(socketFd, queued.dequeue());
+    emit f3_helper_ready();
+}
+
+void f3_helper::readReplies()
+{
+    bool closed = false;
+    forever
+    {
+        int got = f3_helper_receive(socketFd, incoming, fds);
+        if (got > 0)
+            continue;
+        closed = got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+        break;
+    }
+
+    int end;
+    while ((end = incoming.indexOf('\n')) >= 0)
+    {
+        QJsonObject reply = QJsonDocument::fromJson(incoming.left(end)).object();
+        incoming.remove(0, end + 1);
+        const int id = reply["id"].toInt();
+        const bool ok = reply["ok"].toBool();
+        int fd = -1;
+        if (ok && pending.value(id) == "open" && !fds.isEmpty())
+            fd = fds.dequeue();
+        if (pending.remove(id) == 0)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            continue;
+        }
+        emit f3_helper_finished(id, ok, reply[ok ? "output" : "error"].toString(), fd);
+        // A receiver may have stopped the helper
+        if (socketFd < 0)
+            return;
+    }
+
+    if (closed)
+    {
+        stop();
+        failPending("The helper has quit.");
+    }
+}
+
+void f3_helper::failPending(const QString& error)
+{
+    const QList<int> ids = pending.keys();
+    pending.clear();
+    for (int id : ids)
+        emit f3_helper_finished(id, false, error, -1);
+}
@@ -0,0 +1,77 @@
+#ifndef F3_HELPER_H
+#define F3_HELPER_H
+#include <QObject>
+#include <QByteArray>
+#include <QJsonObject>
+#include <QMap>
+#include <QProcess>
+#include <QQueue>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+
+#define F3_HELPER_COMMAND "f3-qt-helper"
+#define F3_HELPER_SOCKET "helper.sock"
+#define F3_HELPER_OPTION_CONNECT "--connect"
+// Name every mount point of f3-qt starts with, the helper mounts nowhere else
+#define F3_HELPER_MOUNT_PREFIX "f3qt_mount_"
+
+class QSocketNotifier;
+
+// Line framing of the helper socket, shared with f3-qt-helper. A line may
+// carry one file descriptor along, which arrives with its first byte.
+bool f3_helper_send(int socketFd, const QByteArray& line, int passFd = -1);
+int f3_helper_receive(int socketFd, QByteArray& buffer, QQueue<int>& fds);
+
+// Client of f3-qt-helper, the privileged process that mounts, unmounts,
+// chmods and opens devices for the GUI. It is started once through sudo
+// and then takes any number of requests over a unix socket, JSON lines
+// tagged with an id; the replies come back as they finish, in any order.
+// The socket sits in a directory only this user can enter and both ends
+// check who is on the other side. The helper only opens and chmods block
+// devices, and only mounts on, unmounts and chmods directories of the
+// user named F3_HELPER_MOUNT_PREFIX*.
+class f3_helper : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit f3_helper(QObject *parent = nullptr);
+    ~f3_helper();
+    bool start(const QString& password);
+    void stop();
+    bool isStarted() const;
+    bool isReady() const;
+
+    // Each returns the id its f3_helper_finished() will carry
+    int mount(const QString& device, const QString& mountPoint);
+    int unmount(const QString& mountPoint);
+    int chmod(const QString& path);
+    int openDevice(const QString& path, bool writable);
+    int listPartitions();
+
+signals:
+    void f3_helper_ready();
+    void f3_helper_failed(const QString& error);
+    // fd is an open descriptor for openDevice(), owned by the receiver
+    void f3_helper_finished(int id, bool ok, const QString& output, int fd);
+
+private:
+    QScopedPointer<QTemporaryDir> socketDir;
+    QProcess process;
+    QScopedPointer<QSocketNotifier> listenNotifier;
+    QScopedPointer<QSocketNotifier> readNotifier;
+    int listenFd;
+    int socketFd;
+    int nextId;
+    QByteArray incoming;
+    QQueue<int> fds;
+    QQueue<QByteArray> queued;
+    QMap<int, QString> pending;
+
+    int request(const QString& op, QJsonObject request);
+    void acceptHelper();
+    void readReplies();
+    void failPending(const QString& error);
+};
+
+#endif // F3_HELPER_H
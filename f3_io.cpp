@@ -0,0 +1,407 @@
+#include "f3_io.h"
+#include <QByteArray>
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#if defined(Q_OS_LINUX) && __has_include(<linux/io_uring.h>)
+#define F3_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+
+static qint64 f3_io_transfer(const f3_io_request& request)
+{
+    ssize_t done;
+    do
+    {
+        if (request.write)
+            done = pwrite(request.fd, request.buffer, size_t(request.size), request.offset);
+        else
+            done = pread(request.fd, request.buffer, size_t(request.size), request.offset);
+    } while (done < 0 && errno == EINTR);
+    return done < 0 ? -qint64(errno) : qint64(done);
+}
+
+void f3_io::registerBuffers(void * const *buffers, int count, qint64 size)
+{
+    Q_UNUSED(buffers);
+    Q_UNUSED(count);
+    Q_UNUSED(size);
+}
+
+// One request at a time on the calling thread
+class f3_io_sync : public f3_io
+{
+public:
+    const char *getName() const override
+    {
+        return "sync";
+    }
+
+    int getQueueDepth() const override
+    {
+        return 1;
+    }
+
+    int submit(const f3_io_request& request) override
+    {
+        f3_io_completion completion;
+        completion.tag = request.tag;
+        completion.result = f3_io_transfer(request);
+        completions.enqueue(completion);
+        return 0;
+    }
+
+    int complete(f3_io_completion& completion) override
+    {
+        if (completions.isEmpty())
+            return EINVAL;
+        completion = completions.dequeue();
+        return 0;
+    }
+
+private:
+    QQueue<f3_io_completion> completions;
+};
+
+// One blocking pread/pwrite per worker thread, so the device still sees
+// queueDepth requests at once
+class f3_io_threads : public f3_io
+{
+public:
+    explicit f3_io_threads(int queueDepth) :
+        stopping(false)
+    {
+        for (int i = 0; i < queueDepth; i++)
+        {
+            QThread *worker = QThread::create([this]() {
+                run();
+            });
+            workers.append(worker);
+            worker->start();
+        }
+    }
+
+    ~f3_io_threads() override
+    {
+        mutex.lock();
+        stopping = true;
+        requestReady.wakeAll();
+        mutex.unlock();
+        for (QThread *worker : workers)
+        {
+            worker->wait();
+            delete worker;
+        }
+    }
+
+    const char *getName() const override
+    {
+        return "threads";
+    }
+
+    int getQueueDepth() const override
+    {
+        return workers.size();
+    }
+
+    int submit(const f3_io_request& request) override
+    {
+        QMutexLocker locker(&mutex);
+        requests.enqueue(request);
+        requestReady.wakeOne();
+        return 0;
+    }
+
+    int complete(f3_io_completion& completion) override
+    {
+        QMutexLocker locker(&mutex);
+        while (completions.isEmpty())
+            completionReady.wait(&mutex);
+        completion = completions.dequeue();
+        return 0;
+    }
+
+private:
+    QMutex mutex;
+    QWaitCondition requestReady;
+    QWaitCondition completionReady;
+    QQueue<f3_io_request> requests;
+    QQueue<f3_io_completion> completions;
+    QVector<QThread*> workers;
+    bool stopping;
+
+    void run()
+    {
+        forever
+        {
+            mutex.lock();
+            while (requests.isEmpty() && !stopping)
+                requestReady.wait(&mutex);
+            if (requests.isEmpty())
+            {
+                mutex.unlock();
+                return;
+            }
+            f3_io_request request = requests.dequeue();
+            mutex.unlock();
+
+            f3_io_completion completion;
+            completion.tag = request.tag;
+            completion.result = f3_io_transfer(request);
+
+            mutex.lock();
+            completions.enqueue(completion);
+            completionReady.wakeOne();
+            mutex.unlock();
+        }
+    }
+};
+
+#ifdef F3_HAVE_IO_URING
+// Talks to the kernel through the raw syscalls and the shared rings, so
+// there is no dependency on liburing.
+class f3_io_uring : public f3_io
+{
+public:
+    explicit f3_io_uring(int queueDepth) :
+        ringFd(-1),
+        depth(0),
+        sqRing(MAP_FAILED),
+        cqRing(MAP_FAILED),
+        sqes(static_cast<io_uring_sqe *>(MAP_FAILED)),
+        sqRingSize(0),
+        cqRingSize(0),
+        sqesSize(0),
+        pending(0),
+        registered(false)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = int(syscall(__NR_io_uring_setup, unsigned(queueDepth), &params));
+        if (ringFd < 0)
+            return;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+            sqRingSize = cqRingSize = qMax(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+        {
+            release();
+            return;
+        }
+        if (singleMap)
+            cqRing = sqRing;
+        else
+        {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ringFd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED)
+            {
+                release();
+                return;
+            }
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+        {
+            release();
+            return;
+        }
+
+        char *sq = static_cast<char *>(sqRing);
+        sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        char *cq = static_cast<char *>(cqRing);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        depth = int(params.sq_entries);
+
+        // 5.1 to 5.5 set up a ring but only know the fixed buffer opcodes,
+        // plain reads and writes would all fail with EINVAL
+        if (!hasPlainOpcodes())
+            release();
+    }
+
+    ~f3_io_uring() override
+    {
+        release();
+    }
+
+    bool isValid() const
+    {
+        return ringFd >= 0;
+    }
+
+    const char *getName() const override
+    {
+        return "uring";
+    }
+
+    int getQueueDepth() const override
+    {
+        return depth;
+    }
+
+    void registerBuffers(void * const *buffers, int count, qint64 size) override
+    {
+        // Pinning the buffers once saves the kernel mapping them on every
+        // request. RLIMIT_MEMLOCK may forbid it, plain requests work anyway.
+        QVector<iovec> iovecs(count);
+        for (int i = 0; i < count; i++)
+        {
+            iovecs[i].iov_base = buffers[i];
+            iovecs[i].iov_len = size_t(size);
+        }
+        registered = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS,
+                             iovecs.data(), unsigned(count)) == 0;
+    }
+
+    int submit(const f3_io_request& request) override
+    {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > sqMask)
+            return EBUSY;
+
+        unsigned index = tail & sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        bool fixed = registered && request.bufferIndex >= 0;
+        if (request.write)
+            sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        else
+            sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = request.fd;
+        sqe->addr = quint64(quintptr(request.buffer));
+        sqe->len = unsigned(request.size);
+        sqe->off = quint64(request.offset);
+        if (fixed)
+            sqe->buf_index = quint16(request.bufferIndex);
+        sqe->user_data = request.tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        pending++;
+        return 0;
+    }
+
+    int complete(f3_io_completion& completion) override
+    {
+        forever
+        {
+            unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe& cqe = cqes[head & cqMask];
+                completion.tag = cqe.user_data;
+                completion.result = cqe.res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+
+            // Hand over everything queued so far and sleep until one is done
+            int submitted = int(syscall(__NR_io_uring_enter, ringFd, pending, 1,
+                                        IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (submitted < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return errno;
+            }
+            pending -= unsigned(submitted);
+        }
+    }
+
+private:
+    int ringFd;
+    int depth;
+    void *sqRing;
+    void *cqRing;
+    io_uring_sqe *sqes;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+    unsigned pending;
+    bool registered;
+
+    // The probe came in 5.6, along with IORING_OP_READ and IORING_OP_WRITE
+    bool hasPlainOpcodes()
+    {
+        const unsigned count = 256;
+        QByteArray space(int(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op)), '\0');
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(space.data());
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, count) != 0)
+            return false;
+        for (int opcode : {IORING_OP_READ, IORING_OP_WRITE})
+        {
+            if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+        return true;
+    }
+
+    void release()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+        sqRing = cqRing = MAP_FAILED;
+        if (ringFd >= 0)
+            ::close(ringFd);
+        ringFd = -1;
+    }
+};
+#endif
+
+f3_io *f3_io_create(const QString& backend, int queueDepth)
+{
+    queueDepth = qBound(1, queueDepth, F3_IO_MAX_DEPTH);
+    if (backend == "sync")
+        return new f3_io_sync;
+
+#ifdef F3_HAVE_IO_URING
+    if (backend == "auto" || backend == "uring")
+    {
+        // Kernels before 5.6, or seccomp profiles, leave it to the threads
+        f3_io_uring *io = new f3_io_uring(queueDepth);
+        if (io->isValid())
+            return io;
+        delete io;
+    }
+#endif
+
+    if (queueDepth == 1)
+        return new f3_io_sync;
+    return new f3_io_threads(queueDepth);
+}
@@ -0,0 +1,44 @@
+#ifndef F3_IO_H
+#define F3_IO_H
+#include <QtGlobal>
+#include <QString>
+
+#define F3_IO_DEFAULT_DEPTH 4
+#define F3_IO_MAX_DEPTH 128
+
+struct f3_io_request
+{
+    int fd = -1;
+    bool write = false;
+    void *buffer = nullptr;
+    int bufferIndex = -1;   // registered buffer holding the data, -1 if none
+    qint64 size = 0;
+    qint64 offset = 0;
+    quint64 tag = 0;
+};
+
+struct f3_io_completion
+{
+    quint64 tag = 0;
+    qint64 result = 0;      // bytes transferred or -errno, like the syscalls
+};
+
+// Asynchronous block I/O for the native engine. Up to getQueueDepth()
+// requests may be in flight; completions come back in any order. Both
+// calls return 0 or an errno value.
+class f3_io
+{
+public:
+    virtual ~f3_io() {}
+    virtual const char *getName() const = 0;
+    virtual int getQueueDepth() const = 0;
+    virtual void registerBuffers(void * const *buffers, int count, qint64 size);
+    virtual int submit(const f3_io_request& request) = 0;
+    virtual int complete(f3_io_completion& completion) = 0;
+};
+
+// backend is "auto", "uring", "threads" or "sync". io_uring falls back to
+// the pread/pwrite thread pool where the kernel does not offer it in full.
+f3_io *f3_io_create(const QString& backend, int queueDepth);
+
+#endif // F3_IO_H
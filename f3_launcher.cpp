@@ -1,24 +1,33 @@
 #include "f3_launcher.h"
+#include "f3_capability.h"
+#include "f3_checkpoint.h"
+#include "f3_engine.h"
+#include "f3_probe.h"
+#include "f3_replay.h"
+#include "f3_region_map.h"
+#include "f3_workers.h"
 #include <QDir>
 #include <QFile>
 #include <QtMath>
 #include <QTime>
-#include <QMessageBox>
 #include <QDebug>
 #include <QMetaMethod>
+#include <QRegularExpression>
 #include <QStringList>
+#include <QThread>
+#include <QDateTime>
+#include <QStandardPaths>
+#include <QStorageInfo>
+#include <atomic>
+#include <cerrno>
+#include <memory>
 
-#define F3_READ_COMMAND "f3read"
-#define F3_WRITE_COMMAND "f3write"
-#define F3_PROBE_COMMAND "f3probe"
-#define F3_FIX_COMMAND "f3fix"
 #define F3_OPTION_SHOW_PROGRESS "--show-progress=1"
 #define F3_OPTION_MIN_MEM "--min-memory"
 #define F3_OPTION_DESTRUCTIVE "--destructive"
 #define F3_OPTION_TIME "--time-ops"
-
-#define F3_VERSION_TAG1 "Copyright (C)"
-#define F3_VERSION_TAG2 "F3 read"
+#define F3_OPTION_START_AT "--start-at="
+#define F3_OPTION_END_AT "--end-at="
 
 #define F3_RESULT_TAG_READ_SPEED "Average reading speed:"
 #define F3_RESULT_TAG_WRITE_SPEED "Average writing speed:"
@@ -34,8 +43,10 @@
 #define F3_RESULT_TAG_FIX_SUCCEED "was successfully fixed"
 #define F3_RESULT_FORMAT_TIME "s.zzz's'"
 #define F3_RESULT_FORMAT_TIME2 "m:ss\""
+#define F3_RESULT_TAG_FILE_WRITTEN "Creating file"
+#define F3_RESULT_TAG_FILE_VALIDATED "Validating file"
 
-#define F3_ERROR_TAG_INACCESSIBLE "is damaged\n"
+#define F3_ERROR_TAG_INACCESSIBLE "is damaged"
 #define F3_ERROR_TAG_NO_SPACE "No space!"
 #define F3_ERROR_TAG_NO_MEM "Out of memory"
 #define F3_ERROR_TAG_NOT_DISK "is a partition of disk device"
@@ -46,6 +57,22 @@
 #define F3_DISK_PROBE_FILE "f3_qt_probe"
 #define F3_FILE_FILTER "*.h2w"
 
+#define F3_OUTPUT_LINES 256
+#define F3_OUTPUT_ERROR_LIMIT 65536
+#define F3_OUTPUT_LOG_DIR "logs"
+#define F3_REGION_FILE_SUFFIX ".regions"
+
+// Only lines carrying one of these are kept for the report
+static const char *f3_output_tags[] = {
+    F3_RESULT_TAG_READ_SPEED, F3_RESULT_TAG_WRITE_SPEED, F3_RESULT_TAG_SPACE_FREE,
+    F3_RESULT_TAG_SPACE_OK, F3_RESULT_TAG_SPACE_LOST, F3_RESULT_TAG_SIZE_ANNOUNCE,
+    F3_RESULT_TAG_SIZE_USABLE, F3_RESULT_TAG_SIZE_BLOCK, F3_RESULT_TAG_SIZE_MODULE,
+    F3_RESULT_TAG_READ_SPEED2, F3_RESULT_TAG_WRITE_SPEED2, F3_RESULT_TAG_FIX_SUCCEED,
+    F3_ERROR_TAG_INACCESSIBLE, F3_ERROR_TAG_NO_SPACE, F3_ERROR_TAG_NO_MEM,
+    F3_ERROR_TAG_NOT_DISK, F3_ERROR_TAG_NOT_ROOT, F3_ERROR_TAG_NOT_USB,
+    F3_ERROR_TAG_OVERSIZE
+};
+
 
 QString f3_get_line_result(const QString& str, const QString& testString)
 {
@@ -117,6 +144,84 @@ QString f3_capacity_unit(const int grade)
     return unit;
 }
 
+QString f3_capacity_string(qint64 bytes)
+{
+    static const char *units[] = {"Byte", "KB", "MB", "GB", "TB", "PB"};
+    double value = bytes;
+    int grade = 0;
+    while (value >= 1024 && grade < 5)
+    {
+        value /= 1024;
+        grade++;
+    }
+    return QString::number(value, 'f', 2).append(' ').append(units[grade]);
+}
+
+// f3 prints sizes in binary units
+qint64 f3_capacity_bytes(const QString& capacity)
+{
+    return qint64(capacity.left(capacity.indexOf(' ')).toDouble()
+                  * qPow(1024, f3_capacity_grade(capacity)));
+}
+
+// Report of a check stopped at the first lost data: what lies before it is
+// taken as good, the rest as lost
+static f3_launcher_report f3_fail_report(qint64 freeSpace, qint64 lostAt, qint64 written)
+{
+    f3_launcher_report report;
+    lostAt = qBound<qint64>(0, lostAt, freeSpace);
+    report.success = true;
+    report.ReportedFree = f3_capacity_string(freeSpace);
+    report.ActualFree = f3_capacity_string(lostAt);
+    report.LostSpace = f3_capacity_string(freeSpace - lostAt);
+    report.availability = freeSpace > 0 ? float(double(lostAt) / freeSpace) : -1;
+    if (written >= 0 && written < freeSpace)
+        report.FailReason = QString("Data lost at %1 after writing %2, the rest was not written")
+                .arg(report.ActualFree, f3_capacity_string(written));
+    else
+        report.FailReason = QString("Data lost at %1, the rest was not read").arg(report.ActualFree);
+    return report;
+}
+
+// "Creating file 3.h2w ... OK!" once f3write has finished a file
+static bool f3_written_file(const QString& line, f3_file_stats& stats)
+{
+    static const QRegularExpression written(F3_RESULT_TAG_FILE_WRITTEN " (\\d+)\\.h2w \\.\\.\\. OK!");
+    if (!line.startsWith(QLatin1String(F3_RESULT_TAG_FILE_WRITTEN)))
+        return false;
+    QRegularExpressionMatch match = written.match(line);
+    if (!match.hasMatch())
+        return false;
+    stats.number = match.captured(1).toLongLong();
+    return true;
+}
+
+// "Validating file 3.h2w ... 2097152/0/0/0" with the sectors f3read found
+// ok, corrupted, changed and overwritten
+static bool f3_validated_file(const QString& line, f3_file_stats& stats)
+{
+    static const QRegularExpression validated(F3_RESULT_TAG_FILE_VALIDATED
+            " (\\d+)\\.h2w \\.\\.\\.\\s*(\\d+)/\\s*(\\d+)/\\s*(\\d+)/\\s*(\\d+)");
+    if (!line.startsWith(QLatin1String(F3_RESULT_TAG_FILE_VALIDATED)))
+        return false;
+    QRegularExpressionMatch match = validated.match(line);
+    if (!match.hasMatch())
+        return false;
+    stats.number = match.captured(1).toLongLong();
+    stats.sectors.ok = match.captured(2).toLongLong();
+    stats.sectors.corrupted = match.captured(3).toLongLong();
+    stats.sectors.changed = match.captured(4).toLongLong();
+    stats.sectors.overwritten = match.captured(5).toLongLong();
+    return true;
+}
+
+QString f3_transfer_speed(qint64 bytes, qint64 msecs)
+{
+    if (bytes <= 0 || msecs <= 0)
+        return "";
+    return f3_capacity_string(bytes * 1000 / msecs).append("/s");
+}
+
 QTime f3_operation_time(QString time)
 {
     time = time.trimmed();
@@ -149,47 +254,41 @@ QString f3_operation_speed(const QString& operation,qint64 blockSize)
             .append("/s");
 }
 
-f3_launcher::f3_launcher() :
+f3_launcher::f3_launcher(QObject *parent) :
+    QObject(parent),
     f3_cui(new QProcess(this)),
-    timer(new QTimer(this)),
+    outputLines(F3_OUTPUT_LINES),
+    seriesRun(0),
+    lastFileMs(0),
+    engineRun(0),
+    engineSucceeded(false),
+    capabilitiesReady(false),
+    hasCui(false),
+    hasQuick(false),
+    hasFix(false),
+    showProgress(false),
+    failFast(false),
+    failLostAt(-1),
+    failWritten(0),
+    resumed(false),
     errCode(F3Error::Ok)
 {
-    f3_path = "./";
-    float version = probeVersion();
-    if (version == 0)
-    {
-        f3_path = "";
-        version = probeVersion();
-    }
-    if (version == 0)
-    {
-        emitError(F3Error::NoCui);
-        return;
-    }
-    if (version < 4.0 || !probeCommand(F3_PROBE_COMMAND))
-    {
-        emitError(F3Error::NoQuick);
-    }
-    if (version < 5.0 || !probeCommand(F3_FIX_COMMAND))
-    {
-        emitError(F3Error::NoFix);
-    }
-    if (version <= 6.0)
-    {
-        emitError(F3Error::NoProgress);
-        showProgress = false;
-    }
-    else
-    {
-        emit f3_launcher_status_changed(F3Status::Ready);
-        showProgress = true;
-    }
-
     options["mode"] = "legacy";
     options["cache"] = "none";
     options["memory"] = "full";
     options["destructive"] = "no";
     options["autofix"] = "no";
+    options["blocksize"] = "1048576";
+    options["io"] = "auto";
+    options["queuedepth"] = "4";
+    options["probe"] = "auto";
+    options["log"] = "yes";
+    options["failfast"] = "no";
+    options["pipeline"] = "no";
+    options["workers"] = "1";
+    options["resume"] = "no";
+    options["samples"] = QString::number(F3_SAMPLE_COUNT);
+    options["regions"] = "yes";
 
     stage = 0;
 #if (QT_VERSION >= QT_VERSION_CHECK(5,6,0))
@@ -197,13 +296,74 @@ f3_launcher::f3_launcher() :
 #else
     connect(f3_cui.data(), static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &f3_launcher::on_f3_cui_finished);
 #endif
-    connect(timer.data(), &QTimer::timeout, this, &f3_launcher::on_timer_timeout);
-    timer->setInterval(200);
+    connect(f3_cui.data(), &QProcess::readyReadStandardOutput, this, &f3_launcher::on_f3_cui_readyReadStandardOutput);
+    connect(f3_cui.data(), &QProcess::readyReadStandardError, this, &f3_launcher::on_f3_cui_readyReadStandardError);
 
+    // The region map is kept next to the output logs
+    connect(this, &f3_launcher::f3_launcher_status_changed, this, [this](f3_launcher_status status) {
+        if (status == F3Status::Finished)
+            saveRegionMap();
+    });
+
+    // Statuses and errors go into the recording as they are emitted
+    connect(this, &f3_launcher::f3_launcher_status_changed, this, [this](f3_launcher_status status) {
+        if (recorder.isNull())
+            return;
+        recorder->recordStatus(status);
+        if (status == F3Status::Finished)
+            recorder->recordReport(getReport());
+    });
+    connect(this, &f3_launcher::f3_launcher_error, this, [this](f3_launcher_error_code errCode) {
+        if (!recorder.isNull())
+            recorder->recordError(errCode);
+    });
+
+    // Known capabilities apply right away, otherwise they arrive once probed
+    f3_capability *capability = f3_capability::instance();
+    connect(capability, &f3_capability::f3_capability_ready, this, &f3_launcher::applyCapabilities);
+    if (capability->isReady())
+        applyCapabilities(capability->get());
+    else
+        capability->probe();
+}
+
+void f3_launcher::applyCapabilities(const f3_capabilities& capabilities)
+{
+    if (capabilitiesReady)
+        return;
+    capabilitiesReady = true;
+
+    this->capabilities = capabilities;
+    f3_path = capabilities.path;
+    hasCui = capabilities.version > 0;
+    hasQuick = capabilities.quick;
+    hasFix = capabilities.fix;
+    showProgress = capabilities.progress;
+    if (!hasCui)
+        emitError(F3Error::NoCui);
+    else
+    {
+        if (!hasQuick)
+            emitError(F3Error::NoQuick);
+        if (!hasFix)
+            emitError(F3Error::NoFix);
+        if (!showProgress)
+            emitError(F3Error::NoProgress);
+        else
+            emit f3_launcher_status_changed(F3Status::Ready);
+    }
+
+    if (!pendingCheck.isEmpty())
+    {
+        QString path = pendingCheck;
+        pendingCheck.clear();
+        startCheck(path);
+    }
 }
 
 f3_launcher::~f3_launcher()
 {
+    stopWorker();
     f3_cui->terminate();
 }
 
@@ -241,18 +401,95 @@ void f3_launcher::startCheck(QString devPath)
     if (stage != 0)
         stopCheck();
 
-    f3_cui_output.clear();
+    if (!capabilitiesReady)
+    {
+        // Resumed by applyCapabilities() once the f3 tools are known
+        pendingCheck = devPath;
+        status = F3Status::Running;
+        emit f3_launcher_status_changed(F3Status::Running);
+        return;
+    }
+
+    this->devPath = devPath;
+    openRecording();
+    clearOutput();
     progress10K = 0;
+    failFast = getOption("failfast") == "true";
+    failLostAt = -1;
+    failWritten = 0;
+    spotFiles.clear();
+    fileSeries.clear();
+    regions.clear();
+    regionFile.clear();
+    seriesRun++;
+    checkClock.start();
+    lastFileMs = 0;
+    workers.reset();
+    checkpoint.reset();
+    resumed = false;
+    // Late spot check results of the previous check are dropped from here on
+    engineRun++;
     status = F3Status::Running;
     emit f3_launcher_status_changed(F3Status::Running);
 
-    this->devPath = devPath;
+    probe.reset();
+    if (getOption("mode") == "native")
+    {
+        stage = 31;
+        if (getOption("cache") == "write")
+        {
+            if (probeDiskFull(devPath) && probeCacheFile(devPath))
+                stage = 32;
+            else
+                emitError(F3Error::CacheNotFound);
+        }
+        engine.reset(new f3_engine);
+        emit f3_launcher_status_changed(F3Status::Staged);
+        startEngine();
+        return;
+    }
+
+    // The native engine on the whole device, nothing to mount; with cache
+    // it only verifies what an earlier raw write left
+    if (getOption("mode") == "raw")
+    {
+        stage = getOption("cache") == "write" ? 62 : 61;
+        engine.reset(new f3_engine);
+        emit f3_launcher_status_changed(F3Status::Staged);
+        startEngine();
+        return;
+    }
+
+    // The native probe stands in for f3probe when it is missing, and does
+    // the sampling, f3 has nothing like it
+    if (getOption("mode") == "sample" || (getOption("mode") == "quick" &&
+        (getOption("probe") == "native" || (getOption("probe") == "auto" && !hasQuick))))
+    {
+        startProbe();
+        return;
+    }
+
+    if (!hasCui)
+    {
+        emitError(F3Error::NoCui);
+        status = F3Status::Stopped;
+        emit f3_launcher_status_changed(F3Status::Stopped);
+        return;
+    }
+
+    // "auto" measures how many workers the drive keeps busy
+    if (getOption("mode") == "legacy" && getOption("workers") != "1")
+    {
+        startWorkers(getOption("workers") == "auto" ? 0 : qMax(1, getOption("workers").toInt()));
+        return;
+    }
+
     QString command;
     QStringList args;
     if (getOption("mode") == "quick")
     {
         command = QString(F3_PROBE_COMMAND);
-        if (!probeCommand(command))
+        if (!hasQuick)
         {
             emitError(F3Error::NoQuick);
             status = F3Status::Stopped;
@@ -281,21 +518,34 @@ void f3_launcher::startCheck(QString devPath)
             else
                 emitError(F3Error::CacheNotFound);
         }
+        QString startAt = getOption("startat");
+        if (getOption("resume") == "true" && startAt.isEmpty())
+            startAt = openCheckpoint(command);
+        else if (stage == 1)
+            f3_checkpoint::discard(devPath);
         if (showProgress)
             args << QString(F3_OPTION_SHOW_PROGRESS);
+        if (!startAt.isEmpty())
+            args << QString(F3_OPTION_START_AT).append(startAt);
+        if (!getOption("endat").isEmpty())
+            args << QString(F3_OPTION_END_AT).append(getOption("endat"));
+        // Spot checks the files f3write has finished so far
+        if (failFast)
+            engine.reset(new f3_engine);
         emit f3_launcher_status_changed(F3Status::Staged);
     }
     args << devPath;
-    f3_cui->start(command.prepend(f3_path), args);
-
-    if (showProgress)
-    {
-        timer->start();
-    }
+    openOutputLog();
+    startProcess(command, args);
 }
 
 void f3_launcher::stopCheck()
 {
+    if (!workers.isNull())
+        workers->stop();
+    stopWorker();
+    if (!replay.isNull())
+        replay->stopProcess();
     f3_cui->terminate();
     f3_cui->waitForFinished();
 }
@@ -305,15 +555,28 @@ f3_launcher_report f3_launcher::getReport()
     f3_launcher_report report;
     report.success = false;
 
-    if (f3_cui_output.trimmed().isEmpty())
+    if (!workers.isNull())
+        return workers->getReport();
+    if (getOption("mode") == "native" || getOption("mode") == "raw")
+        return getEngineReport();
+    if ((getOption("mode") == "quick" || getOption("mode") == "sample") && !probe.isNull())
+        return getProbeReport();
+
+    if (outputLines.isEmpty())
         return report;
 
     bool legacyMode = getOption("mode") == "legacy";
+    if (legacyMode && failLostAt >= 0)
+    {
+        report = f3_fail_report(getLegacyFreeSpace(), failLostAt, failWritten);
+        report.WritingSpeed = getOutputResult(F3_RESULT_TAG_WRITE_SPEED);
+        return report;
+    }
 
-    if ((legacyMode && f3_cui_output.indexOf(F3_RESULT_TAG_READ_SPEED)) ||
-        f3_cui_output.indexOf(F3_RESULT_TAG_READ_SPEED2))
+    if ((legacyMode && hasOutputTag(F3_RESULT_TAG_READ_SPEED)) ||
+        hasOutputTag(F3_RESULT_TAG_READ_SPEED2))
         report.success = true;
-    else if (f3_cui_output.indexOf(F3_RESULT_TAG_FIX_SUCCEED))
+    else if (hasOutputTag(F3_RESULT_TAG_FIX_SUCCEED))
     {
         report.success = true;
         report.ReportedFree = "(Fixed)";
@@ -322,15 +585,15 @@ f3_launcher_report f3_launcher::getReport()
 
     if (legacyMode)
     {
-        report.ReportedFree = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_SPACE_FREE);
-        report.ActualFree = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_SPACE_OK);
-        report.LostSpace = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_SPACE_LOST);
+        report.ReportedFree = getOutputResult(F3_RESULT_TAG_SPACE_FREE);
+        report.ActualFree = getOutputResult(F3_RESULT_TAG_SPACE_OK);
+        report.LostSpace = getOutputResult(F3_RESULT_TAG_SPACE_LOST);
     }
     else
     {
-        report.ReportedFree = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_SIZE_ANNOUNCE);
+        report.ReportedFree = getOutputResult(F3_RESULT_TAG_SIZE_ANNOUNCE);
         report.ReportedFree.truncate(report.ReportedFree.indexOf(" ("));
-        report.ActualFree = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_SIZE_USABLE);
+        report.ActualFree = getOutputResult(F3_RESULT_TAG_SIZE_USABLE);
     }
     report.ActualFree.truncate(report.ActualFree.indexOf(" ("));
     report.LostSpace.truncate(report.LostSpace.indexOf(" ("));
@@ -338,31 +601,106 @@ f3_launcher_report f3_launcher::getReport()
 
     if (!legacyMode)
     {
-        report.ModuleSize = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_SIZE_MODULE);
+        report.ModuleSize = getOutputResult(F3_RESULT_TAG_SIZE_MODULE);
         report.ModuleSize.truncate(report.ModuleSize.indexOf(" ("));
-        report.BlockSize = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_SIZE_BLOCK);
+        report.BlockSize = getOutputResult(F3_RESULT_TAG_SIZE_BLOCK);
         report.BlockSize.truncate(report.BlockSize.indexOf(" ("));        
     }
 
 
     if (legacyMode)
     {
-        report.ReadingSpeed = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_READ_SPEED);
-        report.WritingSpeed = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_WRITE_SPEED);
+        report.ReadingSpeed = getOutputResult(F3_RESULT_TAG_READ_SPEED);
+        report.WritingSpeed = getOutputResult(F3_RESULT_TAG_WRITE_SPEED);
+    }
+
+    // A resumed f3read only went over the files left, the manifest has all
+    if (legacyMode && resumed && report.success && !checkpoint.isNull())
+    {
+        f3_sector_stats sectors = checkpoint->verifiedSectors();
+        qint64 freeSpace = checkpoint->getFreeSpace();
+        report.ReportedFree = f3_capacity_string(freeSpace);
+        report.ActualFree = f3_capacity_string(sectors.ok * F3_SECTOR_SIZE);
+        report.LostSpace = f3_capacity_string(sectors.lost() * F3_SECTOR_SIZE);
+        if (freeSpace > 0)
+            report.availability = float(double(sectors.ok * F3_SECTOR_SIZE) / freeSpace);
     }
     else
     {
         qint64 blockSize = report.BlockSize.left(report.BlockSize.indexOf(' ')).toFloat();
         blockSize *= qPow(1000, f3_capacity_grade(report.BlockSize));
-        report.ReadingSpeed = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_READ_SPEED2);
+        report.ReadingSpeed = getOutputResult(F3_RESULT_TAG_READ_SPEED2);
         report.ReadingSpeed = f3_operation_speed(report.ReadingSpeed, blockSize);
-        report.WritingSpeed = f3_get_line_result(f3_cui_output,F3_RESULT_TAG_WRITE_SPEED2);
+        report.WritingSpeed = getOutputResult(F3_RESULT_TAG_WRITE_SPEED2);
         report.WritingSpeed = f3_operation_speed(report.WritingSpeed, blockSize);
     }
 
     return report;
 }
 
+f3_launcher_report f3_launcher::getEngineReport()
+{
+    f3_launcher_report report;
+    report.success = false;
+    report.availability = -1;
+    if (engine.isNull() || (!engineThread.isNull() && engineThread->isRunning()))
+        return report;
+
+    const f3_engine_result& result = engine->getResult();
+    if (result.lostAt >= 0)
+    {
+        report = f3_fail_report(result.freeSpace, result.lostAt,
+                                result.files.isEmpty() ? result.bytesWritten : -1);
+        report.ReadingSpeed = f3_transfer_speed(result.bytesRead, result.readMs);
+        report.WritingSpeed = f3_transfer_speed(result.bytesWritten, result.writeMs);
+        return report;
+    }
+    if (result.files.isEmpty())
+        return report;
+
+    qint64 okBytes = result.sectors.ok * F3_SECTOR_SIZE;
+    report.success = true;
+    report.ReportedFree = f3_capacity_string(result.freeSpace);
+    report.ActualFree = f3_capacity_string(okBytes);
+    report.LostSpace = f3_capacity_string(result.sectors.lost() * F3_SECTOR_SIZE);
+    if (result.freeSpace > 0)
+        report.availability = float(double(okBytes) / result.freeSpace);
+    report.ReadingSpeed = f3_transfer_speed(result.bytesRead, result.readMs);
+    report.WritingSpeed = f3_transfer_speed(result.bytesWritten, result.writeMs);
+    return report;
+}
+
+f3_launcher_report f3_launcher::getProbeReport()
+{
+    f3_launcher_report report;
+    report.success = false;
+    report.availability = -1;
+    if (!engineThread.isNull() && engineThread->isRunning())
+        return report;
+
+    const f3_probe_result& result = probe->getResult();
+    if (result.blockSize == 0)
+        return report;
+
+    report.success = true;
+    report.ReportedFree = f3_capacity_string(result.announcedSize);
+    report.ActualFree = f3_capacity_string(result.usableSize);
+    report.LostSpace = f3_capacity_string(result.announcedSize - result.usableSize);
+    if (result.announcedSize > 0)
+        report.availability = float(double(result.usableSize) / result.announcedSize);
+    // A sample only bounds the usable size from above, too rough to fix by
+    if (result.samples > 0)
+        report.Confidence = QString("%1%").arg(result.confidence * 100, 0, 'f', 1);
+    else
+    {
+        report.ModuleSize = f3_capacity_string(result.moduleSize);
+        report.BlockSize = f3_capacity_string(result.blockSize);
+    }
+    report.ReadingSpeed = f3_transfer_speed(result.bytesRead, result.readMs);
+    report.WritingSpeed = f3_transfer_speed(result.bytesWritten, result.writeMs);
+    return report;
+}
+
 int f3_launcher::getStage()
 {
     return stage % 10;
@@ -386,13 +724,31 @@ void f3_launcher::startFix()
         blockSize = report.BlockSize;
     }
 
-    qint64 sizeInByte = size.left(size.indexOf(' ')).toInt()
-                            * qPow(1000, f3_capacity_grade(size));
-    qint64 blockSizeInByte = blockSize.left(blockSize.indexOf(' ')).toInt()
-                                * qPow(1000, f3_capacity_grade(blockSize));
-    qint64 blockCount = sizeInByte / blockSizeInByte;
+    qint64 blockCount;
+    if (!probe.isNull())
+    {
+        // The native probe mapped the device to the sector, --last-sec takes
+        // the index of the last sector before the first one lost
+        const qint64 blockSize = probe->getResult().blockSize;
+        const qint64 usable = regions.goodPrefix();
+        if (blockSize <= 0 || usable < blockSize)
+        {
+            emitError(F3Error::NoReport);
+            return;
+        }
+        blockCount = usable / blockSize - 1;
+        probe.reset();
+    }
+    else
+    {
+        qint64 sizeInByte = size.left(size.indexOf(' ')).toInt()
+                                * qPow(1000, f3_capacity_grade(size));
+        qint64 blockSizeInByte = blockSize.left(blockSize.indexOf(' ')).toInt()
+                                    * qPow(1000, f3_capacity_grade(blockSize));
+        blockCount = sizeInByte / blockSizeInByte;
+    }
 
-    f3_cui_output.clear();
+    clearOutput();
     status = F3Status::Running;
     emit f3_launcher_status_changed(F3Status::Running);
     stage = 21;
@@ -400,37 +756,8 @@ void f3_launcher::startFix()
     QStringList args;
     args << "-l" << QString::number(blockCount);
     args << devPath;
-    f3_cui->start(QString(F3_FIX_COMMAND).prepend(f3_path), args);
-}
-
-bool f3_launcher::probeCommand(QString command)
-{
-    f3_cui->start(command.prepend(f3_path), QStringList());
-    f3_cui->waitForStarted();
-    f3_cui->waitForFinished();
-    if (f3_cui->exitCode() == 255 || 
-        f3_cui->error() == QProcess::FailedToStart)
-        return false;
-    else
-        return true;
-}
-
-float f3_launcher::probeVersion()
-{
-    if (!probeCommand(F3_WRITE_COMMAND) || !probeCommand(F3_READ_COMMAND))
-        return 0;
-
-    QString output = f3_cui->readAllStandardError();
-    int p = output.indexOf(F3_VERSION_TAG1);
-    if (p > 0)
-    {
-        return f3_get_line_result(output,F3_VERSION_TAG2).toFloat();
-    }
-    else
-    {
-        return 6.1;
-    }
-
+    openOutputLog();
+    startProcess(F3_FIX_COMMAND, args);
 }
 
 bool f3_launcher::probeDiskFull(QString& devPath)
@@ -485,36 +812,33 @@ bool f3_launcher::probeCacheFile(QString& devPath)
         return false;
 }
 
-int f3_launcher::parseOutput()
+int f3_launcher::parseOutput(int exitCode)
 {
-    int exitCode = f3_cui->exitCode();
     switch(exitCode)
     {
         case 0:
             //Exit normally || Inaccessible
-            f3_cui_output.append(f3_cui->readAllStandardOutput());
-            if (f3_cui_output.indexOf(F3_ERROR_TAG_INACCESSIBLE) >= 0)
+            if (hasOutputTag(F3_ERROR_TAG_INACCESSIBLE))
                 emitError(F3Error::Damaged);
             break;
         case 1:
             //No space || No memory || Not root || Not disk ||
             //Not USB || Oversize
-            f3_cui_output = f3_cui->readAllStandardOutput();
-            f3_cui_output.append(f3_cui->readAllStandardError());
-            if (f3_cui_output.indexOf(F3_ERROR_TAG_NO_SPACE) >= 0)
+            collectErrorOutput();
+            if (hasOutputTag(F3_ERROR_TAG_NO_SPACE))
                 emitError(F3Error::NoSpace);
-            else if (f3_cui_output.indexOf(F3_ERROR_TAG_NO_MEM) >=0 )
+            else if (hasOutputTag(F3_ERROR_TAG_NO_MEM))
                 emitError(F3Error::NoMemory);
-            else if (f3_cui_output.indexOf(F3_ERROR_TAG_NOT_DISK) >= 0)
+            else if (hasOutputTag(F3_ERROR_TAG_NOT_DISK))
                 emitError(F3Error::NotDisk);
-            else if (f3_cui_output.indexOf(F3_ERROR_TAG_NOT_ROOT) >= 0)
+            else if (hasOutputTag(F3_ERROR_TAG_NOT_ROOT))
                 emitError(F3Error::NoPermission);
-            else if (f3_cui_output.indexOf(F3_ERROR_TAG_NOT_USB) >= 0)
+            else if (hasOutputTag(F3_ERROR_TAG_NOT_USB))
                 emitError(F3Error::NotUSB);
-            else if (f3_cui_output.indexOf(F3_ERROR_TAG_OVERSIZE) >= 0)
+            else if (hasOutputTag(F3_ERROR_TAG_OVERSIZE))
                 emitError(F3Error::Oversize);
             else
-                f3_cui_output.clear();
+                clearOutput();
             break;
         case 2:     //Path not exists
             emitError(F3Error::PathIncorrect);
@@ -533,7 +857,9 @@ int f3_launcher::parseOutput()
         case 143:   //Terminated by other process
             break;
         default:
-            f3_cui_output = QString("Error:\n").append(f3_cui->readAllStandardError());
+            clearOutput();
+            collectOutputLine("Error:");
+            collectErrorOutput();
             emitError(F3Error::Unknown);
     }
     return exitCode;
@@ -541,32 +867,68 @@ int f3_launcher::parseOutput()
 
 void f3_launcher::on_f3_cui_finished(int exitCode, QProcess::ExitStatus exitStatus)
 {
-    timer->stop();
     if (stage == 0)
         return;
-    else if (stage == 1)
+
+    // Pick up whatever arrived after the last readyRead
+    consumeOutput(QProcess::StandardOutput, f3_cui->readAllStandardOutput());
+    consumeOutput(QProcess::StandardError, f3_cui->readAllStandardError());
+    tokenizer.flush([this](const QByteArray& line) {
+        appendOutputLine(line);
+    });
+    if (!recorder.isNull())
+        recorder->recordFinish(exitCode, exitStatus);
+
+    if (failLostAt >= 0)
+    {
+        // Stopped at the first lost data, the report tells where
+        stage = 0;
+        outputLog.close();
+        status = F3Status::Finished;
+        emit f3_launcher_status_changed(F3Status::Finished);
+        return;
+    }
+
+    if (stage == 1)
     {
-        if (parseOutput() != 0)
+        if (parseOutput(exitCode) != 0)
         {
             stage = 0;
+            outputLog.close();
             status = F3Status::Stopped;
             emit f3_launcher_status_changed(F3Status::Stopped);
             return;
         }
 
+        // f3read covers whatever the pipeline has not verified yet
         stage = 2;
         progress10K = 0;
+        spotFiles.clear();
+        QString startAt = getOption("startat");
+        if (!checkpoint.isNull())
+        {
+            checkpoint->setWriteComplete();
+            checkpoint->save();
+            startAt = QString::number(checkpoint->verifyAt());
+        }
         QStringList args;
         if (showProgress)
             args << QString(F3_OPTION_SHOW_PROGRESS);
+        if (!startAt.isEmpty())
+            args << QString(F3_OPTION_START_AT).append(startAt);
+        if (!getOption("endat").isEmpty())
+            args << QString(F3_OPTION_END_AT).append(getOption("endat"));
         args << devPath;
-        f3_cui->start(QString(F3_READ_COMMAND).prepend(f3_path),args);
+        startProcess(F3_READ_COMMAND, args);
         emit f3_launcher_status_changed(F3Status::Staged);
-
-        if (showProgress)
-        {
-            timer->start();
-        }
+    }
+    else if (stage == 11 && getOption("probe") == "auto" &&
+             exitCode == 1 && f3_cui_error.contains(F3_ERROR_TAG_NOT_USB))
+    {
+        // f3probe only takes USB drives, mmc and SCSI readers get the native probe
+        outputLog.close();
+        clearOutput();
+        startProbe();
     }
     else if (stage == 11 && options["autofix"] == "true")
     {
@@ -575,9 +937,13 @@ void f3_launcher::on_f3_cui_finished(int exitCode, QProcess::ExitStatus exitStat
     else
     {
         stage = 0;
+        outputLog.close();
 
-        if (parseOutput() == 0)
+        if (parseOutput(exitCode) == 0)
         {
+            // Done, nothing left to resume
+            if (!checkpoint.isNull())
+                f3_checkpoint::discard(devPath);
             status = F3Status::Finished;
             emit f3_launcher_status_changed(F3Status::Finished);            
         }
@@ -589,19 +955,647 @@ void f3_launcher::on_f3_cui_finished(int exitCode, QProcess::ExitStatus exitStat
     }
 }
 
-void f3_launcher::on_timer_timeout()
+void f3_launcher::startProcess(QString command, const QStringList& args)
+{
+    tokenizer.clear();
+    f3_cui_error.clear();
+    lastFileMs = checkClock.elapsed();
+    if (!recorder.isNull())
+        recorder->recordStart(command, args);
+    if (!replay.isNull())
+    {
+        replay->startProcess(command, args);
+        return;
+    }
+    f3_cui->start(command.prepend(f3_path), args);
+}
+
+void f3_launcher::consumeOutput(QProcess::ProcessChannel channel, const QByteArray& data)
 {
-    QString temp = f3_cui->readAllStandardOutput();
-    if (temp.isEmpty()) return;
-    temp.remove(QChar('\b'));
-    int p = temp.indexOf("% --");
-    if (p >= 0)
+    outputLog.write(data);
+    if (!recorder.isNull())
+        recorder->recordOutput(channel, data);
+    if (channel == QProcess::StandardError)
     {
-        int p2 = temp.indexOf("... ", p - 7);
-        float percentage10K = temp.mid(p2 + 4, p - p2 - 4).trimmed().toFloat() * 100.0f;
-        if (percentage10K > progress10K)
-            progress10K = percentage10K;
+        f3_cui_error.append(data);
+        if (f3_cui_error.size() > F3_OUTPUT_ERROR_LIMIT)
+            f3_cui_error.remove(0, f3_cui_error.size() - F3_OUTPUT_ERROR_LIMIT);
+        return;
+    }
+
+    bool changed = tokenizer.feed(data, [this](const QByteArray& line) {
+        appendOutputLine(line);
+    });
+    if (!changed)
+        return;
+    int progress = f3_parse_progress(tokenizer.currentLine());
+    if (progress >= 0 && progress != progress10K)
+    {
+        progress10K = progress;
         emit f3_launcher_status_changed(F3Status::Progressed);
     }
-    f3_cui_output.append(temp);
+}
+
+void f3_launcher::appendOutputLine(const QByteArray& line)
+{
+    QString text = QString::fromLocal8Bit(line);
+    collectOutputLine(text);
+    trackFileSeries(text);
+    if (!checkpoint.isNull())
+        trackCheckpoint(text);
+    if (failFast && failLostAt < 0)
+        checkFailFast(text);
+}
+
+void f3_launcher::collectOutputLine(const QString& line)
+{
+    outputLines.append(line);
+    for (const char *tag : f3_output_tags)
+    {
+        if (!outputTags.contains(tag) && line.contains(QLatin1String(tag)))
+            outputTags.insert(tag, line);
+    }
+}
+
+// f3write gets its finished files spot checked, f3read is stopped at the
+// first file with lost sectors
+void f3_launcher::checkFailFast(const QString& line)
+{
+    f3_file_stats stats;
+    if (stage == 1 && f3_written_file(line, stats))
+    {
+        // A replay has no files to check
+        if (replay.isNull() && !engine.isNull())
+            startSpotCheck(stats.number);
+    }
+    else if (stage == 2 && f3_validated_file(line, stats) && stats.sectors.lost() > 0)
+        stopFailFast(qint64(f3_file_offset(stats.number)) + stats.sectors.ok * F3_SECTOR_SIZE, -1);
+}
+
+// Files f3write has finished and what f3read found in them go into the
+// manifest as they are reported
+void f3_launcher::trackCheckpoint(const QString& line)
+{
+    f3_file_stats stats;
+    if (stage == 1 && f3_written_file(line, stats))
+    {
+        stats.size = QFileInfo(QDir(devPath).filePath(QString("%1.h2w").arg(stats.number))).size();
+        checkpoint->fileWritten(stats);
+        checkpoint->save();
+    }
+    else if (stage == 2 && f3_validated_file(line, stats))
+    {
+        stats.size = QFileInfo(QDir(devPath).filePath(QString("%1.h2w").arg(stats.number))).size();
+        checkpoint->fileVerified(stats);
+        checkpoint->save();
+    }
+}
+
+// f3 prints a file's line once it is done with it, so it took the time
+// since the line before
+void f3_launcher::trackFileSeries(const QString& line)
+{
+    f3_file_stats stats;
+    bool verified = stage == 2 && f3_validated_file(line, stats);
+    if (!verified && !(stage == 1 && f3_written_file(line, stats)))
+        return;
+
+    qint64 now = checkClock.elapsed();
+    stats.elapsedMs = now - lastFileMs;
+    lastFileMs = now;
+    if (verified)
+    {
+        stats.size = (stats.sectors.ok + stats.sectors.lost()) * F3_SECTOR_SIZE;
+        regions.markCounts(qint64(f3_file_offset(stats.number)), stats.sectors);
+    }
+    else
+        stats.size = QFileInfo(QDir(devPath).filePath(QString("%1.h2w").arg(stats.number))).size();
+    recordFile(stats, verified);
+}
+
+void f3_launcher::recordFile(const f3_file_stats& stats, bool verified)
+{
+    f3_file_record& record = fileSeries[stats.number];
+    record.number = stats.number;
+    record.offset = qint64(f3_file_offset(stats.number));
+    record.size = stats.size;
+    if (verified)
+    {
+        record.verifiedAt = checkClock.elapsed();
+        record.readMs = stats.elapsedMs;
+        record.sectors = stats.sectors;
+    }
+    else
+    {
+        record.writtenAt = checkClock.elapsed();
+        record.writeMs = stats.elapsedMs;
+    }
+    emit f3_launcher_file_recorded(record);
+}
+
+const f3_region_map& f3_launcher::getRegionMap()
+{
+    return regions;
+}
+
+// Empty until a finished check has saved its map
+QString f3_launcher::getRegionFile()
+{
+    return regionFile;
+}
+
+// The native engine and probe know the lost sectors themselves, legacy
+// checks were mapped from f3read's lines as they came in
+void f3_launcher::collectRegionMap()
+{
+    if (!workers.isNull())
+        regions = workers->getRegionMap();
+    else if (!engine.isNull() && (getOption("mode") == "native" || getOption("mode") == "raw"))
+        regions = engine->getResult().regions;
+    else if (!probe.isNull() && getOption("mode") == "quick")
+    {
+        const f3_probe_result& result = probe->getResult();
+        regions.clear();
+        regions.mark(0, result.usableSize, F3Region::Good);
+        regions.mark(result.usableSize, result.announcedSize - result.usableSize,
+                     result.wrapped ? F3Region::Overwritten : F3Region::Corrupted);
+    }
+}
+
+void f3_launcher::saveRegionMap()
+{
+    // A fix run afterwards finishes again, the map is saved already
+    if (regions.isEmpty() || !regionFile.isEmpty() || getOption("regions") == "no")
+        return;
+    QString fileName = QString("f3-%1-%2" F3_REGION_FILE_SUFFIX)
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz"),
+                 QString::number(qHash(devPath), 16));
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
+    dir.mkpath(F3_OUTPUT_LOG_DIR);
+    fileName = dir.filePath(QString(F3_OUTPUT_LOG_DIR "/") + fileName);
+    if (regions.save(fileName))
+        regionFile = fileName;
+    else
+        qWarning() << "Cannot save region map" << fileName;
+}
+
+QVector<f3_file_record> f3_launcher::getFileSeries()
+{
+    if (!workers.isNull())
+        return workers->getFileSeries();
+    QVector<f3_file_record> series;
+    for (const f3_file_record& record : fileSeries)
+        series.append(record);
+    return series;
+}
+
+// Picks up the manifest of an interrupted check or starts a new one, and
+// returns the file f3 starts at, empty for the first
+QString f3_launcher::openCheckpoint(QString& command)
+{
+    checkpoint.reset(new f3_checkpoint);
+    if (checkpoint->load(devPath))
+    {
+        resumed = true;
+        if (checkpoint->isWriteComplete())
+        {
+            command = QString(F3_READ_COMMAND);
+            stage = 2;
+            return QString::number(checkpoint->verifyAt());
+        }
+        command = QString(F3_WRITE_COMMAND);
+        stage = 1;
+        return QString::number(checkpoint->resumeAt());
+    }
+
+    // f3write removes the files of an earlier run before it measures
+    qint64 cached = 0;
+    QDir dir(devPath);
+    const QFileInfoList files = dir.entryInfoList(QStringList(F3_FILE_FILTER), QDir::Files);
+    for (const QFileInfo& file : files)
+        cached += file.size();
+    if (stage == 1)
+    {
+        QStorageInfo storage(devPath);
+        storage.refresh();
+        checkpoint->create(devPath, storage.bytesAvailable() + cached);
+    }
+    else if (checkpoint->create(devPath, cached))
+    {
+        for (const QFileInfo& file : files)
+        {
+            f3_file_stats stats;
+            stats.number = file.completeBaseName().toLongLong();
+            stats.size = file.size();
+            if (stats.number > 0)
+                checkpoint->fileWritten(stats);
+        }
+        checkpoint->setWriteComplete();
+        checkpoint->save();
+    }
+    return QString();
+}
+
+void f3_launcher::startSpotCheck(qint64 number)
+{
+    // Pipelined, every file is verified in full and in order, otherwise the
+    // next finished file gets the next spot check
+    bool pipelined = getOption("pipeline") == "true";
+    if (!spotThread.isNull() && spotThread->isRunning())
+    {
+        if (pipelined)
+            spotFiles.enqueue(number);
+        return;
+    }
+
+    auto lostAt = std::make_shared<std::atomic<qint64>>(-1);
+    f3_engine *worker = engine.data();
+    QString path = devPath;
+    int run = engineRun;
+    spotThread.reset(QThread::create([worker, path, number, pipelined, lostAt]() {
+        if (!pipelined)
+        {
+            lostAt->store(worker->spotCheck(path, number));
+            return;
+        }
+        f3_file_stats stats;
+        if (worker->verifyFile(path, number, stats) == 0 && stats.sectors.lost() > 0)
+            lostAt->store(qint64(f3_file_offset(number)) + stats.sectors.ok * F3_SECTOR_SIZE);
+    }));
+    connect(spotThread.data(), &QThread::finished, this, [this, run, number, lostAt]() {
+        if (run != engineRun || (stage != 1 && stage != 2))
+            return;
+        if (lostAt->load() >= 0)
+            stopFailFast(lostAt->load(), stage == 1 ? number * F3_FILE_SIZE : -1);
+        else if (!spotFiles.isEmpty())
+            startSpotCheck(spotFiles.dequeue());
+    });
+    spotThread->start();
+}
+
+// Ends the running f3 tool, on_f3_cui_finished() then reports the lost data
+void f3_launcher::stopFailFast(qint64 lostAt, qint64 written)
+{
+    if (failLostAt >= 0)
+        return;
+    failLostAt = lostAt;
+    failWritten = written;
+    // Not from within the output handling, a replay exits right away
+    QMetaObject::invokeMethod(this, [this]() {
+        if (!replay.isNull())
+            replay->stopProcess();
+        else
+            f3_cui->terminate();
+    }, Qt::QueuedConnection);
+}
+
+// Free space f3write started with, or what the files of an earlier run take
+qint64 f3_launcher::getLegacyFreeSpace()
+{
+    if (!checkpoint.isNull())
+        return checkpoint->getFreeSpace();
+    if (hasOutputTag(F3_RESULT_TAG_SPACE_FREE))
+        return f3_capacity_bytes(getOutputResult(F3_RESULT_TAG_SPACE_FREE));
+
+    qint64 total = 0;
+    QDir dir(devPath);
+    const QFileInfoList files = dir.entryInfoList(QStringList(F3_FILE_FILTER), QDir::Files);
+    for (const QFileInfo& file : files)
+        total += file.size();
+    return total;
+}
+
+void f3_launcher::collectErrorOutput()
+{
+    const QStringList lines = QString::fromLocal8Bit(f3_cui_error).split('\n', Qt::SkipEmptyParts);
+    for (const QString& line : lines)
+        collectOutputLine(line);
+}
+
+void f3_launcher::clearOutput()
+{
+    outputLines.clear();
+    outputTags.clear();
+}
+
+void f3_launcher::openOutputLog()
+{
+    if (getOption("log") == "no")
+        return;
+    QString fileName = QString("f3-%1-%2.log")
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz"),
+                 QString::number(qHash(devPath), 16));
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
+    if (!outputLog.open(dir.filePath(QString(F3_OUTPUT_LOG_DIR "/") + fileName)))
+        qWarning() << "Cannot create output log" << fileName;
+}
+
+void f3_launcher::openRecording()
+{
+    recorder.reset();
+    if (getOption("record").isEmpty())
+        return;
+    recorder.reset(new f3_recorder);
+    if (!recorder->open(getOption("record"), devPath, options, capabilities))
+    {
+        qWarning() << "Cannot create recording" << getOption("record");
+        recorder.reset();
+    }
+}
+
+bool f3_launcher::hasOutputTag(const char *tag)
+{
+    return outputTags.contains(tag);
+}
+
+QString f3_launcher::getOutputResult(const char *tag)
+{
+    return f3_get_line_result(outputTags.value(tag), tag);
+}
+
+QString f3_launcher::getOutput()
+{
+    if (!workers.isNull())
+        return workers->getOutput();
+
+    QStringList lines;
+    for (int i = outputLines.firstIndex(); i <= outputLines.lastIndex(); i++)
+        lines.append(outputLines.at(i));
+    return lines.join('\n');
+}
+
+QString f3_launcher::getLogFile()
+{
+    return outputLog.fileName();
+}
+
+// Output and exits come from the recording from now on instead of f3
+void f3_launcher::setReplay(f3_replay *replay)
+{
+    this->replay = replay;
+    connect(replay, &f3_replay::f3_replay_output, this, &f3_launcher::consumeOutput);
+    connect(replay, &f3_replay::f3_replay_process_finished, this, &f3_launcher::on_f3_cui_finished);
+    capabilitiesReady = false;
+    applyCapabilities(replay->getCapabilities());
+}
+
+// Runs output captured from an f3 tool through the same parsing as a live
+// run of the given stage, so getReport() answers for it afterwards
+void f3_launcher::loadTranscript(int stage, const QByteArray& output, const QByteArray& errorOutput, int exitCode)
+{
+    if (this->stage != 0)
+        stopCheck();
+
+    clearOutput();
+    tokenizer.clear();
+    f3_cui_error.clear();
+    probe.reset();
+    workers.reset();
+    checkpoint.reset();
+    resumed = false;
+    progress10K = 0;
+    failFast = false;
+    failLostAt = -1;
+    this->stage = stage;
+    consumeOutput(QProcess::StandardOutput, output);
+    consumeOutput(QProcess::StandardError, errorOutput);
+    tokenizer.flush([this](const QByteArray& line) {
+        appendOutputLine(line);
+    });
+    parseOutput(exitCode);
+    this->stage = 0;
+}
+
+void f3_launcher::on_f3_cui_readyReadStandardOutput()
+{
+    // Leftovers of a run that has already been wound up
+    if (stage == 0)
+        return;
+    consumeOutput(QProcess::StandardOutput, f3_cui->readAllStandardOutput());
+}
+
+void f3_launcher::on_f3_cui_readyReadStandardError()
+{
+    if (stage == 0)
+        return;
+    consumeOutput(QProcess::StandardError, f3_cui->readAllStandardError());
+}
+
+void f3_launcher::startEngine()
+{
+    bool ok;
+    qint64 blockSize = getOption("blocksize").toLongLong(&ok);
+    if (ok && blockSize > 0)
+        engine->setBlockSize(blockSize);
+    int queueDepth = getOption("queuedepth").toInt(&ok);
+    if (ok && queueDepth > 0)
+        engine->setQueueDepth(queueDepth);
+    engine->setBackend(getOption("io"));
+    engine->setFailFast(failFast);
+    engine->setPipelined(getOption("pipeline") == "true");
+    engine->setResume(getOption("resume") == "true");
+    engine->setCallbacks(makeCallbacks());
+
+    f3_engine *worker = engine.data();
+    bool verifying = stage == 32 || stage == 62;
+    bool raw = stage > 60;
+    QString path = devPath;
+    startWorker([worker, verifying, raw, path]() {
+        if (raw)
+            return verifying ? worker->verifyDevice(path) : worker->writeDevice(path);
+        return verifying ? worker->verify(path) : worker->write(path);
+    });
+}
+
+void f3_launcher::startWorkers(int count)
+{
+    workers.reset(new f3_workers);
+    connect(workers.data(), &f3_workers::f3_workers_error, this, &f3_launcher::emitError);
+    connect(workers.data(), &f3_workers::f3_workers_file_recorded, this, &f3_launcher::f3_launcher_file_recorded);
+    connect(workers.data(), &f3_workers::f3_workers_status_changed, this, [this](f3_launcher_status status) {
+        if (workers.isNull() || stage == 0)
+            return;
+        progress10K = workers->getProgress10K();
+        if (status == F3Status::Finished || status == F3Status::Stopped)
+        {
+            stage = 0;
+            this->status = status;
+            collectRegionMap();
+        }
+        else
+            stage = workers->getStage();
+        emit f3_launcher_status_changed(status);
+    });
+
+    // Stays at 1 until the workers report in
+    stage = 1;
+    emit f3_launcher_status_changed(F3Status::Staged);
+    workers->start(devPath, options, count);
+}
+
+void f3_launcher::startProbe()
+{
+    if (f3_probe::isPartition(devPath))
+    {
+        emitError(F3Error::NotDisk);
+        stage = 0;
+        status = F3Status::Stopped;
+        emit f3_launcher_status_changed(F3Status::Stopped);
+        return;
+    }
+
+    bool sampling = getOption("mode") == "sample";
+    stage = sampling ? 51 : 41;
+    emit f3_launcher_status_changed(F3Status::Staged);
+    probe.reset(new f3_probe);
+    QString destructive = getOption("destructive");
+    probe->setDestructive(destructive == "true" || destructive == "yes");
+    bool ok;
+    int samples = getOption("samples").toInt(&ok);
+    if (ok && samples > 0)
+        probe->setSampleCount(samples);
+    probe->setCallbacks(makeCallbacks());
+
+    f3_probe *worker = probe.data();
+    QString path = devPath;
+    startWorker([worker, path, sampling]() {
+        return sampling ? worker->sample(path) : worker->run(path);
+    });
+}
+
+f3_engine_callbacks f3_launcher::makeCallbacks()
+{
+    // The workers report from their own thread, only hand over changed values
+    auto lastProgress = std::make_shared<std::atomic<int>>(-1);
+    f3_engine_callbacks callbacks;
+    callbacks.progress = [this, lastProgress](qint64 done, qint64 total) {
+        int value = total > 0 ? int(done * 10000 / total) : 0;
+        if (lastProgress->exchange(value) == value)
+            return;
+        QMetaObject::invokeMethod(this, [this, value]() {
+            progress10K = value;
+            emit f3_launcher_status_changed(F3Status::Progressed);
+        }, Qt::QueuedConnection);
+    };
+    // Files of a check that has been replaced since are dropped
+    int run = seriesRun;
+    callbacks.fileWritten = [this, run](const f3_file_stats& stats) {
+        QMetaObject::invokeMethod(this, [this, run, stats]() {
+            if (run == seriesRun)
+                recordFile(stats, false);
+        }, Qt::QueuedConnection);
+    };
+    callbacks.fileVerified = [this, run](const f3_file_stats& stats) {
+        QMetaObject::invokeMethod(this, [this, run, stats]() {
+            if (run == seriesRun)
+                recordFile(stats, true);
+        }, Qt::QueuedConnection);
+    };
+    return callbacks;
+}
+
+void f3_launcher::startWorker(const std::function<bool()>& work)
+{
+    progress10K = 0;
+    int run = ++engineRun;
+    engineThread.reset(QThread::create([this, work]() {
+        engineSucceeded = work();
+    }));
+    connect(engineThread.data(), &QThread::finished, this, [this, run]() {
+        finishEngine(run);
+    });
+    engineThread->start();
+}
+
+void f3_launcher::stopWorker()
+{
+    if (!spotThread.isNull())
+        spotThread->wait();
+    if (engineThread.isNull() || !engineThread->isRunning())
+        return;
+    if (!engine.isNull())
+        engine->cancel();
+    if (!probe.isNull())
+        probe->cancel();
+    engineThread->wait();
+}
+
+void f3_launcher::finishEngine(int run)
+{
+    // Ignore a late notification from a run that has been stopped and replaced
+    if (run != engineRun)
+        return;
+    engineThread->wait();
+    if (stage == 0)
+        return;
+
+    if (!engineSucceeded)
+    {
+        switch(!probe.isNull() ? probe->getError() : engine->getError())
+        {
+            case ENOSPC:
+                emitError(F3Error::NoSpace);
+                break;
+            case ENOMEM:
+                emitError(F3Error::NoMemory);
+                break;
+            case ENOENT:
+                emitError(F3Error::PathIncorrect);
+                break;
+            case EACCES:
+            case EPERM:
+            case EROFS:
+                emitError(F3Error::NoPermission);
+                break;
+            case ENOTDIR:
+                emitError(F3Error::NotDirectory);
+                break;
+            case ENOTBLK:
+            case EISDIR:
+            case ENOTTY:
+                emitError(F3Error::NotDevice);
+                break;
+            case EBUSY:
+                emitError(F3Error::Busy);
+                break;
+            case EINVAL:
+            case EOPNOTSUPP:
+                // The filesystem or the kernel is not up to the native
+                // engine, f3write/f3read may still be
+                emitError(stage == 31 || stage == 32 ? F3Error::NoNative : F3Error::Unknown);
+                break;
+            case ECANCELED:
+                break;
+            default:
+                emitError(F3Error::Unknown);
+        }
+        stage = 0;
+        status = F3Status::Stopped;
+        emit f3_launcher_status_changed(F3Status::Stopped);
+        return;
+    }
+
+    // A fail-fast write that already lost data skips the verify
+    if ((stage == 31 || stage == 61) && engine->getResult().lostAt < 0)
+    {
+        stage++;
+        emit f3_launcher_status_changed(F3Status::Staged);
+        startEngine();
+        return;
+    }
+    collectRegionMap();
+    if (stage == 41 || stage == 51)
+    {
+        if (probe->getResult().usableSize == 0)
+            emitError(F3Error::Damaged);
+        if (stage == 41 && options["autofix"] == "true")
+        {
+            startFix();
+            return;
+        }
+    }
+
+    stage = 0;
+    status = F3Status::Finished;
+    emit f3_launcher_status_changed(F3Status::Finished);
 }
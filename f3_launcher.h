@@ -1,9 +1,28 @@
 #ifndef F3_LAUNCHER_H
 #define F3_LAUNCHER_H
 #include <QtCore/QProcess>
-#include <QtCore/QTimer>
 #include <QtCore/QMap>
+#include <QtCore/QHash>
+#include <QtCore/QContiguousCache>
+#include <QtCore/QQueue>
+#include <QtCore/QElapsedTimer>
+#include <QPointer>
 #include <QScopedPointer>
+#include "f3_capability.h"
+#include "f3_output.h"
+#include "f3_pattern.h"
+#include "f3_region_map.h"
+
+class f3_checkpoint;
+class f3_engine;
+class f3_probe;
+class f3_recorder;
+class f3_replay;
+class f3_workers;
+struct f3_engine_callbacks;
+struct f3_file_stats;
+class QThread;
+class QTime;
 
 
 enum class F3Status {
@@ -33,9 +52,21 @@ enum class F3Error {
     Oversize = 141,
     Damaged = 142,
     NotDevice = 143,
+    Busy = 144,
+    NoNative = 145,
     Unknown = 255
 };
 
+QString f3_get_line_result(const QString& str, const QString& testString);
+int f3_capacity_grade(const QString& capacity);
+float f3_capacity_ratio(const QString& numerator, const QString& denominator);
+QString f3_capacity_unit(const int grade);
+QString f3_capacity_string(qint64 bytes);
+qint64 f3_capacity_bytes(const QString& capacity);
+QString f3_transfer_speed(qint64 bytes, qint64 msecs);
+QTime f3_operation_time(QString time);
+QString f3_operation_speed(const QString& operation, qint64 blockSize);
+
 // For backward compatibility
 using f3_launcher_status = F3Status;
 using f3_launcher_error_code = F3Error;
@@ -51,6 +82,26 @@ struct f3_launcher_report
     float availability;
     QString ModuleSize;
     QString BlockSize;
+    QString FailReason;     // why a fail-fast check stopped early
+    QString Confidence;     // how sure a sampled capacity is genuine
+};
+
+// One *.h2w file as it went through the check, times in ms. writtenAt and
+// verifiedAt count from the start of the check, -1 for a pass the file
+// has not been through.
+struct f3_file_record
+{
+    qint64 number = 0;
+    qint64 offset = 0;      // where the file starts in the checked space
+    qint64 size = 0;
+    qint64 writtenAt = -1;
+    qint64 writeMs = 0;
+    qint64 verifiedAt = -1;
+    qint64 readMs = 0;
+    f3_sector_stats sectors;
+
+    qint64 writeSpeed() const { return writeMs > 0 ? size * 1000 / writeMs : 0; }
+    qint64 readSpeed() const { return readMs > 0 ? size * 1000 / readMs : 0; }
 };
 
 
@@ -59,7 +110,7 @@ class f3_launcher : public QObject
     Q_OBJECT
 
 public:
-    f3_launcher();
+    explicit f3_launcher(QObject *parent = nullptr);
     ~f3_launcher();
     f3_launcher_status getStatus();
     f3_launcher_error_code getErrCode();
@@ -70,34 +121,101 @@ public:
     bool setOption(QString key, QString value);
     QString getOption(QString key);
     void startFix();
-    QString f3_cui_output;
+    QString getOutput();
+    QVector<f3_file_record> getFileSeries();
+    const f3_region_map& getRegionMap();
+    QString getRegionFile();
+    QString getLogFile();
+    void loadTranscript(int stage, const QByteArray& output, const QByteArray& errorOutput, int exitCode);
+    void setReplay(f3_replay *replay);
     int progress10K;
 
 signals:
     void f3_launcher_status_changed(f3_launcher_status status);
     void f3_launcher_error(f3_launcher_error_code errCode);
+    void f3_launcher_file_recorded(const f3_file_record& record);
 
 private:
     QScopedPointer<QProcess> f3_cui;
-    QScopedPointer<QTimer> timer;
+    f3_output_tokenizer tokenizer;
+    QByteArray f3_cui_error;
+    QContiguousCache<QString> outputLines;
+    QHash<QString,QString> outputTags;
+    f3_output_log outputLog;
+    QScopedPointer<f3_recorder> recorder;
+    QPointer<f3_replay> replay;
+    QScopedPointer<f3_workers> workers;
+    QScopedPointer<f3_checkpoint> checkpoint;
+    QScopedPointer<f3_engine> engine;
+    QScopedPointer<f3_probe> probe;
+    QScopedPointer<QThread> engineThread;
+    QScopedPointer<QThread> spotThread;
+    QQueue<qint64> spotFiles;
+    QMap<qint64,f3_file_record> fileSeries;
+    f3_region_map regions;
+    QString regionFile;
+    QElapsedTimer checkClock;
+    int seriesRun;
+    qint64 lastFileMs;
+    int engineRun;
+    bool engineSucceeded;
     QString devPath;
     QString f3_path;
     QMap<QString,QString> options;
+    QString pendingCheck;
+    f3_capabilities capabilities;
+    bool capabilitiesReady;
+    bool hasCui;
+    bool hasQuick;
+    bool hasFix;
     bool showProgress;
+    bool failFast;
+    qint64 failLostAt;
+    qint64 failWritten;
+    bool resumed;
     int stage;
     F3Status status;
     F3Error errCode;
 
     void emitError(f3_launcher_error_code errorCode);
-    bool probeCommand(QString command);
-    float probeVersion();
+    void applyCapabilities(const f3_capabilities& capabilities);
     bool probeDiskFull(QString& devPath);
     bool probeCacheFile(QString& devPath);
-    int parseOutput();
+    int parseOutput(int exitCode);
+    void startProcess(QString command, const QStringList& args);
+    void consumeOutput(QProcess::ProcessChannel channel, const QByteArray& data);
+    void appendOutputLine(const QByteArray& line);
+    void collectOutputLine(const QString& line);
+    void checkFailFast(const QString& line);
+    void trackCheckpoint(const QString& line);
+    void trackFileSeries(const QString& line);
+    void recordFile(const f3_file_stats& stats, bool verified);
+    void collectRegionMap();
+    void saveRegionMap();
+    QString openCheckpoint(QString& command);
+    void startSpotCheck(qint64 number);
+    void stopFailFast(qint64 lostAt, qint64 written);
+    qint64 getLegacyFreeSpace();
+    void collectErrorOutput();
+    void clearOutput();
+    void openOutputLog();
+    void openRecording();
+    bool hasOutputTag(const char *tag);
+    QString getOutputResult(const char *tag);
+    void startEngine();
+    void startProbe();
+    void startWorkers(int count);
+    void startWorker(const std::function<bool()>& work);
+    void stopWorker();
+    f3_engine_callbacks makeCallbacks();
+    void finishEngine(int run);
+    f3_launcher_report getEngineReport();
+    f3_launcher_report getProbeReport();
 
 private slots:
     void on_f3_cui_finished(int exitCode, QProcess::ExitStatus exitStatus);
-    void on_timer_timeout();
+    void on_f3_cui_readyReadStandardOutput();
+    void on_f3_cui_readyReadStandardError();
 };
 
 #endif // F3_LAUNCHER_H
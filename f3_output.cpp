@@ -0,0 +1,163 @@
+#include "f3_output.h"
+#include <QDir>
+#include <QFileInfo>
+#include <cstring>
+#ifdef F3_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define F3_PROGRESS_TAG "% --"
+
+
+f3_output_tokenizer::f3_output_tokenizer() :
+    cursor(0)
+{
+}
+
+bool f3_output_tokenizer::feed(const QByteArray& data, const std::function<void(const QByteArray&)>& lineFinished)
+{
+    bool changed = false;
+    const char *p = data.constData();
+    const char *end = p + data.size();
+    while (p < end)
+    {
+        // Copy runs of plain text at once, only control bytes go one by one
+        const char *run = p;
+        while (p < end && *p != '\n' && *p != '\b' && *p != '\r')
+            p++;
+        if (p > run)
+        {
+            int length = int(p - run);
+            int overlap = qMin(length, int(line.size()) - cursor);
+            if (overlap > 0)
+                memcpy(line.data() + cursor, run, size_t(overlap));
+            if (length > overlap)
+                line.append(run + overlap, length - overlap);
+            cursor += length;
+            changed = true;
+        }
+        if (p == end)
+            break;
+
+        switch (*p)
+        {
+            case '\n':
+                lineFinished(line);
+                line.clear();
+                cursor = 0;
+                changed = false;
+                break;
+            case '\b':
+                if (cursor > 0)
+                    cursor--;
+                break;
+            case '\r':
+                cursor = 0;
+                break;
+        }
+        p++;
+    }
+    return changed;
+}
+
+void f3_output_tokenizer::flush(const std::function<void(const QByteArray&)>& lineFinished)
+{
+    if (!line.isEmpty())
+        lineFinished(line);
+    clear();
+}
+
+const QByteArray& f3_output_tokenizer::currentLine() const
+{
+    return line;
+}
+
+void f3_output_tokenizer::clear()
+{
+    line.clear();
+    cursor = 0;
+}
+
+f3_output_log::f3_output_log() :
+    gzfile(nullptr)
+{
+}
+
+f3_output_log::~f3_output_log()
+{
+    close();
+}
+
+bool f3_output_log::open(const QString& fileName)
+{
+    close();
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+#ifdef F3_HAVE_ZLIB
+    name = fileName + ".gz";
+    // Fastest level, the log must never slow down reading the output
+    gzfile = gzopen(QFile::encodeName(name).constData(), "wb1");
+    if (gzfile)
+        return true;
+#endif
+    name = fileName;
+    file.setFileName(name);
+    if (file.open(QFile::WriteOnly | QFile::Truncate))
+        return true;
+    name.clear();
+    return false;
+}
+
+void f3_output_log::write(const QByteArray& data)
+{
+    if (data.isEmpty())
+        return;
+#ifdef F3_HAVE_ZLIB
+    if (gzfile)
+    {
+        gzwrite(gzfile, data.constData(), unsigned(data.size()));
+        return;
+    }
+#endif
+    if (file.isOpen())
+        file.write(data);
+}
+
+void f3_output_log::close()
+{
+#ifdef F3_HAVE_ZLIB
+    if (gzfile)
+        gzclose(gzfile);
+#endif
+    gzfile = nullptr;
+    if (file.isOpen())
+        file.close();
+}
+
+bool f3_output_log::isOpen() const
+{
+    return gzfile || file.isOpen();
+}
+
+QString f3_output_log::fileName() const
+{
+    return name;
+}
+
+int f3_parse_progress(const QByteArray& line)
+{
+    int p = line.lastIndexOf(F3_PROGRESS_TAG);
+    if (p <= 0)
+        return -1;
+
+    int start = p;
+    while (start > 0 && ((line[start - 1] >= '0' && line[start - 1] <= '9') || line[start - 1] == '.'))
+        start--;
+    if (start == p)
+        return -1;
+
+    bool ok = false;
+    double percentage = line.mid(start, p - start).toDouble(&ok);
+    if (!ok)
+        return -1;
+    return int(percentage * 100.0 + 0.5);
+}
@@ -0,0 +1,47 @@
+#ifndef F3_OUTPUT_H
+#define F3_OUTPUT_H
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <functional>
+
+struct gzFile_s;
+
+// Splits the raw output of an f3 tool into lines. f3 redraws its progress in
+// place by moving the cursor back with '\b', so the line still being drawn
+// is kept like a terminal would show it until its '\n' arrives.
+class f3_output_tokenizer
+{
+public:
+    f3_output_tokenizer();
+    bool feed(const QByteArray& data, const std::function<void(const QByteArray&)>& lineFinished);
+    void flush(const std::function<void(const QByteArray&)>& lineFinished);
+    const QByteArray& currentLine() const;
+    void clear();
+
+private:
+    QByteArray line;
+    int cursor;
+};
+
+// Raw transcript of a run, gzip compressed when zlib is available.
+class f3_output_log
+{
+public:
+    f3_output_log();
+    ~f3_output_log();
+    bool open(const QString& fileName);
+    void write(const QByteArray& data);
+    void close();
+    bool isOpen() const;
+    QString fileName() const;
+
+private:
+    gzFile_s *gzfile;
+    QFile file;
+    QString name;
+};
+
+int f3_parse_progress(const QByteArray& line);
+
+#endif // F3_OUTPUT_H
@@ -0,0 +1,322 @@
+#include "f3_pattern.h"
+#include <cstring>
+
+#if defined(Q_PROCESSOR_X86) && (defined(__GNUC__) || defined(__clang__))
+#define F3_PATTERN_X86
+#include <immintrin.h>
+#endif
+
+#define F3_SECTOR_WORDS (F3_SECTOR_SIZE / 8)
+
+typedef quint64 (*f3_pattern_fill_function)(void *, qint64, quint64);
+typedef void (*f3_pattern_check_function)(const void *, qint64, quint64, f3_sector_stats&);
+
+static inline quint64 f3_random_number(quint64 previous)
+{
+    return previous * Q_UINT64_C(4294967311) + 17;
+}
+
+// Word i of a sector is an affine function of the sector offset:
+// word[i] = mul[i] * offset + add[i]. Moving one sector ahead therefore
+// adds the same step[i] = mul[i] * F3_SECTOR_SIZE to every word, which is
+// all the vectorized paths have to do per sector.
+struct f3_pattern_table
+{
+    quint64 mul[F3_SECTOR_WORDS];
+    quint64 add[F3_SECTOR_WORDS];
+    quint64 step[F3_SECTOR_WORDS];
+
+    f3_pattern_table()
+    {
+        mul[0] = 1;
+        add[0] = 0;
+        for (int i = 1; i < F3_SECTOR_WORDS; i++)
+        {
+            mul[i] = mul[i - 1] * Q_UINT64_C(4294967311);
+            add[i] = f3_random_number(add[i - 1]);
+        }
+        for (int i = 0; i < F3_SECTOR_WORDS; i++)
+            step[i] = mul[i] * F3_SECTOR_SIZE;
+    }
+
+    void sector(quint64 *words, quint64 offset) const
+    {
+        for (int i = 0; i < F3_SECTOR_WORDS; i++)
+            words[i] = mul[i] * offset + add[i];
+    }
+};
+
+static const f3_pattern_table& f3_pattern_get_table()
+{
+    static const f3_pattern_table table;
+    return table;
+}
+
+// Same classification as f3read: the sequence is replayed from the offset
+// stored in the sector, so a sector that landed at the wrong place is told
+// apart from one that holds garbage.
+static void f3_pattern_check_sector(const unsigned char *p, quint64 offset, f3_sector_stats& stats)
+{
+    quint64 sector[F3_SECTOR_WORDS];
+    memcpy(sector, p, F3_SECTOR_SIZE);
+
+    int errors = 0;
+    quint64 rn = sector[0];
+    for (int i = 1; errors <= F3_FILE_TOLERANCE && i < F3_SECTOR_WORDS; i++)
+    {
+        rn = f3_random_number(rn);
+        if (rn != sector[i])
+            errors++;
+    }
+
+    if (sector[0] == offset)
+    {
+        if (errors == 0)
+            stats.ok++;
+        else if (errors <= F3_FILE_TOLERANCE)
+            stats.changed++;
+        else
+            stats.corrupted++;
+    }
+    else if (errors <= F3_FILE_TOLERANCE)
+        stats.overwritten++;
+    else
+        stats.corrupted++;
+}
+
+static quint64 f3_pattern_fill_scalar(void *buffer, qint64 size, quint64 offset)
+{
+    unsigned char *p = static_cast<unsigned char *>(buffer);
+    const unsigned char *end = p + size - size % F3_SECTOR_SIZE;
+    for (; p < end; p += F3_SECTOR_SIZE)
+    {
+        quint64 sector[F3_SECTOR_WORDS];
+        quint64 rn = offset;
+        sector[0] = offset;
+        for (int i = 1; i < F3_SECTOR_WORDS; i++)
+        {
+            rn = f3_random_number(rn);
+            sector[i] = rn;
+        }
+        memcpy(p, sector, F3_SECTOR_SIZE);
+        offset += F3_SECTOR_SIZE;
+    }
+    return offset;
+}
+
+static void f3_pattern_check_scalar(const void *buffer, qint64 size, quint64 offset, f3_sector_stats& stats)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(buffer);
+    const unsigned char *end = p + size - size % F3_SECTOR_SIZE;
+    for (; p < end; p += F3_SECTOR_SIZE)
+    {
+        f3_pattern_check_sector(p, offset, stats);
+        offset += F3_SECTOR_SIZE;
+    }
+}
+
+#ifdef F3_PATTERN_X86
+#define F3_SSE2_LANES (F3_SECTOR_WORDS / 2)
+#define F3_AVX2_LANES (F3_SECTOR_WORDS / 4)
+
+__attribute__((target("sse2")))
+static quint64 f3_pattern_fill_sse2(void *buffer, qint64 size, quint64 offset)
+{
+    unsigned char *p = static_cast<unsigned char *>(buffer);
+    const unsigned char *end = p + size - size % F3_SECTOR_SIZE;
+    if (p >= end)
+        return offset;
+
+    const f3_pattern_table& table = f3_pattern_get_table();
+    quint64 first[F3_SECTOR_WORDS];
+    table.sector(first, offset);
+    __m128i words[F3_SSE2_LANES], step[F3_SSE2_LANES];
+    for (int j = 0; j < F3_SSE2_LANES; j++)
+    {
+        words[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first + 2 * j));
+        step[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.step + 2 * j));
+    }
+    for (; p < end; p += F3_SECTOR_SIZE)
+    {
+        for (int j = 0; j < F3_SSE2_LANES; j++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16 * j), words[j]);
+            words[j] = _mm_add_epi64(words[j], step[j]);
+        }
+        offset += F3_SECTOR_SIZE;
+    }
+    return offset;
+}
+
+__attribute__((target("sse2")))
+static void f3_pattern_check_sse2(const void *buffer, qint64 size, quint64 offset, f3_sector_stats& stats)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(buffer);
+    const unsigned char *end = p + size - size % F3_SECTOR_SIZE;
+    if (p >= end)
+        return;
+
+    const f3_pattern_table& table = f3_pattern_get_table();
+    quint64 first[F3_SECTOR_WORDS];
+    table.sector(first, offset);
+    __m128i words[F3_SSE2_LANES], step[F3_SSE2_LANES];
+    for (int j = 0; j < F3_SSE2_LANES; j++)
+    {
+        words[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first + 2 * j));
+        step[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.step + 2 * j));
+    }
+    for (; p < end; p += F3_SECTOR_SIZE)
+    {
+        // Intact sectors match the expected pattern word for word, only the
+        // others need the exact f3read classification
+        __m128i equal = _mm_set1_epi32(-1);
+        for (int j = 0; j < F3_SSE2_LANES; j++)
+        {
+            __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * j));
+            equal = _mm_and_si128(equal, _mm_cmpeq_epi32(data, words[j]));
+            words[j] = _mm_add_epi64(words[j], step[j]);
+        }
+        if (_mm_movemask_epi8(equal) == 0xFFFF)
+            stats.ok++;
+        else
+            f3_pattern_check_sector(p, offset, stats);
+        offset += F3_SECTOR_SIZE;
+    }
+}
+
+__attribute__((target("avx2")))
+static quint64 f3_pattern_fill_avx2(void *buffer, qint64 size, quint64 offset)
+{
+    unsigned char *p = static_cast<unsigned char *>(buffer);
+    const unsigned char *end = p + size - size % F3_SECTOR_SIZE;
+    if (p >= end)
+        return offset;
+
+    const f3_pattern_table& table = f3_pattern_get_table();
+    quint64 first[F3_SECTOR_WORDS];
+    table.sector(first, offset);
+    __m256i words[F3_AVX2_LANES], step[F3_AVX2_LANES];
+    for (int j = 0; j < F3_AVX2_LANES; j++)
+    {
+        words[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first + 4 * j));
+        step[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.step + 4 * j));
+    }
+    for (; p < end; p += F3_SECTOR_SIZE)
+    {
+        for (int j = 0; j < F3_AVX2_LANES; j++)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(p + 32 * j), words[j]);
+            words[j] = _mm256_add_epi64(words[j], step[j]);
+        }
+        offset += F3_SECTOR_SIZE;
+    }
+    return offset;
+}
+
+__attribute__((target("avx2")))
+static void f3_pattern_check_avx2(const void *buffer, qint64 size, quint64 offset, f3_sector_stats& stats)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(buffer);
+    const unsigned char *end = p + size - size % F3_SECTOR_SIZE;
+    if (p >= end)
+        return;
+
+    const f3_pattern_table& table = f3_pattern_get_table();
+    quint64 first[F3_SECTOR_WORDS];
+    table.sector(first, offset);
+    __m256i words[F3_AVX2_LANES], step[F3_AVX2_LANES];
+    for (int j = 0; j < F3_AVX2_LANES; j++)
+    {
+        words[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first + 4 * j));
+        step[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.step + 4 * j));
+    }
+    for (; p < end; p += F3_SECTOR_SIZE)
+    {
+        __m256i equal = _mm256_set1_epi64x(-1);
+        for (int j = 0; j < F3_AVX2_LANES; j++)
+        {
+            __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32 * j));
+            equal = _mm256_and_si256(equal, _mm256_cmpeq_epi64(data, words[j]));
+            words[j] = _mm256_add_epi64(words[j], step[j]);
+        }
+        if (_mm256_movemask_epi8(equal) == -1)
+            stats.ok++;
+        else
+            f3_pattern_check_sector(p, offset, stats);
+        offset += F3_SECTOR_SIZE;
+    }
+}
+#endif
+
+struct f3_pattern_implementation
+{
+    const char *name;
+    f3_pattern_fill_function fill;
+    f3_pattern_check_function check;
+};
+
+static const f3_pattern_implementation f3_pattern_implementations[] = {
+#ifdef F3_PATTERN_X86
+    {"avx2", f3_pattern_fill_avx2, f3_pattern_check_avx2},
+    {"sse2", f3_pattern_fill_sse2, f3_pattern_check_sse2},
+#endif
+    {"scalar", f3_pattern_fill_scalar, f3_pattern_check_scalar}
+};
+
+static bool f3_pattern_supported(const f3_pattern_implementation& implementation)
+{
+#ifdef F3_PATTERN_X86
+    __builtin_cpu_init();
+    if (strcmp(implementation.name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(implementation.name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return implementation.fill == f3_pattern_fill_scalar;
+}
+
+static const f3_pattern_implementation *&f3_pattern_current()
+{
+    static const f3_pattern_implementation *current = []() {
+        for (const f3_pattern_implementation& implementation : f3_pattern_implementations)
+        {
+            if (f3_pattern_supported(implementation))
+                return &implementation;
+        }
+        return &f3_pattern_implementations[0];
+    }();
+    return current;
+}
+
+quint64 f3_pattern_fill(void *buffer, qint64 size, quint64 offset)
+{
+    return f3_pattern_current()->fill(buffer, size, offset);
+}
+
+void f3_pattern_check(const void *buffer, qint64 size, quint64 offset, f3_sector_stats &stats)
+{
+    f3_pattern_current()->check(buffer, size, offset, stats);
+}
+
+const char *f3_pattern_implementation_name()
+{
+    return f3_pattern_current()->name;
+}
+
+bool f3_pattern_select(const char *name)
+{
+    for (const f3_pattern_implementation& implementation : f3_pattern_implementations)
+    {
+        if (strcmp(implementation.name, name) == 0 && f3_pattern_supported(implementation))
+        {
+            f3_pattern_current() = &implementation;
+            return true;
+        }
+    }
+    return false;
+}
+
+quint64 f3_file_offset(qint64 number)
+{
+    return quint64(number - 1) * F3_FILE_SIZE;
+}
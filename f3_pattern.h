@@ -0,0 +1,39 @@
+#ifndef F3_PATTERN_H
+#define F3_PATTERN_H
+#include <QtGlobal>
+
+// Layout of the *.h2w files written by f3write: every 512-byte sector starts
+// with its 64-bit offset on the device, followed by a pseudo-random sequence
+// seeded with that offset. Files are 1 GB each and "N.h2w" begins at (N-1) GB.
+#define F3_SECTOR_SIZE 512
+#define F3_FILE_SIZE (Q_INT64_C(1) << 30)
+#define F3_FILE_TOLERANCE 2
+
+struct f3_sector_stats
+{
+    qint64 ok = 0;
+    qint64 corrupted = 0;
+    qint64 changed = 0;
+    qint64 overwritten = 0;
+
+    qint64 lost() const { return corrupted + changed + overwritten; }
+    f3_sector_stats &operator+=(const f3_sector_stats &other)
+    {
+        ok += other.ok;
+        corrupted += other.corrupted;
+        changed += other.changed;
+        overwritten += other.overwritten;
+        return *this;
+    }
+};
+
+quint64 f3_pattern_fill(void *buffer, qint64 size, quint64 offset);
+void f3_pattern_check(const void *buffer, qint64 size, quint64 offset, f3_sector_stats &stats);
+quint64 f3_file_offset(qint64 number);
+
+// The fill/check routines pick the widest vector unit the CPU supports
+// (avx2, sse2, scalar) on first use; the output is identical for all of them.
+const char *f3_pattern_implementation_name();
+bool f3_pattern_select(const char *name);
+
+#endif // F3_PATTERN_H
@@ -0,0 +1,567 @@
+#include "f3_probe.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QSet>
+#include <QtMath>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#endif
+
+#define F3_PROBE_ALIGNMENT 4096
+#define F3_PROBE_SAMPLES 64
+#define F3_PROBE_MAX_ROUNDS 64
+#define F3_PROBE_EVICT_SIZE (Q_INT64_C(32) << 20)
+#define F3_PROBE_EVICT_CHUNK (Q_INT64_C(1) << 20)
+#define F3_PROBE_NO_TAG -1
+#define F3_SAMPLE_EDGE 8
+
+
+f3_probe::f3_probe() :
+    destructive(false),
+    evictSize(F3_PROBE_EVICT_SIZE),
+    sampleCount(F3_SAMPLE_COUNT),
+    cancelled(false),
+    errorNumber(0),
+    fd(-1),
+    blockCount(0),
+    salt(0),
+    buffer(nullptr),
+    evictBuffer(nullptr),
+    evictBackup(nullptr),
+    readNs(0),
+    writeNs(0)
+{
+}
+
+void f3_probe::setDestructive(bool enabled)
+{
+    destructive = enabled;
+}
+
+void f3_probe::setEvictSize(qint64 size)
+{
+    evictSize = qMax<qint64>(size, 0);
+}
+
+void f3_probe::setSampleCount(int count)
+{
+    sampleCount = qMax(count, 1);
+}
+
+void f3_probe::setCallbacks(const f3_engine_callbacks& callbacks)
+{
+    this->callbacks = callbacks;
+}
+
+void f3_probe::cancel()
+{
+    cancelled = true;
+}
+
+int f3_probe::getError() const
+{
+    return errorNumber;
+}
+
+const f3_probe_result& f3_probe::getResult() const
+{
+    return result;
+}
+
+// f3probe refuses partitions as well, the capacity of a fake card only
+// makes sense for the whole disk
+bool f3_probe::isPartition(const QString& device)
+{
+#ifdef Q_OS_LINUX
+    struct stat info;
+    if (stat(QFile::encodeName(device).constData(), &info) != 0 || !S_ISBLK(info.st_mode))
+        return false;
+    return QFileInfo::exists(QString("/sys/dev/block/%1:%2/partition")
+                             .arg(major(info.st_rdev)).arg(minor(info.st_rdev)));
+#else
+    Q_UNUSED(device);
+    return false;
+#endif
+}
+
+bool f3_probe::fail(int error)
+{
+    errorNumber = error;
+    return false;
+}
+
+bool f3_probe::open(const QString& device)
+{
+    cancelled = false;
+    errorNumber = 0;
+    result = f3_probe_result();
+    backups.clear();
+    aliases.clear();
+    readNs = writeNs = 0;
+    buffer = evictBuffer = evictBackup = nullptr;
+
+    QByteArray name = QFile::encodeName(device);
+    struct stat info;
+    if (stat(name.constData(), &info) != 0)
+        return fail(errno);
+    if (!S_ISBLK(info.st_mode))
+        return fail(S_ISDIR(info.st_mode) ? EISDIR : ENOTBLK);
+
+    // Every block has to come from the drive, not from the page cache
+    int flags = O_RDWR | O_SYNC;
+#ifdef O_DIRECT
+    flags |= O_DIRECT;
+#endif
+    fd = ::open(name.constData(), flags);
+    if (fd < 0)
+        return fail(errno);
+
+#ifdef Q_OS_LINUX
+    quint64 size = 0;
+    int sectorSize = 0;
+    if (ioctl(fd, BLKGETSIZE64, &size) != 0 || ioctl(fd, BLKSSZGET, &sectorSize) != 0)
+    {
+        int error = errno;
+        ::close(fd);
+        fd = -1;
+        return fail(error);
+    }
+    result.announcedSize = qint64(size);
+    result.blockSize = qMax(sectorSize, F3_SECTOR_SIZE);
+#else
+    result.announcedSize = lseek(fd, 0, SEEK_END);
+    result.blockSize = F3_SECTOR_SIZE;
+#endif
+    blockCount = result.announcedSize / result.blockSize;
+    salt = QRandomGenerator::global()->generate64();
+
+    if (posix_memalign(&buffer, F3_PROBE_ALIGNMENT, size_t(result.blockSize)) != 0 ||
+        posix_memalign(&evictBuffer, F3_PROBE_ALIGNMENT, size_t(F3_PROBE_EVICT_CHUNK)) != 0 ||
+        (!destructive && evictSize > 0 &&
+         posix_memalign(&evictBackup, F3_PROBE_ALIGNMENT, size_t(evictSize)) != 0))
+    {
+        close();
+        return fail(ENOMEM);
+    }
+    return true;
+}
+
+void f3_probe::close()
+{
+    // Put the original data back even if the probe was cancelled or failed
+    if (buffer)
+        restore();
+    free(evictBackup);
+    free(evictBuffer);
+    free(buffer);
+    evictBackup = evictBuffer = buffer = nullptr;
+    ::close(fd);
+    fd = -1;
+    result.writeMs = writeNs / 1000000;
+    result.readMs = readNs / 1000000;
+}
+
+bool f3_probe::run(const QString& device)
+{
+    if (!open(device))
+        return false;
+
+    bool ok = true;
+    qint64 good = -1;
+    qint64 bad = blockCount;
+    QVector<qint64> anchors;
+    const double depth = std::log2(double(blockCount) + 1);
+    while (ok && bad - good > 1 && result.rounds < F3_PROBE_MAX_ROUNDS)
+    {
+        ok = probeRound(anchors, good, bad);
+        if (ok && callbacks.progress)
+            callbacks.progress(qint64((depth - std::log2(double(bad - good))) * 1000),
+                               qint64(depth * 1000));
+    }
+
+    close();
+    if (!ok)
+        return false;
+
+    result.usableSize = (good + 1) * result.blockSize;
+    result.wrapped = !aliases.isEmpty();
+    if (!aliases.isEmpty())
+        result.moduleSize = aliasPeriod() * result.blockSize;
+    else
+    {
+        result.moduleSize = result.blockSize;
+        while (result.moduleSize < result.usableSize)
+            result.moduleSize <<= 1;
+    }
+    return true;
+}
+
+// Head and tail, where fakes give themselves away first, then the share
+// of the samples spread evenly and the share drawn at random; uniform
+// counts the latter two, the ones the confidence rests on
+QVector<qint64> f3_probe::pickSamples(int& uniform)
+{
+    QVector<qint64> samples;
+    QRandomGenerator *random = QRandomGenerator::global();
+    qint64 edge = qMin<qint64>(F3_SAMPLE_EDGE, blockCount);
+    for (qint64 block = 0; block < edge; block++)
+    {
+        samples.append(block);
+        samples.append(blockCount - 1 - block);
+    }
+
+    int strata = qMax(sampleCount / 2, 1);
+    for (int i = 0; i < strata; i++)
+    {
+        qint64 first = blockCount * i / strata;
+        qint64 span = qMax<qint64>(blockCount * (i + 1) / strata - first, 1);
+        samples.append(first + qint64(random->generate64() % quint64(span)));
+    }
+    for (int i = strata; i < sampleCount; i++)
+        samples.append(qint64(random->generate64() % quint64(blockCount)));
+
+    std::sort(samples.begin(), samples.end());
+    samples.erase(std::unique(samples.begin(), samples.end()), samples.end());
+    uniform = qMax(samples.size() - int(edge) * 2, 0);
+    return samples;
+}
+
+bool f3_probe::sample(const QString& device)
+{
+    if (!open(device))
+        return false;
+    if (blockCount == 0)
+    {
+        close();
+        return fail(ENOSPC);
+    }
+
+    int uniform = 0;
+    const QVector<qint64> samples = pickSamples(uniform);
+    const qint64 total = samples.size() * 2;
+    qint64 done = 0;
+    bool ok = true;
+    for (qint64 block : samples)
+    {
+        if (cancelled)
+        {
+            ok = fail(ECANCELED);
+            break;
+        }
+        tagBlock(block);
+        if (callbacks.progress)
+            callbacks.progress(++done, total);
+    }
+    if (ok)
+        evict(samples);
+
+    // Of two blocks sharing storage the higher one is the fake
+    qint64 bad = blockCount;
+    for (int i = 0; ok && i < samples.size(); i++)
+    {
+        if (cancelled)
+        {
+            ok = fail(ECANCELED);
+            break;
+        }
+        qint64 block = samples.at(i);
+        qint64 tag = readTag(block);
+        if (tag != block)
+        {
+            result.lostSamples++;
+            bad = qMin(bad, tag == F3_PROBE_NO_TAG ? block : qMax(block, tag));
+        }
+        if (callbacks.progress)
+            callbacks.progress(++done, total);
+    }
+
+    close();
+    if (!ok)
+        return false;
+
+    result.rounds = 1;
+    result.samples = samples.size();
+    result.usableSize = bad * result.blockSize;
+    result.confidence = result.lostSamples > 0 ? 0 :
+            1 - std::pow(1 - F3_SAMPLE_FAKE_SHARE, uniform);
+    return true;
+}
+
+bool f3_probe::probeRound(QVector<qint64>& anchors, qint64& good, qint64& bad)
+{
+    QVector<qint64> samples;
+    qint64 span = bad - good - 1;
+    if (result.rounds == 0)
+    {
+        // Fakes wrap at a power of two or at least a multiple of a large
+        // one, so start with such positions, their aliases land on each other
+        qint64 stride = 1;
+        while (stride * 2 * F3_PROBE_SAMPLES <= blockCount)
+            stride <<= 1;
+        for (qint64 block = 0; block < bad; block += stride)
+            samples.append(block);
+        for (qint64 block = 1; block < bad; block <<= 1)
+            samples.append(block);
+        samples.append(bad - 1);
+    }
+    else if (span <= F3_PROBE_SAMPLES)
+    {
+        for (qint64 block = good + 1; block < bad; block++)
+            samples.append(block);
+    }
+    else
+    {
+        for (int i = 1; i <= F3_PROBE_SAMPLES; i++)
+            samples.append(good + qint64(double(span) * i / F3_PROBE_SAMPLES));
+    }
+    // Once the wrap period is known, also tag the blocks each sample would
+    // land on so a wrap that is no power of two is still seen
+    if (!aliases.isEmpty())
+    {
+        qint64 period = aliasPeriod();
+        for (int i = samples.size() - 1; i >= 0; i--)
+        {
+            if (samples.at(i) >= period)
+                samples.append(samples.at(i) - period);
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    samples.erase(std::unique(samples.begin(), samples.end()), samples.end());
+    result.rounds++;
+
+    for (qint64 block : samples)
+    {
+        if (cancelled)
+            return fail(ECANCELED);
+        tagBlock(block);
+    }
+
+    QVector<qint64> checked = anchors + samples;
+    std::sort(checked.begin(), checked.end());
+    checked.erase(std::unique(checked.begin(), checked.end()), checked.end());
+    evict(checked);
+
+    // A block without its tag lost the data. Blocks that read back the
+    // same tag share one piece of storage, only the lowest of them is real.
+    QSet<qint64> broken;
+    QMap<qint64, qint64> owners;
+    for (qint64 block : checked)
+    {
+        if (cancelled)
+            return fail(ECANCELED);
+        qint64 tag = readTag(block);
+        if (tag == F3_PROBE_NO_TAG)
+        {
+            broken.insert(block);
+            continue;
+        }
+        qint64 owner = owners.value(tag, tag);
+        if (block < owner)
+            owners.insert(tag, block);
+        if (block != tag || owner != tag)
+        {
+            qint64 alias = qMax(block, owner);
+            broken.insert(alias);
+            if (!aliases.contains(alias))
+                aliases.insert(alias, qMin(block, owner));
+        }
+    }
+
+    for (qint64 block : checked)
+    {
+        if (broken.contains(block))
+        {
+            bad = qMin(bad, block);
+            break;
+        }
+    }
+    good = -1;
+    anchors.clear();
+    for (qint64 block : checked)
+    {
+        if (block >= bad)
+            break;
+        good = block;
+        anchors.append(block);
+    }
+    return true;
+}
+
+// The shortest distance between a block and its alias is the size of the
+// memory that is really there
+qint64 f3_probe::aliasPeriod() const
+{
+    qint64 period = blockCount;
+    for (auto i = aliases.constBegin(); i != aliases.constEnd(); ++i)
+        period = qMin(period, i.key() - i.value());
+    return period;
+}
+
+bool f3_probe::readBlock(qint64 block)
+{
+    QElapsedTimer timer;
+    timer.start();
+    ssize_t got;
+    do
+        got = pread(fd, buffer, size_t(result.blockSize), block * result.blockSize);
+    while (got < 0 && errno == EINTR);
+    readNs += timer.nsecsElapsed();
+    if (got > 0)
+        result.bytesRead += got;
+    return got == result.blockSize;
+}
+
+bool f3_probe::writeBlock(qint64 block, const void *data)
+{
+    QElapsedTimer timer;
+    timer.start();
+    ssize_t written;
+    do
+        written = pwrite(fd, data, size_t(result.blockSize), block * result.blockSize);
+    while (written < 0 && errno == EINTR);
+    writeNs += timer.nsecsElapsed();
+    if (written > 0)
+        result.bytesWritten += written;
+    return written == result.blockSize;
+}
+
+// Position of the block whose tag is stored at block, F3_PROBE_NO_TAG if
+// it holds anything else
+qint64 f3_probe::readTag(qint64 block)
+{
+    if (!readBlock(block))
+        return F3_PROBE_NO_TAG;
+
+    quint64 offset;
+    memcpy(&offset, buffer, sizeof(offset));
+    quint64 distance = offset - salt;
+    if (distance % quint64(result.blockSize) != 0 ||
+        distance / quint64(result.blockSize) >= quint64(blockCount))
+        return F3_PROBE_NO_TAG;
+
+    f3_sector_stats stats;
+    f3_pattern_check(buffer, result.blockSize, offset, stats);
+    if (stats.ok * F3_SECTOR_SIZE != result.blockSize)
+        return F3_PROBE_NO_TAG;
+    return qint64(distance / quint64(result.blockSize));
+}
+
+void f3_probe::tagBlock(qint64 block)
+{
+    // Unreadable blocks cannot be restored anyway
+    if (!destructive && readBlock(block))
+        backups.append(qMakePair(block, QByteArray(static_cast<const char *>(buffer), int(result.blockSize))));
+
+    f3_pattern_fill(buffer, result.blockSize, salt + quint64(block * result.blockSize));
+    // A failed write shows up as a missing tag when reading back
+    writeBlock(block, buffer);
+}
+
+// Cheap drives keep the last writes in a RAM cache and answer reads from
+// it, and reads do not push them out, so like f3probe this writes other
+// data through: over the lowest run of blocks between the tagged ones,
+// sorted in tagged, where the real storage is. A tagged block that is an
+// alias of the run loses its tag, which only exposes it. Unless the test
+// is destructive the run is read first and written back at the end, both
+// passes count towards the eviction.
+void f3_probe::evict(const QVector<qint64>& tagged)
+{
+    fdatasync(fd);
+#ifdef Q_OS_LINUX
+    ioctl(fd, BLKFLSBUF, 0);
+#endif
+
+    qint64 want = qMin(evictSize, blockCount * result.blockSize) / result.blockSize;
+    qint64 start = 0;
+    qint64 length = 0;
+    qint64 previous = -1;
+    for (int i = 0; i <= tagged.size() && length < want; i++)
+    {
+        qint64 next = i < tagged.size() ? tagged.at(i) : blockCount;
+        if (next - previous - 1 > length)
+        {
+            start = previous + 1;
+            length = qMin(next - previous - 1, want);
+        }
+        previous = next;
+    }
+
+    const qint64 first = start * result.blockSize;
+    const qint64 size = length * result.blockSize;
+    const qint64 chunkSize = F3_PROBE_EVICT_CHUNK - F3_PROBE_EVICT_CHUNK % result.blockSize;
+    qint64 done = 0;
+    QVector<bool> saved;
+    for (qint64 offset = 0; offset < size && !cancelled; offset += chunkSize)
+    {
+        qint64 chunk = qMin(chunkSize, size - offset);
+        char *backup = static_cast<char *>(evictBackup) + offset;
+        QElapsedTimer timer;
+        if (evictBackup)
+        {
+            // What cannot be read back cannot be restored, leave it alone
+            timer.start();
+            ssize_t got = pread(fd, backup, size_t(chunk), first + offset);
+            readNs += timer.nsecsElapsed();
+            if (got > 0)
+                result.bytesRead += got;
+            saved.append(got == chunk);
+            if (got != chunk)
+                continue;
+        }
+        f3_pattern_fill(evictBuffer, chunk, quint64(first + offset));
+        timer.start();
+        ssize_t written = pwrite(fd, evictBuffer, size_t(chunk), first + offset);
+        writeNs += timer.nsecsElapsed();
+        if (written > 0)
+            result.bytesWritten += written;
+        done = offset + chunk;
+    }
+
+    // Even after a cancel
+    for (qint64 offset = 0; evictBackup && offset < done; offset += chunkSize)
+    {
+        if (!saved.at(int(offset / chunkSize)))
+            continue;
+        qint64 chunk = qMin(chunkSize, done - offset);
+        QElapsedTimer timer;
+        timer.start();
+        ssize_t written = pwrite(fd, static_cast<char *>(evictBackup) + offset, size_t(chunk), first + offset);
+        writeNs += timer.nsecsElapsed();
+        if (written > 0)
+            result.bytesWritten += written;
+    }
+    fdatasync(fd);
+#ifdef Q_OS_LINUX
+    ioctl(fd, BLKFLSBUF, 0);
+#endif
+}
+
+void f3_probe::restore()
+{
+    // Newest first, so a block overwritten through an alias gets its
+    // original content back last
+    for (int i = backups.size() - 1; i >= 0; i--)
+    {
+        memcpy(buffer, backups.at(i).second.constData(), size_t(result.blockSize));
+        writeBlock(backups.at(i).first, buffer);
+    }
+    backups.clear();
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+#ifdef Q_OS_LINUX
+        ioctl(fd, BLKFLSBUF, 0);
+#endif
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef F3_PROBE_H
+#define F3_PROBE_H
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include <QMap>
+#include <atomic>
+#include "f3_engine.h"
+
+#define F3_SAMPLE_COUNT 512
+#define F3_SAMPLE_FAKE_SHARE 0.01
+
+struct f3_probe_result
+{
+    qint64 announcedSize = 0;   // bytes the device claims to have
+    qint64 usableSize = 0;      // bytes before the first block that lost data
+    qint64 moduleSize = 0;
+    qint64 blockSize = 0;
+    qint64 bytesWritten = 0;
+    qint64 writeMs = 0;
+    qint64 bytesRead = 0;
+    qint64 readMs = 0;
+    int rounds = 0;
+    bool wrapped = false;       // lost blocks alias lower ones
+    int samples = 0;            // sample(): blocks checked
+    int lostSamples = 0;        // sample(): blocks that lost their data
+    double confidence = -1;     // sample(): that less than F3_SAMPLE_FAKE_SHARE is missing
+};
+
+// Native replacement for f3probe. Each round writes blocks tagged with their
+// own position across the interval still in doubt, pushes them out of the
+// drive cache by writing other blocks and reads everything back. A block holding another block's
+// tag exposes the higher one as an alias of the lower, so wrapping fakes
+// are caught as well as ones that drop writes, as long as they wrap at a
+// multiple of the first round's power-of-two stride. Only the probed blocks
+// are backed up, a few hundred at most, and written back afterwards unless
+// the test is destructive; so are the 32 MiB the eviction writes over.
+//
+// sample() screens a device instead of measuring it: one round over the
+// first and last blocks plus a random block out of each of count/2 equal
+// strata and count/2 anywhere. If none of them lost its data, the capacity
+// is genuine with the reported confidence unless less than
+// F3_SAMPLE_FAKE_SHARE of it is missing.
+class f3_probe
+{
+public:
+    f3_probe();
+    void setDestructive(bool enabled);
+    void setEvictSize(qint64 size);
+    void setSampleCount(int count);
+    void setCallbacks(const f3_engine_callbacks& callbacks);
+    bool run(const QString& device);
+    bool sample(const QString& device);
+    void cancel();
+    int getError() const;
+    const f3_probe_result& getResult() const;
+    static bool isPartition(const QString& device);
+
+private:
+    bool destructive;
+    qint64 evictSize;
+    int sampleCount;
+    std::atomic<bool> cancelled;
+    int errorNumber;
+    f3_engine_callbacks callbacks;
+    f3_probe_result result;
+
+    int fd;
+    qint64 blockCount;
+    quint64 salt;
+    void *buffer;
+    void *evictBuffer;
+    void *evictBackup;      // what the eviction writes over, kept unless destructive
+    QVector<QPair<qint64, QByteArray>> backups;
+    QMap<qint64, qint64> aliases;
+    qint64 readNs;
+    qint64 writeNs;
+
+    bool fail(int error);
+    bool open(const QString& device);
+    void close();
+    QVector<qint64> pickSamples(int& uniform);
+    qint64 aliasPeriod() const;
+    bool readBlock(qint64 block);
+    bool writeBlock(qint64 block, const void *data);
+    qint64 readTag(qint64 block);
+    void tagBlock(qint64 block);
+    void evict(const QVector<qint64>& tagged);
+    bool probeRound(QVector<qint64>& anchors, qint64& good, qint64& bad);
+    void restore();
+};
+
+#endif // F3_PROBE_H
@@ -0,0 +1,236 @@
+#include "f3_region_map.h"
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <iterator>
+
+#define F3_REGION_MAP_MAGIC 0x46335247  // "F3RG"
+
+
+static F3Region f3_region_worst(F3Region a, F3Region b)
+{
+    return quint8(a) >= quint8(b) ? a : b;
+}
+
+f3_region_map::f3_region_map() :
+    granularity(1)
+{
+}
+
+void f3_region_map::clear()
+{
+    runs.clear();
+    granularity = 1;
+}
+
+bool f3_region_map::isEmpty() const
+{
+    return runs.isEmpty();
+}
+
+F3Region f3_region_map::kindAt(qint64 sector) const
+{
+    auto i = runs.upperBound(sector);
+    if (i == runs.constBegin())
+        return F3Region::Unknown;
+    return (--i).value();
+}
+
+// Sets [start, end) to kind, with no two neighbouring runs alike
+void f3_region_map::assign(qint64 start, qint64 end, F3Region kind)
+{
+    if (start >= end)
+        return;
+    F3Region before = kindAt(start - 1);
+    F3Region after = kindAt(end);
+    auto i = runs.lowerBound(start);
+    while (i != runs.end() && i.key() <= end)
+        i = runs.erase(i);
+    if (kind != before)
+        runs.insert(start, kind);
+    if (after != kind)
+        runs.insert(end, after);
+}
+
+// Whole granules take the new kind, the ones cut at either end keep the
+// worse of what they had and the new kind
+void f3_region_map::markSectors(qint64 start, qint64 end, F3Region kind)
+{
+    if (start >= end)
+        return;
+    qint64 first = start - start % granularity;
+    qint64 last = end + (granularity - end % granularity) % granularity;
+    qint64 innerStart = start + (granularity - start % granularity) % granularity;
+    qint64 innerEnd = end - end % granularity;
+    if (innerStart >= innerEnd)
+    {
+        for (qint64 granule = first; granule < last; granule += granularity)
+            assign(granule, granule + granularity, f3_region_worst(kindAt(granule), kind));
+    }
+    else
+    {
+        assign(innerStart, innerEnd, kind);
+        if (first < innerStart)
+            assign(first, innerStart, f3_region_worst(kindAt(first), kind));
+        if (innerEnd < last)
+            assign(innerEnd, last, f3_region_worst(kindAt(innerEnd), kind));
+    }
+    while (runs.size() > F3_REGION_MAP_MAX_RUNS)
+        coarsen();
+}
+
+void f3_region_map::coarsen()
+{
+    const QVector<f3_region> regions = getRegions();
+    runs.clear();
+    granularity *= 2;
+    for (const f3_region& region : regions)
+    {
+        if (region.kind != F3Region::Unknown)
+            markSectors(region.offset / F3_SECTOR_SIZE,
+                        (region.offset + region.size) / F3_SECTOR_SIZE, region.kind);
+    }
+}
+
+void f3_region_map::mark(qint64 offset, qint64 size, F3Region kind)
+{
+    markSectors(offset / F3_SECTOR_SIZE, (offset + size + F3_SECTOR_SIZE - 1) / F3_SECTOR_SIZE, kind);
+}
+
+// f3read only tells how many sectors of a file it found in each state, not
+// where; they are laid out good first, the way f3read counts Data OK
+void f3_region_map::markCounts(qint64 offset, const f3_sector_stats& sectors)
+{
+    const QPair<qint64, F3Region> parts[] = {
+        {sectors.ok, F3Region::Good},
+        {sectors.changed, F3Region::Changed},
+        {sectors.overwritten, F3Region::Overwritten},
+        {sectors.corrupted, F3Region::Corrupted}
+    };
+    for (const QPair<qint64, F3Region>& part : parts)
+    {
+        mark(offset, part.first * F3_SECTOR_SIZE, part.second);
+        offset += part.first * F3_SECTOR_SIZE;
+    }
+}
+
+void f3_region_map::merge(const f3_region_map& other)
+{
+    const QVector<f3_region> regions = other.getRegions();
+    for (const f3_region& region : regions)
+    {
+        if (region.kind != F3Region::Unknown)
+            mark(region.offset, region.size, region.kind);
+    }
+}
+
+QVector<f3_region> f3_region_map::getRegions() const
+{
+    QVector<f3_region> regions;
+    for (auto i = runs.constBegin(); i != runs.constEnd(); ++i)
+    {
+        auto next = std::next(i);
+        if (next == runs.constEnd())
+            break;
+        regions.append({i.key() * F3_SECTOR_SIZE, (next.key() - i.key()) * F3_SECTOR_SIZE, i.value()});
+    }
+    return regions;
+}
+
+// The worst kind in each of slots equal parts of the map
+QVector<F3Region> f3_region_map::summarize(int slots) const
+{
+    QVector<F3Region> summary(qMax(slots, 0), F3Region::Unknown);
+    if (runs.isEmpty() || slots <= 0)
+        return summary;
+    const qint64 extent = runs.lastKey();
+    for (auto i = runs.constBegin(); i != runs.constEnd(); ++i)
+    {
+        auto next = std::next(i);
+        if (next == runs.constEnd())
+            break;
+        int first = int(i.key() * slots / extent);
+        int last = int((next.key() * slots - 1) / extent);
+        for (int slot = first; slot <= last && slot < slots; slot++)
+            summary[slot] = f3_region_worst(summary.at(slot), i.value());
+    }
+    return summary;
+}
+
+qint64 f3_region_map::getSize() const
+{
+    return runs.isEmpty() ? 0 : runs.lastKey() * F3_SECTOR_SIZE;
+}
+
+qint64 f3_region_map::getGranularity() const
+{
+    return granularity * F3_SECTOR_SIZE;
+}
+
+// Bytes from the start up to the first one that is not known to be good
+qint64 f3_region_map::goodPrefix() const
+{
+    if (runs.isEmpty() || runs.firstKey() != 0 || runs.first() != F3Region::Good)
+        return 0;
+    auto next = std::next(runs.constBegin());
+    return next == runs.constEnd() ? 0 : next.key() * F3_SECTOR_SIZE;
+}
+
+qint64 f3_region_map::bytes(F3Region kind) const
+{
+    qint64 total = 0;
+    const QVector<f3_region> regions = getRegions();
+    for (const f3_region& region : regions)
+    {
+        if (region.kind == kind)
+            total += region.size;
+    }
+    return total;
+}
+
+bool f3_region_map::save(const QString& fileName) const
+{
+    QSaveFile file(fileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint32(F3_REGION_MAP_MAGIC) << quint32(F3_REGION_MAP_FORMAT)
+        << qint64(granularity) << qint64(runs.size());
+    for (auto i = runs.constBegin(); i != runs.constEnd(); ++i)
+        out << qint64(i.key()) << quint8(i.value());
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+bool f3_region_map::load(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint32 format = 0;
+    qint64 granule = 0;
+    qint64 count = 0;
+    in >> magic >> format >> granule >> count;
+    if (magic != F3_REGION_MAP_MAGIC || format != F3_REGION_MAP_FORMAT ||
+        granule <= 0 || count < 0 || count > F3_REGION_MAP_MAX_RUNS + 2)
+        return false;
+
+    QMap<qint64, F3Region> loaded;
+    for (qint64 i = 0; i < count; i++)
+    {
+        qint64 sector = 0;
+        quint8 kind = 0;
+        in >> sector >> kind;
+        if (kind > quint8(F3Region::Corrupted))
+            return false;
+        loaded.insert(sector, F3Region(kind));
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+    runs = loaded;
+    granularity = granule;
+    return true;
+}
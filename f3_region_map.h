@@ -0,0 +1,63 @@
+#ifndef F3_REGION_MAP_H
+#define F3_REGION_MAP_H
+#include <QString>
+#include <QMap>
+#include <QVector>
+#include "f3_pattern.h"
+
+#define F3_REGION_MAP_MAX_RUNS 65536
+#define F3_REGION_MAP_FORMAT 1
+
+// Ordered by how bad they are, a coarse map keeps the worst of a granule
+enum class F3Region : quint8 {
+    Unknown = 0,
+    Good = 1,
+    Changed = 2,
+    Overwritten = 3,
+    Corrupted = 4
+};
+
+struct f3_region
+{
+    qint64 offset;
+    qint64 size;
+    F3Region kind;
+};
+
+// Which byte ranges of the checked space held their data and how the rest
+// was lost, run-length coded at sector granularity. Past
+// F3_REGION_MAP_MAX_RUNS runs the granule doubles and mixed granules take
+// their worst kind, so even a device that fails every other sector costs a
+// few MB at most.
+class f3_region_map
+{
+public:
+    f3_region_map();
+    void clear();
+    bool isEmpty() const;
+    void mark(qint64 offset, qint64 size, F3Region kind);
+    void markCounts(qint64 offset, const f3_sector_stats& sectors);
+    void merge(const f3_region_map& other);
+
+    QVector<f3_region> getRegions() const;
+    QVector<F3Region> summarize(int slots) const;
+    qint64 getSize() const;
+    qint64 getGranularity() const;
+    qint64 goodPrefix() const;
+    qint64 bytes(F3Region kind) const;
+
+    bool save(const QString& fileName) const;
+    bool load(const QString& fileName);
+
+private:
+    // Sector a run starts at and its kind, up to the next one
+    QMap<qint64, F3Region> runs;
+    qint64 granularity;
+
+    F3Region kindAt(qint64 sector) const;
+    void assign(qint64 start, qint64 end, F3Region kind);
+    void markSectors(qint64 start, qint64 end, F3Region kind);
+    void coarsen();
+};
+
+#endif // F3_REGION_MAP_H
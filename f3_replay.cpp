@@ -0,0 +1,427 @@
+#include "f3_replay.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#define F3_REPLAY_TYPE_HEADER "header"
+#define F3_REPLAY_TYPE_START "start"
+#define F3_REPLAY_TYPE_OUTPUT "output"
+#define F3_REPLAY_TYPE_FINISH "finish"
+#define F3_REPLAY_TYPE_STATUS "status"
+#define F3_REPLAY_TYPE_ERROR "error"
+#define F3_REPLAY_TYPE_REPORT "report"
+
+// Exit code QProcess reports for a tool stopped with terminate()
+#define F3_REPLAY_EXIT_TERMINATED 15
+
+
+static QJsonObject f3_replay_report(const f3_launcher_report& report)
+{
+    QJsonObject object;
+    object["success"] = report.success;
+    object["readingSpeed"] = report.ReadingSpeed;
+    object["writingSpeed"] = report.WritingSpeed;
+    object["reportedFree"] = report.ReportedFree;
+    object["actualFree"] = report.ActualFree;
+    object["lostSpace"] = report.LostSpace;
+    object["availability"] = double(report.availability);
+    object["moduleSize"] = report.ModuleSize;
+    object["blockSize"] = report.BlockSize;
+    // Only present when set, so recordings made before it still match
+    if (!report.FailReason.isEmpty())
+        object["failReason"] = report.FailReason;
+    return object;
+}
+
+bool f3_recorder::open(const QString& fileName, const QString& devPath,
+                       const QMap<QString,QString>& options, const f3_capabilities& capabilities)
+{
+    file.close();
+    file.setFileName(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        return false;
+    clock.start();
+
+    QJsonObject optionObject;
+    for (auto i = options.constBegin(); i != options.constEnd(); ++i)
+        optionObject[i.key()] = i.value();
+    QJsonObject capabilityObject;
+    capabilityObject["path"] = capabilities.path;
+    capabilityObject["version"] = double(capabilities.version);
+    capabilityObject["quick"] = capabilities.quick;
+    capabilityObject["fix"] = capabilities.fix;
+    capabilityObject["progress"] = capabilities.progress;
+
+    QJsonObject event;
+    event["type"] = F3_REPLAY_TYPE_HEADER;
+    event["format"] = F3_REPLAY_FORMAT;
+    event["device"] = devPath;
+    event["options"] = optionObject;
+    event["capabilities"] = capabilityObject;
+    write(event);
+    return true;
+}
+
+void f3_recorder::recordStart(const QString& command, const QStringList& args)
+{
+    QJsonObject event;
+    event["type"] = F3_REPLAY_TYPE_START;
+    event["command"] = command;
+    event["args"] = QJsonArray::fromStringList(args);
+    write(event);
+}
+
+void f3_recorder::recordOutput(QProcess::ProcessChannel channel, const QByteArray& data)
+{
+    if (data.isEmpty())
+        return;
+    QJsonObject event;
+    event["type"] = F3_REPLAY_TYPE_OUTPUT;
+    event["channel"] = channel == QProcess::StandardError ? "stderr" : "stdout";
+    event["data"] = QString::fromLatin1(data.toBase64());
+    write(event);
+}
+
+void f3_recorder::recordFinish(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    QJsonObject event;
+    event["type"] = F3_REPLAY_TYPE_FINISH;
+    event["exitCode"] = exitCode;
+    event["crashed"] = exitStatus == QProcess::CrashExit;
+    write(event);
+}
+
+void f3_recorder::recordStatus(f3_launcher_status status)
+{
+    QJsonObject event;
+    event["type"] = F3_REPLAY_TYPE_STATUS;
+    event["status"] = int(status);
+    write(event);
+}
+
+void f3_recorder::recordError(f3_launcher_error_code errCode)
+{
+    QJsonObject event;
+    event["type"] = F3_REPLAY_TYPE_ERROR;
+    event["error"] = int(errCode);
+    write(event);
+}
+
+void f3_recorder::recordReport(const f3_launcher_report& report)
+{
+    QJsonObject event = f3_replay_report(report);
+    event["type"] = F3_REPLAY_TYPE_REPORT;
+    write(event);
+}
+
+void f3_recorder::write(QJsonObject event)
+{
+    if (!file.isOpen())
+        return;
+    event["t"] = clock.elapsed();
+    // Flushed line by line, a recording of a crash is the useful one
+    file.write(QJsonDocument(event).toJson(QJsonDocument::Compact).append('\n'));
+    file.flush();
+}
+
+
+f3_replay::f3_replay(QObject *parent) :
+    QObject(parent),
+    speed(1),
+    position(0),
+    processStart(0),
+    running(false),
+    finished(false)
+{
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, &f3_replay::deliver);
+}
+
+bool f3_replay::load(const QString& fileName)
+{
+    events.clear();
+    expected.clear();
+    error.clear();
+
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+    {
+        error = file.errorString();
+        return false;
+    }
+    int lineNumber = 0;
+    while (!file.atEnd())
+    {
+        QByteArray line = file.readLine().trimmed();
+        lineNumber++;
+        if (line.isEmpty())
+            continue;
+        QJsonParseError parseError;
+        QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+        if (!document.isObject())
+        {
+            error = QString("Line %1: %2").arg(lineNumber).arg(parseError.errorString());
+            return false;
+        }
+        events.append(document.object());
+    }
+
+    if (events.isEmpty() || events.first()["type"].toString() != F3_REPLAY_TYPE_HEADER ||
+        events.first()["format"].toInt() != F3_REPLAY_FORMAT)
+    {
+        error = "Not an f3-qt recording";
+        return false;
+    }
+    header = events.first();
+
+    // Runs that touch the device themselves have nothing to replay
+    QJsonObject options = header["options"].toObject();
+    if (options["mode"].toString() == "native" || options["mode"].toString() == "sample" ||
+        options["mode"].toString() == "raw")
+    {
+        error = "Native runs cannot be replayed";
+        return false;
+    }
+    if (options["cache"].toString() == "write")
+    {
+        error = "Runs resuming from cached files cannot be replayed";
+        return false;
+    }
+    if (options["resume"].toString() == "true")
+    {
+        error = "Runs keeping a checkpoint cannot be replayed";
+        return false;
+    }
+
+    for (const QJsonObject& event : events)
+    {
+        QString type = event["type"].toString();
+        if (type == F3_REPLAY_TYPE_STATUS)
+            expected.append(QString("status %1").arg(event["status"].toInt()));
+        else if (type == F3_REPLAY_TYPE_ERROR)
+            expected.append(QString("error %1").arg(event["error"].toInt()));
+        else if (type == F3_REPLAY_TYPE_REPORT)
+            report = event;
+    }
+    return true;
+}
+
+void f3_replay::setSpeed(double speed)
+{
+    this->speed = qMax(0.0, speed);
+}
+
+QString f3_replay::getError()
+{
+    return error;
+}
+
+QString f3_replay::getMismatch()
+{
+    return mismatch;
+}
+
+f3_capabilities f3_replay::getCapabilities()
+{
+    QJsonObject object = header["capabilities"].toObject();
+    f3_capabilities capabilities;
+    capabilities.path = object["path"].toString();
+    capabilities.version = float(object["version"].toDouble());
+    capabilities.quick = object["quick"].toBool();
+    capabilities.fix = object["fix"].toBool();
+    capabilities.progress = object["progress"].toBool();
+    return capabilities;
+}
+
+void f3_replay::start(f3_launcher *launcher)
+{
+    this->launcher = launcher;
+    replayed.clear();
+    mismatch.clear();
+    position = 1;
+    running = false;
+    finished = false;
+
+    QJsonObject options = header["options"].toObject();
+    for (auto i = options.constBegin(); i != options.constEnd(); ++i)
+        launcher->setOption(i.key(), i.value().toString());
+    // Never overwrite the recording, never fall back to probing the
+    // device natively and keep no region map of a device that is not there
+    launcher->setOption("record", "");
+    launcher->setOption("probe", "external");
+    launcher->setOption("regions", "no");
+    launcher->setReplay(this);
+
+    connect(launcher, &f3_launcher::f3_launcher_status_changed, this, &f3_replay::on_launcher_status_changed);
+    connect(launcher, &f3_launcher::f3_launcher_error, this, &f3_replay::on_launcher_error);
+    launcher->startCheck(header["device"].toString());
+}
+
+int f3_replay::findStart(int from)
+{
+    for (int i = from; i < events.size(); i++)
+    {
+        if (events.at(i)["type"].toString() == F3_REPLAY_TYPE_START)
+            return i;
+    }
+    return -1;
+}
+
+// Next output or exit of the process started last
+int f3_replay::findProcessEvent(int from)
+{
+    for (int i = from; i < events.size(); i++)
+    {
+        QString type = events.at(i)["type"].toString();
+        if (type == F3_REPLAY_TYPE_OUTPUT || type == F3_REPLAY_TYPE_FINISH)
+            return i;
+        if (type == F3_REPLAY_TYPE_START)
+            return -1;
+    }
+    return -1;
+}
+
+void f3_replay::startProcess(const QString& command, const QStringList& args)
+{
+    Q_UNUSED(args);
+    int index = findStart(position);
+    if (index < 0)
+    {
+        fail(QString("%1 started after the recording ended").arg(command));
+        return;
+    }
+    QString recorded = events.at(index)["command"].toString();
+    if (recorded != command)
+    {
+        fail(QString("%1 started where %2 was recorded").arg(command, recorded));
+        return;
+    }
+
+    position = index + 1;
+    processStart = qint64(events.at(index)["t"].toDouble());
+    running = true;
+    clock.start();
+    scheduleNext();
+}
+
+void f3_replay::stopProcess()
+{
+    timer.stop();
+    if (!running)
+        return;
+    running = false;
+    // Whatever the recording still holds for this process is skipped
+    for (int index = findProcessEvent(position); index >= 0; index = findProcessEvent(index + 1))
+        position = index + 1;
+    emit f3_replay_process_finished(F3_REPLAY_EXIT_TERMINATED, QProcess::CrashExit);
+}
+
+void f3_replay::scheduleNext()
+{
+    int index = findProcessEvent(position);
+    if (index < 0)
+    {
+        fail("Recording ends before the process exits");
+        return;
+    }
+    position = index;
+
+    qint64 delay = 0;
+    if (speed > 0)
+    {
+        qint64 due = qint64((events.at(index)["t"].toDouble() - processStart) / speed);
+        delay = qMax<qint64>(0, due - clock.elapsed());
+    }
+    timer.start(int(delay));
+}
+
+void f3_replay::deliver()
+{
+    if (!running || position >= events.size())
+        return;
+
+    const QJsonObject event = events.at(position++);
+    if (event["type"].toString() == F3_REPLAY_TYPE_OUTPUT)
+    {
+        QProcess::ProcessChannel channel = event["channel"].toString() == "stderr" ?
+                    QProcess::StandardError : QProcess::StandardOutput;
+        emit f3_replay_output(channel, QByteArray::fromBase64(event["data"].toString().toLatin1()));
+        scheduleNext();
+        return;
+    }
+
+    // The launcher may start the next process right from this signal
+    running = false;
+    emit f3_replay_process_finished(event["exitCode"].toInt(),
+                                    event["crashed"].toBool() ? QProcess::CrashExit : QProcess::NormalExit);
+}
+
+void f3_replay::fail(const QString& reason)
+{
+    if (finished)
+        return;
+    if (mismatch.isEmpty())
+        mismatch = reason;
+    timer.stop();
+    running = false;
+    if (!launcher.isNull())
+        launcher->stopCheck();
+    complete();
+}
+
+void f3_replay::on_launcher_status_changed(f3_launcher_status status)
+{
+    if (finished)
+        return;
+    replayed.append(QString("status %1").arg(int(status)));
+    if ((status != F3Status::Finished && status != F3Status::Stopped) || launcher->getStage() != 0)
+        return;
+
+    // A fix the user asked for after the check is part of the recording
+    int index = findStart(position);
+    if (index >= 0 && events.at(index)["command"].toString() == F3_FIX_COMMAND)
+    {
+        QTimer::singleShot(0, launcher.data(), &f3_launcher::startFix);
+        return;
+    }
+    QTimer::singleShot(0, this, &f3_replay::complete);
+}
+
+void f3_replay::on_launcher_error(f3_launcher_error_code errCode)
+{
+    if (!finished)
+        replayed.append(QString("error %1").arg(int(errCode)));
+}
+
+void f3_replay::complete()
+{
+    if (finished)
+        return;
+    finished = true;
+
+    for (int i = 0; i < qMax(expected.size(), replayed.size()) && mismatch.isEmpty(); i++)
+    {
+        QString want = i < expected.size() ? expected.at(i) : QString("nothing");
+        QString got = i < replayed.size() ? replayed.at(i) : QString("nothing");
+        if (want != got)
+            mismatch = QString("Event %1: %2 where %3 was recorded").arg(i + 1).arg(got, want);
+    }
+
+    if (mismatch.isEmpty() && !report.isEmpty() && !launcher.isNull())
+    {
+        QJsonObject got = f3_replay_report(launcher->getReport());
+        for (auto i = got.constBegin(); i != got.constEnd(); ++i)
+        {
+            if (i.value() != report[i.key()])
+            {
+                mismatch = QString("Report %1: %2 where %3 was recorded")
+                        .arg(i.key(), i.value().toVariant().toString(),
+                             report[i.key()].toVariant().toString());
+                break;
+            }
+        }
+    }
+
+    if (!launcher.isNull())
+        disconnect(launcher.data(), nullptr, this, nullptr);
+    emit f3_replay_finished(mismatch.isEmpty());
+}
@@ -0,0 +1,94 @@
+#ifndef F3_REPLAY_H
+#define F3_REPLAY_H
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonObject>
+#include <QPointer>
+#include <QProcess>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include "f3_capability.h"
+#include "f3_launcher.h"
+
+#define F3_REPLAY_FORMAT 1
+
+// Writes everything a check went through as JSON lines: the options and
+// capabilities it started with, every f3 process with its output chunks
+// and exit, and the statuses, errors and report of the launcher, each
+// stamped with the milliseconds since the start.
+class f3_recorder
+{
+public:
+    bool open(const QString& fileName, const QString& devPath,
+              const QMap<QString,QString>& options, const f3_capabilities& capabilities);
+    void recordStart(const QString& command, const QStringList& args);
+    void recordOutput(QProcess::ProcessChannel channel, const QByteArray& data);
+    void recordFinish(int exitCode, QProcess::ExitStatus exitStatus);
+    void recordStatus(f3_launcher_status status);
+    void recordError(f3_launcher_error_code errCode);
+    void recordReport(const f3_launcher_report& report);
+
+private:
+    QFile file;
+    QElapsedTimer clock;
+
+    void write(QJsonObject event);
+};
+
+// Plays a recording back into a launcher in place of the f3 tools, at the
+// recorded pace times speed or, with speed 0, as fast as the event loop
+// goes. The launcher runs its usual state machine on the recorded output;
+// the statuses and errors it emits and its final report must then match
+// the recorded ones.
+class f3_replay : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit f3_replay(QObject *parent = nullptr);
+    bool load(const QString& fileName);
+    void setSpeed(double speed);
+    void start(f3_launcher *launcher);
+    QString getError();
+    QString getMismatch();
+    f3_capabilities getCapabilities();
+
+    // Called by the launcher instead of running f3
+    void startProcess(const QString& command, const QStringList& args);
+    void stopProcess();
+
+signals:
+    void f3_replay_output(QProcess::ProcessChannel channel, const QByteArray& data);
+    void f3_replay_process_finished(int exitCode, QProcess::ExitStatus exitStatus);
+    void f3_replay_finished(bool matched);
+
+private:
+    QVector<QJsonObject> events;
+    QJsonObject header;
+    QJsonObject report;
+    QStringList expected;
+    QStringList replayed;
+    QPointer<f3_launcher> launcher;
+    QTimer timer;
+    QElapsedTimer clock;
+    double speed;
+    int position;
+    qint64 processStart;
+    bool running;
+    bool finished;
+    QString error;
+    QString mismatch;
+
+    int findStart(int from);
+    int findProcessEvent(int from);
+    void scheduleNext();
+    void deliver();
+    void fail(const QString& reason);
+    void complete();
+    void on_launcher_status_changed(f3_launcher_status status);
+    void on_launcher_error(f3_launcher_error_code errCode);
+};
+
+#endif // F3_REPLAY_H
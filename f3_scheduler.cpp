@@ -0,0 +1,279 @@
+#include "f3_scheduler.h"
+#include "f3_devices.h"
+#include <QThread>
+#include <climits>
+
+#define F3_SCHEDULER_DEFAULT_CONCURRENCY 4
+// One more device on a bus has to add this much, in percent, to stay
+#define F3_SCHEDULER_BUS_GAIN 110
+// Share of the root hub's link speed past which a bus counts as full
+#define F3_SCHEDULER_BUS_SATURATION 60
+
+
+f3_scheduler::f3_scheduler(QObject *parent) :
+    QObject(parent),
+    sysRoot(F3_DEVICES_SYS_ROOT),
+    concurrency(qMax(1, qMin(QThread::idealThreadCount(), F3_SCHEDULER_DEFAULT_CONCURRENCY))),
+    busConcurrency(F3_SCHEDULER_BUS_AUTO),
+    nextId(1),
+    started(false)
+{
+}
+
+f3_scheduler::~f3_scheduler()
+{
+    stop();
+}
+
+int f3_scheduler::addJob(const QString& devPath, const QMap<QString,QString>& options)
+{
+    f3_job job;
+    job.id = nextId++;
+    job.devPath = devPath;
+    job.options = options;
+    f3_device device;
+    const QString disk = f3_devices::diskName(sysRoot, devPath);
+    if (!disk.isEmpty() && f3_devices::readDevice(sysRoot, disk, device) && device.usbBus > 0)
+    {
+        job.usbBus = device.usbBus;
+        job.usbPort = device.usbPort;
+        buses[job.usbBus].linkSpeed = device.usbBusSpeed;
+    }
+    jobs[job.id] = job;
+    pending.enqueue(job.id);
+    if (started)
+        dispatch();
+    return job.id;
+}
+
+void f3_scheduler::setConcurrency(int limit)
+{
+    concurrency = qMax(1, limit);
+    if (started)
+        dispatch();
+}
+
+int f3_scheduler::getConcurrency()
+{
+    return concurrency;
+}
+
+// F3_SCHEDULER_BUS_AUTO measures each bus, F3_SCHEDULER_BUS_UNLIMITED
+// leaves only the overall limit
+void f3_scheduler::setBusConcurrency(int limit)
+{
+    busConcurrency = qMax(F3_SCHEDULER_BUS_UNLIMITED, limit);
+    if (started)
+        dispatch();
+}
+
+int f3_scheduler::getBusConcurrency()
+{
+    return busConcurrency;
+}
+
+int f3_scheduler::getBusLimit(int bus)
+{
+    if (busConcurrency == F3_SCHEDULER_BUS_UNLIMITED)
+        return INT_MAX;
+    if (busConcurrency > 0)
+        return busConcurrency;
+    return buses.value(bus).limit;
+}
+
+// Where the USB topology is read from, for jobs added afterwards
+void f3_scheduler::setSysRoot(const QString& path)
+{
+    sysRoot = path;
+}
+
+void f3_scheduler::start()
+{
+    started = true;
+    dispatch();
+}
+
+void f3_scheduler::stop()
+{
+    started = false;
+    pending.clear();
+    const QList<f3_launcher*> running = launchers.values();
+    for (f3_launcher *launcher : running)
+        launcher->stopCheck();
+}
+
+void f3_scheduler::cancelJob(int id)
+{
+    if (pending.removeAll(id) > 0)
+    {
+        jobs[id].status = F3Status::Stopped;
+        emit f3_job_status_changed(id, F3Status::Stopped);
+        dispatch();
+    }
+    else if (launchers.contains(id))
+        launchers[id]->stopCheck();
+}
+
+f3_job f3_scheduler::getJob(int id)
+{
+    f3_job job = jobs.value(id);
+    if (launchers.contains(id))
+    {
+        job.stage = launchers[id]->getStage();
+        job.progress10K = launchers[id]->progress10K;
+    }
+    return job;
+}
+
+QList<int> f3_scheduler::getJobs()
+{
+    return jobs.keys();
+}
+
+int f3_scheduler::getRunningCount()
+{
+    return launchers.size();
+}
+
+int f3_scheduler::getPendingCount()
+{
+    return pending.size();
+}
+
+bool f3_scheduler::isIdle()
+{
+    return launchers.isEmpty() && pending.isEmpty();
+}
+
+bool f3_scheduler::hasRoom(int bus)
+{
+    return bus == 0 || buses.value(bus).running < getBusLimit(bus);
+}
+
+// Jobs waiting for room on their bus let the ones behind them go first
+void f3_scheduler::dispatch()
+{
+    for (int i = 0; started && launchers.size() < concurrency && i < pending.size(); )
+    {
+        const int id = pending.at(i);
+        if (!hasRoom(jobs[id].usbBus))
+        {
+            i++;
+            continue;
+        }
+        pending.removeAt(i);
+        launch(id);
+    }
+
+    if (started && isIdle())
+    {
+        started = false;
+        emit f3_scheduler_finished();
+    }
+}
+
+void f3_scheduler::launch(int id)
+{
+    f3_job& job = jobs[id];
+    f3_launcher *launcher = new f3_launcher(this);
+    for (auto i = job.options.constBegin(); i != job.options.constEnd(); ++i)
+        launcher->setOption(i.key(), i.value());
+    launchers[id] = launcher;
+    if (job.usbBus > 0)
+        buses[job.usbBus].running++;
+
+    connect(launcher, &f3_launcher::f3_launcher_status_changed, this, [this, id](f3_launcher_status status) {
+        on_launcher_status_changed(id, status);
+    });
+    connect(launcher, &f3_launcher::f3_launcher_error, this, [this, id](f3_launcher_error_code errCode) {
+        on_launcher_error(id, errCode);
+    });
+    connect(launcher, &f3_launcher::f3_launcher_file_recorded, this, [this, id](const f3_file_record& record) {
+        on_launcher_file_recorded(id, record);
+    });
+    launcher->startCheck(job.devPath);
+}
+
+void f3_scheduler::on_launcher_status_changed(int id, f3_launcher_status status)
+{
+    f3_launcher *launcher = launchers.value(id);
+    if (!launcher)
+        return;
+
+    f3_job& job = jobs[id];
+    job.status = status;
+    const int stage = launcher->getStage();
+    // A speed from the pass before is not comparable any more
+    if (stage != job.stage && job.usbBus > 0)
+        buses[job.usbBus].speeds.remove(id);
+    job.stage = stage;
+    job.progress10K = launcher->progress10K;
+    if (status == F3Status::Finished)
+    {
+        job.report = launcher->getReport();
+        job.regionFile = launcher->getRegionFile();
+    }
+    emit f3_job_status_changed(id, status);
+
+    if (status == F3Status::Finished || status == F3Status::Stopped)
+    {
+        launchers.remove(id);
+        launcher->deleteLater();
+        if (job.usbBus > 0)
+        {
+            f3_scheduler_bus& bus = buses[job.usbBus];
+            bus.running--;
+            bus.speeds.remove(id);
+        }
+        dispatch();
+    }
+}
+
+void f3_scheduler::on_launcher_error(int id, f3_launcher_error_code errCode)
+{
+    f3_job& job = jobs[id];
+    job.errCode = errCode;
+    job.errors.append(errCode);
+    emit f3_job_error(id, errCode);
+}
+
+// Each file a job writes tells how fast its device is going, reads are left
+// out so that totals only ever add up writes. Once every device on a full
+// bus has told, the total decides whether one more may join: it stays if
+// it raised the total, otherwise the bus goes back to the limit before it
+// and keeps that.
+void f3_scheduler::on_launcher_file_recorded(int id, const f3_file_record& record)
+{
+    const int busNumber = jobs.value(id).usbBus;
+    if (busNumber == 0 || busConcurrency != F3_SCHEDULER_BUS_AUTO)
+        return;
+    f3_scheduler_bus& bus = buses[busNumber];
+    const qint64 speed = record.writeSpeed();
+    if (bus.settled || record.verifiedAt >= 0 || speed <= 0)
+        return;
+    bus.speeds[id] = speed;
+    if (bus.running < bus.limit || bus.speeds.size() < bus.running)
+        return;
+
+    qint64 total = 0;
+    for (qint64 jobSpeed : bus.speeds)
+        total += jobSpeed;
+    if (bus.throughput > 0 && total * 100 < bus.throughput * F3_SCHEDULER_BUS_GAIN)
+    {
+        // The last one only took its share from the others
+        bus.limit = qMax(1, bus.limit - 1);
+        bus.settled = true;
+        return;
+    }
+    bus.throughput = total;
+    if (bus.linkSpeed > 0 &&
+        total * 8 * 100 >= qint64(bus.linkSpeed) * 1000000 * F3_SCHEDULER_BUS_SATURATION)
+    {
+        bus.settled = true;
+        return;
+    }
+    // Everyone measures again with the new device on the bus
+    bus.limit++;
+    bus.speeds.clear();
+    dispatch();
+}
@@ -0,0 +1,91 @@
+#ifndef F3_SCHEDULER_H
+#define F3_SCHEDULER_H
+#include <QObject>
+#include <QMap>
+#include <QQueue>
+#include <QList>
+#include "f3_launcher.h"
+
+#define F3_SCHEDULER_BUS_AUTO 0
+#define F3_SCHEDULER_BUS_UNLIMITED -1
+
+struct f3_job
+{
+    int id = 0;
+    QString devPath;
+    QMap<QString,QString> options;
+    F3Status status = F3Status::Ready;
+    F3Error errCode = F3Error::Ok;
+    QList<F3Error> errors;
+    int stage = 0;
+    int progress10K = 0;
+    f3_launcher_report report = f3_launcher_report();
+    QString regionFile;     // saved bad-region map of a finished job
+    int usbBus = 0;         // root hub the device is on, 0 when not on USB
+    QString usbPort;
+};
+
+// Devices on one USB root hub share its bandwidth, more of them at once
+// only pays while their total keeps rising
+struct f3_scheduler_bus
+{
+    int limit = 1;
+    int running = 0;
+    int linkSpeed = 0;          // Mbit/s
+    qint64 throughput = 0;      // bytes/s measured at the current limit
+    bool settled = false;
+    QMap<int, qint64> speeds;   // last write speed of each job writing on it
+};
+
+// Runs one f3_launcher per device, at most "concurrency" of them at a time.
+// Devices on the same USB root hub start one at a time: another one joins
+// only when the last measured total of the bus rose, so a shared bus
+// finishes its devices one after another instead of all of them late.
+class f3_scheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit f3_scheduler(QObject *parent = nullptr);
+    ~f3_scheduler();
+    int addJob(const QString& devPath, const QMap<QString,QString>& options);
+    void setConcurrency(int limit);
+    int getConcurrency();
+    void setBusConcurrency(int limit);
+    int getBusConcurrency();
+    int getBusLimit(int bus);
+    void setSysRoot(const QString& path);
+    void start();
+    void stop();
+    void cancelJob(int id);
+    f3_job getJob(int id);
+    QList<int> getJobs();
+    int getRunningCount();
+    int getPendingCount();
+    bool isIdle();
+
+signals:
+    void f3_job_status_changed(int id, f3_launcher_status status);
+    void f3_job_error(int id, f3_launcher_error_code errCode);
+    void f3_scheduler_finished();
+
+private:
+    QMap<int, f3_job> jobs;
+    QMap<int, f3_launcher*> launchers;
+    QQueue<int> pending;
+    QMap<int, f3_scheduler_bus> buses;
+    QString sysRoot;
+    int concurrency;
+    int busConcurrency;
+    int nextId;
+    bool started;
+
+    void dispatch();
+    void launch(int id);
+    bool hasRoom(int bus);
+    void on_launcher_file_recorded(int id, const f3_file_record& record);
+    void on_launcher_status_changed(int id, f3_launcher_status status);
+    void on_launcher_error(int id, f3_launcher_error_code errCode);
+};
+
+#endif // F3_SCHEDULER_H
@@ -0,0 +1,397 @@
+#include "f3_workers.h"
+#include "f3_pattern.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <unistd.h>
+
+#define F3_WORKERS_MAX 8
+#define F3_WORKERS_PROBE_FILE "f3_qt_workers"
+// Long enough to get past the SLC cache of most drives
+#define F3_WORKERS_PROBE_MS 10000
+#define F3_WORKERS_PROBE_SIZE (Q_INT64_C(1) << 30)
+#define F3_WORKERS_PROBE_BLOCK (Q_INT64_C(1) << 20)
+#define F3_WORKERS_PROBE_GAIN 1.2
+#define F3_WORKERS_ALIGNMENT 4096
+
+
+// Writes a probe file of its own, bypassing the page cache where possible,
+// until the time is up or it holds limit bytes
+static bool f3_workers_write(const QString& fileName, const QElapsedTimer& timer, qint64 limit,
+                             std::atomic<qint64>& written, const std::atomic<bool> *cancel)
+{
+    QByteArray name = QFile::encodeName(fileName);
+    int fd = -1;
+#ifdef O_DIRECT
+    fd = ::open(name.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+    if (fd < 0)
+        fd = ::open(name.constData(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    void *buffer = nullptr;
+    bool ok = posix_memalign(&buffer, F3_WORKERS_ALIGNMENT, size_t(F3_WORKERS_PROBE_BLOCK)) == 0;
+    for (qint64 offset = 0; ok && offset < limit && !timer.hasExpired(F3_WORKERS_PROBE_MS) &&
+         !(cancel && cancel->load()); offset += F3_WORKERS_PROBE_BLOCK)
+    {
+        f3_pattern_fill(buffer, F3_WORKERS_PROBE_BLOCK, quint64(offset));
+        ok = pwrite(fd, buffer, size_t(F3_WORKERS_PROBE_BLOCK), offset) == F3_WORKERS_PROBE_BLOCK;
+        if (ok)
+            written += F3_WORKERS_PROBE_BLOCK;
+    }
+    ok = ok && fdatasync(fd) == 0;
+    free(buffer);
+    ::close(fd);
+    ::unlink(name.constData());
+    return ok;
+}
+
+// Bytes per second that count writers reach together over the same time,
+// never taking more than half of the free space
+static double f3_workers_throughput(const QString& devPath, int count, const std::atomic<bool> *cancel)
+{
+    QDir dir(devPath);
+    QStorageInfo storage(devPath);
+    qint64 limit = qMin(F3_WORKERS_PROBE_SIZE, storage.bytesAvailable() / 2) / count;
+    limit -= limit % F3_WORKERS_PROBE_BLOCK;
+    if (limit <= 0)
+        return 0;
+
+    std::atomic<bool> ok(true);
+    std::atomic<qint64> written(0);
+    QVector<QThread*> threads;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < count; i++)
+    {
+        QString fileName = dir.filePath(QString(F3_WORKERS_PROBE_FILE "%1").arg(i));
+        threads.append(QThread::create([fileName, &timer, limit, &ok, &written, cancel]() {
+            if (!f3_workers_write(fileName, timer, limit, written, cancel))
+                ok = false;
+        }));
+        threads.last()->start();
+    }
+    for (QThread *thread : threads)
+    {
+        thread->wait();
+        delete thread;
+    }
+    qint64 elapsed = qMax<qint64>(timer.elapsed(), 1);
+    if (!ok || (cancel && cancel->load()))
+        return 0;
+    return double(written.load()) * 1000 / elapsed;
+}
+
+f3_workers::f3_workers(QObject *parent) :
+    QObject(parent),
+    lossFound(nullptr),
+    freeSpace(0),
+    run(0),
+    stage(0),
+    progress10K(0),
+    running(0),
+    stopping(false),
+    stopped(false)
+{
+}
+
+f3_workers::~f3_workers()
+{
+    blockSignals(true);
+    stop();
+}
+
+// Doubles the writers as long as that still pays off
+int f3_workers::suggest(const QString& devPath, const std::atomic<bool> *cancel)
+{
+    int best = 1;
+    double throughput = f3_workers_throughput(devPath, 1, cancel);
+    for (int count = 2; throughput > 0 && count <= F3_WORKERS_MAX; count *= 2)
+    {
+        double next = f3_workers_throughput(devPath, count, cancel);
+        if (next < throughput * F3_WORKERS_PROBE_GAIN)
+            break;
+        best = count;
+        throughput = next;
+    }
+    return best;
+}
+
+// With count 0 the number of workers is measured first
+void f3_workers::start(const QString& devPath, const QMap<QString,QString>& options, int count)
+{
+    stop();
+    qDeleteAll(launchers);
+    launchers.clear();
+    weights.clear();
+    this->devPath = devPath;
+    this->options = options;
+    lossFound = nullptr;
+    stage = 0;
+    progress10K = 0;
+    running = 0;
+    stopping = false;
+    stopped = false;
+    int current = ++run;
+
+    if (count > 0)
+    {
+        launch(count);
+        return;
+    }
+
+    // Takes up to a minute, keep it off the event loop
+    auto suggested = std::make_shared<std::atomic<int>>(1);
+    auto cancel = suggestCancel = std::make_shared<std::atomic<bool>>(false);
+    QString path = devPath;
+    suggestThread.reset(QThread::create([path, suggested, cancel]() {
+        suggested->store(suggest(path, cancel.get()));
+    }));
+    connect(suggestThread.data(), &QThread::finished, this, [this, current, suggested]() {
+        if (current == run && !stopping)
+            launch(suggested->load());
+    });
+    suggestThread->start();
+}
+
+void f3_workers::stop()
+{
+    bool measuring = !suggestThread.isNull() && suggestThread->isRunning();
+    if (suggestCancel)
+        suggestCancel->store(true);
+    if (!suggestThread.isNull())
+        suggestThread->wait();
+    if (running > 0)
+        stopped = true;
+    stopLaunchers();
+    // Stopped before any worker was started
+    if (measuring && launchers.isEmpty())
+        emit f3_workers_status_changed(F3Status::Stopped);
+}
+
+void f3_workers::stopLaunchers()
+{
+    stopping = true;
+    // stopCheck() may report back right away, go through a copy
+    const QVector<f3_launcher*> busy = launchers;
+    for (f3_launcher *launcher : busy)
+    {
+        if (launcher->getStage() != 0)
+            launcher->stopCheck();
+    }
+}
+
+void f3_workers::launch(int count)
+{
+    // f3write fills the free space, a cached run is verified as it was left.
+    // Each worker only replaces the files of its own range, so the ones an
+    // earlier run left count as free space like a single f3write sees them.
+    qint64 files = 0;
+    freeSpace = 0;
+    const QFileInfoList fileList = QDir(devPath).entryInfoList(QStringList("*.h2w"), QDir::Files);
+    for (const QFileInfo& file : fileList)
+    {
+        files = qMax(files, file.completeBaseName().toLongLong());
+        freeSpace += file.size();
+    }
+    if (options.value("cache") != "write")
+    {
+        QStorageInfo storage(devPath);
+        storage.refresh();
+        freeSpace += storage.bytesAvailable();
+        files = (freeSpace + F3_FILE_SIZE - 1) / F3_FILE_SIZE;
+        // Numbered past every range, no worker would get to them
+        for (const QFileInfo& file : fileList)
+        {
+            if (file.completeBaseName().toLongLong() > files)
+                QFile::remove(file.filePath());
+        }
+    }
+    count = int(qBound<qint64>(1, count, qMax<qint64>(files, 1)));
+
+    for (int i = 0; i < count; i++)
+    {
+        qint64 first = files * i / count + 1;
+        qint64 last = files * (i + 1) / count;
+        f3_launcher *launcher = new f3_launcher(this);
+        for (auto option = options.constBegin(); option != options.constEnd(); ++option)
+            launcher->setOption(option.key(), option.value());
+        launcher->setOption("workers", "1");
+        launcher->setOption("record", "");
+        launcher->setOption("resume", "no");
+        launcher->setOption("regions", "no");
+        // Each one keeps to its own range, or the last would eat into the
+        // free space the others still count on
+        launcher->setOption("startat", QString::number(first));
+        launcher->setOption("endat", QString::number(last));
+        launchers.append(launcher);
+        weights.append(qMax<qint64>(last - first + 1, 1));
+
+        connect(launcher, &f3_launcher::f3_launcher_status_changed, this, [this, launcher](f3_launcher_status status) {
+            on_launcher_status_changed(launcher, status);
+        });
+        connect(launcher, &f3_launcher::f3_launcher_error, this, &f3_workers::f3_workers_error);
+        connect(launcher, &f3_launcher::f3_launcher_file_recorded, this, &f3_workers::f3_workers_file_recorded);
+    }
+
+    running = count;
+    stage = 0;
+    for (f3_launcher *launcher : launchers)
+        launcher->startCheck(devPath);
+}
+
+// The stage the slowest worker is in
+int f3_workers::getStage()
+{
+    int current = 0;
+    for (f3_launcher *launcher : launchers)
+    {
+        int workerStage = launcher->getStage();
+        if (workerStage != 0 && (current == 0 || workerStage < current))
+            current = workerStage;
+    }
+    return current != 0 ? current : stage;
+}
+
+int f3_workers::getProgress10K()
+{
+    qint64 done = 0;
+    qint64 total = 0;
+    for (int i = 0; i < launchers.size(); i++)
+    {
+        int workerStage = launchers.at(i)->getStage();
+        bool ahead = workerStage == 0 || workerStage > stage;
+        done += weights.at(i) * (ahead ? 10000 : launchers.at(i)->progress10K);
+        total += weights.at(i);
+    }
+    return total > 0 ? int(done / total) : 0;
+}
+
+f3_launcher_report f3_workers::getReport()
+{
+    if (lossFound)
+        return lossFound->getReport();
+
+    f3_launcher_report report;
+    report.success = !launchers.isEmpty();
+    report.availability = -1;
+    qint64 okBytes = 0;
+    qint64 lostBytes = 0;
+    qint64 readSpeed = 0;
+    qint64 writeSpeed = 0;
+    for (f3_launcher *launcher : launchers)
+    {
+        f3_launcher_report part = launcher->getReport();
+        report.success = report.success && part.success;
+        okBytes += f3_capacity_bytes(part.ActualFree);
+        lostBytes += f3_capacity_bytes(part.LostSpace);
+        // The workers ran side by side, their speeds add up
+        readSpeed += f3_capacity_bytes(part.ReadingSpeed.remove("/s"));
+        writeSpeed += f3_capacity_bytes(part.WritingSpeed.remove("/s"));
+    }
+    if (!report.success)
+        return report;
+
+    report.ReportedFree = f3_capacity_string(freeSpace);
+    report.ActualFree = f3_capacity_string(okBytes);
+    report.LostSpace = f3_capacity_string(lostBytes);
+    if (freeSpace > 0)
+        report.availability = float(double(okBytes) / freeSpace);
+    if (readSpeed > 0)
+        report.ReadingSpeed = f3_capacity_string(readSpeed).append("/s");
+    if (writeSpeed > 0)
+        report.WritingSpeed = f3_capacity_string(writeSpeed).append("/s");
+    return report;
+}
+
+QString f3_workers::getOutput()
+{
+    QStringList output;
+    for (int i = 0; i < launchers.size(); i++)
+    {
+        QString range = launchers.at(i)->getOption("startat");
+        range.append('-').append(launchers.at(i)->getOption("endat"));
+        output.append(QString("[Worker %1, files %2]").arg(i + 1).arg(range));
+        output.append(launchers.at(i)->getOutput());
+    }
+    return output.join('\n');
+}
+
+// The workers started together, their clocks line up closely enough
+QVector<f3_file_record> f3_workers::getFileSeries()
+{
+    QVector<f3_file_record> series;
+    for (f3_launcher *launcher : launchers)
+        series += launcher->getFileSeries();
+    std::sort(series.begin(), series.end(), [](const f3_file_record& a, const f3_file_record& b) {
+        return a.number < b.number;
+    });
+    return series;
+}
+
+// Each worker mapped its own files, at their offsets in the whole range
+f3_region_map f3_workers::getRegionMap()
+{
+    f3_region_map regions;
+    for (f3_launcher *launcher : launchers)
+        regions.merge(launcher->getRegionMap());
+    return regions;
+}
+
+void f3_workers::on_launcher_status_changed(f3_launcher *launcher, f3_launcher_status status)
+{
+    switch(status)
+    {
+        case F3Status::Staged:
+        case F3Status::Progressed:
+        {
+            int current = getStage();
+            int progress = getProgress10K();
+            if (current != stage)
+            {
+                stage = current;
+                progress10K = progress;
+                emit f3_workers_status_changed(F3Status::Staged);
+            }
+            else if (progress != progress10K)
+            {
+                progress10K = progress;
+                emit f3_workers_status_changed(F3Status::Progressed);
+            }
+            break;
+        }
+        case F3Status::Finished:
+        case F3Status::Stopped:
+            running--;
+            // One worker failing or losing data decides for all of them
+            if (status == F3Status::Stopped && !stopping)
+            {
+                stopped = true;
+                stopLaunchers();
+            }
+            else if (status == F3Status::Finished && !lossFound &&
+                     !launcher->getReport().FailReason.isEmpty())
+            {
+                lossFound = launcher;
+                stopLaunchers();
+            }
+            if (running == 0)
+            {
+                stage = 0;
+                emit f3_workers_status_changed(stopped ? F3Status::Stopped : F3Status::Finished);
+            }
+            break;
+        default:
+            break;
+    }
+}
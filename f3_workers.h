@@ -0,0 +1,60 @@
+#ifndef F3_WORKERS_H
+#define F3_WORKERS_H
+#include <QObject>
+#include <QMap>
+#include <QScopedPointer>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include "f3_launcher.h"
+
+class QThread;
+
+// Runs a legacy check as several f3write/f3read processes at once, each on
+// its own range of *.h2w files through --start-at/--end-at, for drives that
+// serve requests in parallel. Progress and reports of the workers are
+// merged as if a single process had checked the whole range.
+class f3_workers : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit f3_workers(QObject *parent = nullptr);
+    ~f3_workers();
+    void start(const QString& devPath, const QMap<QString,QString>& options, int count);
+    void stop();
+    int getStage();
+    int getProgress10K();
+    f3_launcher_report getReport();
+    QString getOutput();
+    QVector<f3_file_record> getFileSeries();
+    f3_region_map getRegionMap();
+    static int suggest(const QString& devPath, const std::atomic<bool> *cancel = nullptr);
+
+signals:
+    void f3_workers_status_changed(f3_launcher_status status);
+    void f3_workers_error(f3_launcher_error_code errCode);
+    void f3_workers_file_recorded(const f3_file_record& record);
+
+private:
+    QVector<f3_launcher*> launchers;
+    QVector<qint64> weights;
+    QScopedPointer<QThread> suggestThread;
+    std::shared_ptr<std::atomic<bool>> suggestCancel;
+    QString devPath;
+    QMap<QString,QString> options;
+    f3_launcher *lossFound;
+    qint64 freeSpace;
+    int run;
+    int stage;
+    int progress10K;
+    int running;
+    bool stopping;
+    bool stopped;
+
+    void launch(int count);
+    void stopLaunchers();
+    void on_launcher_status_changed(f3_launcher *launcher, f3_launcher_status status);
+};
+
+#endif // F3_WORKERS_H
@@ -0,0 +1,406 @@
+#include "f3_broadcast.h"
+#include "f3_replay.h"
+#include "f3_scheduler.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <cstring>
+
+QString f3_cli_status_name(F3Status status)
+{
+    switch(status)
+    {
+        case F3Status::Ready:
+            return "ready";
+        case F3Status::Running:
+            return "running";
+        case F3Status::Finished:
+            return "finished";
+        case F3Status::Stopped:
+            return "stopped";
+        case F3Status::Staged:
+            return "staged";
+        case F3Status::Progressed:
+            return "progressed";
+    }
+    return "unknown";
+}
+
+QString f3_cli_error_name(F3Error errCode)
+{
+    switch(errCode)
+    {
+        case F3Error::Ok:
+            return "ok";
+        case F3Error::PathIncorrect:
+            return "path-incorrect";
+        case F3Error::NoCui:
+            return "no-cui";
+        case F3Error::NoPermission:
+            return "no-permission";
+        case F3Error::NoSpace:
+            return "no-space";
+        case F3Error::NoProgress:
+            return "no-progress";
+        case F3Error::NoQuick:
+            return "no-quick";
+        case F3Error::CacheNotFound:
+            return "cache-not-found";
+        case F3Error::NoMemory:
+            return "no-memory";
+        case F3Error::NotDirectory:
+            return "not-directory";
+        case F3Error::NotDisk:
+            return "not-disk";
+        case F3Error::NotUSB:
+            return "not-usb";
+        case F3Error::NoFix:
+            return "no-fix";
+        case F3Error::NoReport:
+            return "no-report";
+        case F3Error::Oversize:
+            return "oversize";
+        case F3Error::Damaged:
+            return "damaged";
+        case F3Error::NotDevice:
+            return "not-device";
+        case F3Error::Busy:
+            return "busy";
+        case F3Error::NoNative:
+            return "no-native";
+        default:
+            return "unknown";
+    }
+}
+
+QJsonObject f3_cli_job_result(const f3_job& job)
+{
+    QJsonArray errors;
+    for (F3Error errCode : job.errors)
+        errors.append(f3_cli_error_name(errCode));
+
+    QJsonObject result;
+    result["device"] = job.devPath;
+    result["mode"] = job.options.value("mode");
+    result["status"] = f3_cli_status_name(job.status);
+    result["errors"] = errors;
+    result["success"] = job.status == F3Status::Finished && job.report.success;
+    if (job.usbBus > 0)
+        result["usbPort"] = job.usbPort;
+    if (job.status == F3Status::Finished)
+    {
+        QJsonObject report;
+        report["reportedFree"] = job.report.ReportedFree;
+        report["actualFree"] = job.report.ActualFree;
+        report["lostSpace"] = job.report.LostSpace;
+        report["availability"] = job.report.availability;
+        report["readingSpeed"] = job.report.ReadingSpeed;
+        report["writingSpeed"] = job.report.WritingSpeed;
+        report["moduleSize"] = job.report.ModuleSize;
+        report["blockSize"] = job.report.BlockSize;
+        if (!job.report.FailReason.isEmpty())
+            report["failReason"] = job.report.FailReason;
+        if (!job.report.Confidence.isEmpty())
+            report["confidence"] = job.report.Confidence;
+        if (!job.regionFile.isEmpty())
+            report["regionMap"] = job.regionFile;
+        result["report"] = report;
+    }
+    return result;
+}
+
+bool f3_cli_write_results(const QString& key, const QJsonArray& results, const QString& fileName)
+{
+    QJsonObject document;
+    document["version"] = QString(APP_VERSION);
+    document[key] = results;
+    QByteArray json = QJsonDocument(document).toJson();
+
+    if (!fileName.isEmpty())
+    {
+        QFile file(fileName);
+        if (!file.open(QFile::WriteOnly | QFile::Truncate) || file.write(json) != json.size())
+        {
+            QTextStream(stderr) << "Cannot write " << file.fileName() << ": " << file.errorString() << "\n";
+            return false;
+        }
+    }
+    else
+    {
+        QFile out;
+        out.open(stdout, QFile::WriteOnly);
+        out.write(json);
+    }
+    return true;
+}
+
+// Plays the recordings back all at once and checks each against what was
+// recorded
+int f3_cli_replay(QCoreApplication& a, const QStringList& files, double speed, const QString& output)
+{
+    QTextStream err(stderr);
+    QJsonArray results;
+    int pending = 0;
+    int exitCode = 0;
+    for (const QString& fileName : files)
+    {
+        f3_replay *replay = new f3_replay(&a);
+        if (!replay->load(fileName))
+        {
+            err << fileName << ": " << replay->getError() << "\n";
+            delete replay;
+            exitCode = 2;
+            continue;
+        }
+        replay->setSpeed(speed);
+        f3_launcher *launcher = new f3_launcher(replay);
+        pending++;
+        QObject::connect(replay, &f3_replay::f3_replay_finished, &a, [&, fileName, replay](bool matched) {
+            QJsonObject result;
+            result["file"] = fileName;
+            result["matched"] = matched;
+            if (!matched)
+            {
+                result["mismatch"] = replay->getMismatch();
+                exitCode = qMax(exitCode, 1);
+            }
+            results.append(result);
+            replay->deleteLater();
+            if (--pending == 0)
+                a.exit(exitCode);
+        }, Qt::QueuedConnection);
+        replay->start(launcher);
+    }
+
+    if (pending > 0)
+        a.exec();
+    if (!f3_cli_write_results("replays", results, output))
+        exitCode = 2;
+    return exitCode;
+}
+
+// Writes all the directories in one pass, each block filled once for all of
+// them. The jobs then resume from the checkpoints it leaves and only
+// verify; a directory it had to drop is finished by its own job.
+QVector<f3_broadcast_target> f3_cli_broadcast(const QStringList& paths,
+                                              const QMap<QString,QString>& options, bool quiet)
+{
+    QTextStream err(stderr);
+    f3_broadcast broadcast;
+    broadcast.setTargets(paths);
+    bool ok;
+    qint64 blockSize = options.value("blocksize").toLongLong(&ok);
+    if (ok && blockSize > 0)
+        broadcast.setBlockSize(blockSize);
+    int queueDepth = options.value("queuedepth").toInt(&ok);
+    if (ok && queueDepth > 0)
+        broadcast.setQueueDepth(queueDepth);
+    broadcast.setBackend(options.value("io", "auto"));
+
+    int lastPercent = -1;
+    f3_broadcast_callbacks callbacks;
+    callbacks.progress = [&](qint64 done, qint64 total) {
+        int percent = total > 0 ? int(done * 100 / total) : 0;
+        if (quiet || percent == lastPercent)
+            return;
+        lastPercent = percent;
+        err << "broadcast: " << percent << "%\n";
+        err.flush();
+    };
+    broadcast.setCallbacks(callbacks);
+    broadcast.write();
+
+    const QVector<f3_broadcast_target>& targets = broadcast.getTargets();
+    if (!quiet)
+    {
+        for (const f3_broadcast_target& target : targets)
+        {
+            if (target.error != 0)
+                err << target.path << ": broadcast dropped, " << strerror(target.error) << "\n";
+        }
+    }
+    return targets;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("f3-qt-cli");
+    QCoreApplication::setApplicationVersion(APP_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Batch runner for F3 - Fight Flash Fraud.\n"
+                                     "Takes mounted directories (native, legacy) "
+                                     "or disk devices (quick, sample, raw).");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption modeOption(QStringList() << "m" << "mode",
+                                  "Test mode: native, legacy, quick, sample or raw.", "mode", "native");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+                                  "Number of devices checked at the same time.", "count");
+    QCommandLineOption perBusOption("per-bus", "Devices checked at the same time on one USB root "
+                                    "hub: auto to measure, a count, or off.", "count", "auto");
+    QCommandLineOption cacheOption(QStringList() << "c" << "cache",
+                                   "Only verify files left by a previous run.");
+    QCommandLineOption memoryOption("min-memory", "Use less memory (quick mode).");
+    QCommandLineOption destructiveOption("destructive", "Run destructive test (quick mode).");
+    QCommandLineOption autofixOption("autofix", "Fix the capacity after a quick test.");
+    QCommandLineOption failFastOption("fail-fast", "Stop at the first lost data (native, legacy).");
+    QCommandLineOption pipelineOption("pipeline", "Verify each file while the next one is written "
+                                      "(native; legacy with --fail-fast).");
+    QCommandLineOption resumeOption("resume", "Keep a checkpoint on each device and resume an "
+                                    "interrupted check from it (native, legacy).");
+    QCommandLineOption workersOption("workers", "f3 processes per device, each on its own range of "
+                                     "files (legacy), or auto to measure.", "count");
+    QCommandLineOption broadcastOption("broadcast", "Write all the directories in one pass that "
+                                       "makes each pattern block once, then verify each (native).");
+    QCommandLineOption samplesOption("samples", "Blocks checked in sample mode, head and tail "
+                                     "not counted.", "count");
+    QCommandLineOption blockSizeOption("block-size", "I/O block size in bytes (native mode).", "bytes");
+    QCommandLineOption probeOption("probe", "Capacity probe for quick mode: auto, native or external.", "probe");
+    QCommandLineOption ioOption("io", "I/O backend for native mode: auto, uring, threads or sync.", "backend");
+    QCommandLineOption queueDepthOption("queue-depth", "Blocks kept in flight in native mode.", "count");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    "Write JSON results to file instead of stdout.", "file");
+    QCommandLineOption quietOption(QStringList() << "q" << "quiet",
+                                   "Do not print progress to stderr.");
+    QCommandLineOption recordOption("record", "Record the f3 output of each device into <dir>.", "dir");
+    QCommandLineOption replayOption("replay", "Play a recording back instead of running f3 "
+                                    "and check the outcome; may be given more than once.", "file");
+    QCommandLineOption speedOption("speed", "Replay speed factor, 0 for as fast as possible.",
+                                   "factor", "1");
+    parser.addOptions({modeOption, jobsOption, perBusOption, cacheOption, memoryOption, destructiveOption,
+                       autofixOption, failFastOption, pipelineOption,
+                       resumeOption, workersOption, broadcastOption, samplesOption, blockSizeOption, probeOption, ioOption, queueDepthOption,
+                       outputOption, quietOption, recordOption, replayOption, speedOption});
+    parser.addPositionalArgument("paths", "Directories or devices to check.", "<path>...");
+    parser.process(a);
+
+    if (parser.isSet(replayOption))
+        return f3_cli_replay(a, parser.values(replayOption), parser.value(speedOption).toDouble(),
+                             parser.value(outputOption));
+
+    const QStringList paths = parser.positionalArguments();
+    if (paths.isEmpty())
+        parser.showHelp(2);
+
+    QMap<QString,QString> options;
+    options["mode"] = parser.value(modeOption);
+    options["cache"] = parser.isSet(cacheOption) ? "write" : "none";
+    options["memory"] = parser.isSet(memoryOption) ? "minimum" : "full";
+    options["destructive"] = parser.isSet(destructiveOption) ? "true" : "no";
+    options["autofix"] = parser.isSet(autofixOption) ? "true" : "no";
+    options["failfast"] = parser.isSet(failFastOption) ? "true" : "no";
+    options["pipeline"] = parser.isSet(pipelineOption) ? "true" : "no";
+    options["resume"] = parser.isSet(resumeOption) ? "true" : "no";
+    if (parser.isSet(workersOption))
+        options["workers"] = parser.value(workersOption);
+    if (parser.isSet(samplesOption))
+        options["samples"] = parser.value(samplesOption);
+    if (parser.isSet(blockSizeOption))
+        options["blocksize"] = parser.value(blockSizeOption);
+    if (parser.isSet(probeOption))
+        options["probe"] = parser.value(probeOption);
+    if (parser.isSet(ioOption))
+        options["io"] = parser.value(ioOption);
+    if (parser.isSet(queueDepthOption))
+        options["queuedepth"] = parser.value(queueDepthOption);
+
+    bool quiet = parser.isSet(quietOption);
+    QVector<f3_broadcast_target> broadcast;
+    if (parser.isSet(broadcastOption))
+    {
+        if (options["mode"] != "native" || parser.isSet(cacheOption))
+        {
+            QTextStream(stderr) << "--broadcast needs native mode and cannot be used with --cache.\n";
+            return 2;
+        }
+        broadcast = f3_cli_broadcast(paths, options, quiet);
+        options["resume"] = "true";
+    }
+
+    f3_scheduler scheduler;
+    if (parser.isSet(jobsOption))
+        scheduler.setConcurrency(parser.value(jobsOption).toInt());
+    const QString perBus = parser.value(perBusOption);
+    if (perBus == "off")
+        scheduler.setBusConcurrency(F3_SCHEDULER_BUS_UNLIMITED);
+    else if (perBus != "auto")
+        scheduler.setBusConcurrency(qMax(1, perBus.toInt()));
+    QDir recordDir(parser.value(recordOption));
+    if (parser.isSet(recordOption))
+        recordDir.mkpath(".");
+    QMap<int, f3_broadcast_target> broadcastJobs;
+    for (int i = 0; i < paths.size(); i++)
+    {
+        const QString& path = paths.at(i);
+        if (parser.isSet(recordOption))
+            options["record"] = recordDir.filePath(QFileInfo(path).fileName() + ".jsonl");
+        int id = scheduler.addJob(path, options);
+        if (i < broadcast.size() && broadcast.at(i).error == 0)
+            broadcastJobs[id] = broadcast.at(i);
+    }
+
+    QTextStream err(stderr);
+    QMap<int,int> lastPercent;
+    QObject::connect(&scheduler, &f3_scheduler::f3_job_status_changed, &a,
+                     [&](int id, f3_launcher_status status) {
+        if (quiet)
+            return;
+        f3_job job = scheduler.getJob(id);
+        if (status == F3Status::Progressed)
+        {
+            int percent = job.progress10K / 100;
+            if (lastPercent.value(id, -1) == percent)
+                return;
+            lastPercent[id] = percent;
+            err << job.devPath << ": stage " << job.stage << ", " << percent << "%\n";
+        }
+        else if (status == F3Status::Staged)
+            err << job.devPath << ": stage " << job.stage << "\n";
+        else
+            err << job.devPath << ": " << f3_cli_status_name(status) << "\n";
+        err.flush();
+    });
+    QObject::connect(&scheduler, &f3_scheduler::f3_job_error, &a,
+                     [&](int id, f3_launcher_error_code errCode) {
+        if (quiet)
+            return;
+        err << scheduler.getJob(id).devPath << ": error " << f3_cli_error_name(errCode) << "\n";
+        err.flush();
+    });
+
+    int exitCode = 0;
+    QObject::connect(&scheduler, &f3_scheduler::f3_scheduler_finished, &a, [&]() {
+        QJsonArray results;
+        for (int id : scheduler.getJobs())
+        {
+            QJsonObject result = f3_cli_job_result(scheduler.getJob(id));
+            // The jobs only timed their verify, the write was the broadcast
+            if (broadcastJobs.contains(id) && result.contains("report"))
+            {
+                const f3_broadcast_target& target = broadcastJobs[id];
+                QJsonObject report = result["report"].toObject();
+                report["writingSpeed"] = f3_transfer_speed(target.bytesWritten, target.writeMs);
+                result["report"] = report;
+            }
+            if (!result["success"].toBool())
+                exitCode = 1;
+            results.append(result);
+        }
+        if (!f3_cli_write_results("results", results, parser.value(outputOption)))
+            exitCode = 2;
+        a.exit(exitCode);
+    });
+
+    scheduler.start();
+    if (scheduler.isIdle())
+        return exitCode;
+    return a.exec();
+}
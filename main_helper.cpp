@@ -0,0 +1,273 @@
+#include "f3_helper.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QTextStream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <functional>
+
+// Privileged side of f3_helper. Started as root through sudo, it connects
+// to the socket of the f3-qt that started it and serves its requests until
+// that closes. Mounting and the like run as child processes, replies go
+// out as they finish.
+
+static int helperSocket = -1;
+static uid_t helperUser = 0;
+// What this helper has mounted, the only directories it unmounts or chmods
+static QSet<QString> helperMounts;
+
+static void f3_helper_reply(int id, bool ok, const QString& text, int passFd = -1)
+{
+    QJsonObject reply;
+    reply["id"] = id;
+    reply["ok"] = ok;
+    reply[ok ? "output" : "error"] = text;
+    f3_helper_send(helperSocket, QJsonDocument(reply).toJson(QJsonDocument::Compact), passFd);
+}
+
+static int f3_helper_connect(const QString& path)
+{
+    const QByteArray name = QFile::encodeName(path);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (size_t(name.size()) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(address.sun_path, name.constData(), size_t(name.size()));
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (::connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+// A block device node, not reached through a symbolic link. The lstat()
+// keeps anything else from even being opened, the fstat() makes sure it
+// did not change in between.
+static int f3_helper_open_device(const QByteArray& name, int flags)
+{
+    struct stat info;
+    if (lstat(name.constData(), &info) != 0)
+        return -1;
+    if (!S_ISBLK(info.st_mode))
+    {
+        errno = ENOTBLK;
+        return -1;
+    }
+    int fd = ::open(name.constData(), flags | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &info) != 0 || !S_ISBLK(info.st_mode))
+    {
+        ::close(fd);
+        errno = ENOTBLK;
+        return -1;
+    }
+    return fd;
+}
+
+// An empty directory of the user named like the mount points of f3-qt,
+// with no symbolic link on the way to it
+static bool f3_helper_is_mount_point(const QString& path)
+{
+    struct stat info;
+    const QByteArray name = QFile::encodeName(path);
+    if (!QFileInfo(path).fileName().startsWith(F3_HELPER_MOUNT_PREFIX) ||
+        QFileInfo(path).canonicalFilePath() != QDir::cleanPath(path) ||
+        lstat(name.constData(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != helperUser)
+        return false;
+    return QDir(path).entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot).isEmpty();
+}
+
+static void f3_helper_run(QCoreApplication& a, int id, const QString& program, const QStringList& args,
+                          const std::function<void(bool)>& finished = nullptr)
+{
+    QProcess *process = new QProcess(&a);
+#if (QT_VERSION >= QT_VERSION_CHECK(5,6,0))
+    QObject::connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), &a,
+#else
+    QObject::connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), &a,
+#endif
+                     [process, id, finished](int exitCode, QProcess::ExitStatus status) {
+        bool ok = status == QProcess::NormalExit && exitCode == 0;
+        if (finished)
+            finished(ok);
+        QByteArray output = ok ? process->readAllStandardOutput() : process->readAllStandardError();
+        f3_helper_reply(id, ok, QString::fromUtf8(output).trimmed());
+        process->deleteLater();
+    });
+    QObject::connect(process, &QProcess::errorOccurred, &a, [process, id, program](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart)
+            return;
+        f3_helper_reply(id, false, QString("Cannot run %1.").arg(program));
+        process->deleteLater();
+    });
+    process->start(program, args);
+}
+
+static void f3_helper_handle(QCoreApplication& a, const QJsonObject& request)
+{
+    const int id = request["id"].toInt();
+    const QString op = request["op"].toString();
+    const QString path = request["path"].toString();
+    const QByteArray name = QFile::encodeName(path);
+    // Nothing is taken relative to the working directory of root
+    if (op != "partitions" && !QDir::isAbsolutePath(path))
+    {
+        f3_helper_reply(id, false, "The path has to be absolute.");
+        return;
+    }
+
+    if (op == "mount")
+    {
+        const QString target = QDir::cleanPath(request["target"].toString());
+        struct stat info;
+        if (lstat(name.constData(), &info) != 0 || !S_ISBLK(info.st_mode))
+            f3_helper_reply(id, false, "Only block devices are mounted.");
+        else if (!QDir::isAbsolutePath(target) || !f3_helper_is_mount_point(target))
+            f3_helper_reply(id, false, QString("The mount point has to be an empty directory %1*.")
+                                           .arg(F3_HELPER_MOUNT_PREFIX));
+        else
+            // Nothing on the device gets to act as root
+            f3_helper_run(a, id, "mount", QStringList() << "-o" << "nosuid,nodev" << path << target,
+                          [target](bool ok) {
+                if (ok)
+                    helperMounts.insert(target);
+            });
+    }
+    else if (op == "unmount")
+    {
+        const QString target = QDir::cleanPath(path);
+        if (!helperMounts.contains(target))
+            f3_helper_reply(id, false, "Only what the helper has mounted is unmounted.");
+        else
+            f3_helper_run(a, id, "umount", QStringList() << target, [target](bool ok) {
+                if (ok)
+                    helperMounts.remove(target);
+            });
+    }
+    else if (op == "partitions")
+        f3_helper_run(a, id, "fdisk", QStringList() << "-l");
+    else if (op == "chmod")
+    {
+        // Same as chmod a+rwX, on a device or the top of a mounted device
+        int fd;
+        if (helperMounts.contains(QDir::cleanPath(path)))
+            fd = ::open(name.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        else
+            fd = f3_helper_open_device(name, O_RDONLY | O_NONBLOCK);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 ||
+            fchmod(fd, (info.st_mode & 07777) | (S_ISDIR(info.st_mode) ? 0777 : 0666)) != 0)
+            f3_helper_reply(id, false, QString(strerror(errno)));
+        else
+            f3_helper_reply(id, true, QString());
+        if (fd >= 0)
+            ::close(fd);
+    }
+    else if (op == "open")
+    {
+        int fd = f3_helper_open_device(name, request["write"].toBool() ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            f3_helper_reply(id, false, QString(strerror(errno)));
+        else
+        {
+            f3_helper_reply(id, true, QString(), fd);
+            ::close(fd);
+        }
+    }
+    else
+        f3_helper_reply(id, false, QString("Unknown request %1.").arg(op));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName(F3_HELPER_COMMAND);
+    QTextStream err(stderr);
+
+    const QStringList args = a.arguments();
+    const int at = args.indexOf(F3_HELPER_OPTION_CONNECT);
+    if (at < 0 || at + 1 >= args.size())
+    {
+        err << "Usage: " << F3_HELPER_COMMAND << " " << F3_HELPER_OPTION_CONNECT << " <socket>\n";
+        return 2;
+    }
+    if (geteuid() != 0)
+    {
+        err << F3_HELPER_COMMAND << " has to be run as root, through sudo.\n";
+        return 1;
+    }
+    helperSocket = f3_helper_connect(args.at(at + 1));
+    if (helperSocket < 0)
+    {
+        err << "Cannot connect to " << args.at(at + 1) << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+#ifdef SO_PEERCRED
+    // Only the user sudo was run by gets served
+    bool ok = false;
+    helperUser = qgetenv("SUDO_UID").toUInt(&ok);
+    struct ucred peer;
+    socklen_t length = sizeof(peer);
+    if (!ok || getsockopt(helperSocket, SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0 ||
+        peer.uid != helperUser)
+    {
+        err << "The socket does not belong to the user running sudo.\n";
+        return 1;
+    }
+#endif
+
+    QByteArray incoming;
+    QQueue<int> fds;
+    QSocketNotifier notifier(helperSocket, QSocketNotifier::Read);
+    QObject::connect(&notifier, &QSocketNotifier::activated, &a, [&]() {
+        forever
+        {
+            int got = f3_helper_receive(helperSocket, incoming, fds);
+            if (got > 0)
+                continue;
+            // f3-qt has gone, so has the reason to run
+            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                notifier.setEnabled(false);
+                a.quit();
+            }
+            break;
+        }
+        // Nothing is passed this way
+        while (!fds.isEmpty())
+            ::close(fds.dequeue());
+
+        int end;
+        while ((end = incoming.indexOf('\n')) >= 0)
+        {
+            QJsonObject request = QJsonDocument::fromJson(incoming.left(end)).object();
+            incoming.remove(0, end + 1);
+            f3_helper_handle(a, request);
+        }
+    });
+    return a.exec();
+}
@@ -3,7 +3,9 @@
 #include "helpwindow.h"
 #include "aboutdialog.h"
 #include "passworddialog.h"
+#include "f3_checkpoint.h"
 #include <QDebug>
+#include <QEventLoop>
 #include <QMessageBox>
 #include <QScreen>
 #include <QLabel>
@@ -20,6 +22,8 @@
 #include <QSettings>
 #include <QWindow>
 #include <QTimer>
+#include <QTreeWidgetItem>
+#include <unistd.h>
 
 void f3_qt_fillReport(f3_launcher_report &report)
 {
@@ -82,8 +86,16 @@ MainWindow::MainWindow(QWidget *parent) :
     statusBar->addWidget(statusWidget.release(), 1);  // Transfer ownership to status bar
     connect(&cui, &f3_launcher::f3_launcher_status_changed, this, &MainWindow::on_cuiStatusChanged);
     connect(&cui, &f3_launcher::f3_launcher_error, this, &MainWindow::on_cuiError);
+    connect(&cui, &f3_launcher::f3_launcher_file_recorded, this, &MainWindow::on_cuiFileRecorded);
     connect(&timer, &QTimer::timeout, this, &MainWindow::on_timerTimeout);
+    connect(&devices, &f3_devices::f3_devices_updated, this, &MainWindow::showDevice);
+    connect(&devices, &f3_devices::f3_devices_removed, this, &MainWindow::hideDevice);
+    devices.rescan();
+    devices.startMonitor();
     checking = false;
+    waitingHelper = false;
+    ui->optionLegacy->setChecked(QSettings("ChickenLegsOz", "F3-Qt").value("legacy", false).toBool());
+    checkTab = 0;
     
     // Set minimum size but allow resizing
     setMinimumSize(400, 350);
@@ -286,8 +298,8 @@ QString MainWindow::mountDisk(const QString& device, bool useSudo)
     
     // Create a safe mount directory name
     QDir dir;
-    QString mountDir = QString("%1/f3qt_mount_%2").arg(
-        QDir::tempPath(),
+    QString mountDir = QString("%1/%2%3").arg(
+        QDir::tempPath(), F3_HELPER_MOUNT_PREFIX,
         QString(QCryptographicHash::hash(device.toUtf8(), QCryptographicHash::Sha256).toHex()).left(8)
     );
     
@@ -304,23 +316,22 @@ QString MainWindow::mountDisk(const QString& device, bool useSudo)
         return QString();
     }
     
-    // Setup and execute mount command
-    QProcess proc;
-    QString command;
-    
-    if (useSudo) {
-        PasswordDialog dialog(this);
-        if (dialog.exec() != QDialog::Accepted) {
+    // Once the helper runs, everything privileged goes through it
+    if (useSudo || helper.isStarted()) {
+        QString error;
+        if (!startHelper() || !waitHelper(helper.mount(sanitizedDevice, mountDir), &error)) {
             dir.rmdir(mountDir);
+            if (!error.isEmpty())
+                QMessageBox::critical(this, "Mount Error",
+                    QString("Failed to mount device.\nError: %1").arg(error));
             return QString();
         }
-        QString password = dialog.getPassword();
-        command = QString("echo \"%1\" | sudo -S mount %2 %3")
-                     .arg(password, sanitizedDevice, mountDir);
-        proc.start("bash", QStringList() << "-c" << command);
-    } else {
-        proc.start("mount", QStringList() << sanitizedDevice << mountDir);
+        return mountDir;
     }
+
+    // Setup and execute mount command
+    QProcess proc;
+    proc.start("mount", QStringList() << sanitizedDevice << mountDir);
     
     if (!proc.waitForStarted(5000)) {  // 5 second timeout
         dir.rmdir(mountDir);
@@ -340,7 +351,7 @@ QString MainWindow::mountDisk(const QString& device, bool useSudo)
         QString errorOutput = QString::fromUtf8(proc.readAllStandardError());
         dir.rmdir(mountDir);
         
-        if (!useSudo && errorOutput.contains("Permission denied")) {
+        if (errorOutput.contains("Permission denied")) {
             // Retry with sudo
             return mountDisk(device, true);
         }
@@ -375,46 +386,43 @@ bool MainWindow::unmountDisk(const QString& mountPoint, bool useSudo)
         return false;
     }
     
-    // Setup and execute unmount command
-    QProcess proc;
-    QString command;
-    
-    if (useSudo) {
-        PasswordDialog dialog(this);
-        if (dialog.exec() != QDialog::Accepted) {
+    if (useSudo || helper.isStarted()) {
+        QString error;
+        if (!startHelper() || !waitHelper(helper.unmount(sanitizedMountPoint), &error)) {
+            if (!error.isEmpty())
+                QMessageBox::critical(this, "Unmount Error",
+                    QString("Failed to unmount device.\nError: %1").arg(error));
             return false;
         }
-        QString password = dialog.getPassword();
-        command = QString("echo \"%1\" | sudo -S umount %2")
-                     .arg(password, sanitizedMountPoint);
-        proc.start("bash", QStringList() << "-c" << command);
     } else {
+        // Setup and execute unmount command
+        QProcess proc;
         proc.start("umount", QStringList() << sanitizedMountPoint);
-    }
-    
-    if (!proc.waitForStarted(5000)) {  // 5 second timeout
-        QMessageBox::critical(this, "Unmount Error", "Failed to start unmount command.");
-        return false;
-    }
-    
-    if (!proc.waitForFinished(30000)) {  // 30 second timeout
-        proc.terminate();
-        proc.waitForFinished(5000);
-        QMessageBox::critical(this, "Unmount Error", "Unmount operation timed out.");
-        return false;
-    }
-    
-    if (proc.exitCode() != 0) {
-        QString errorOutput = QString::fromUtf8(proc.readAllStandardError());
-        
-        if (!useSudo && errorOutput.contains("Permission denied")) {
-            // Retry with sudo
-            return unmountDisk(mountPoint, true);
+
+        if (!proc.waitForStarted(5000)) {  // 5 second timeout
+            QMessageBox::critical(this, "Unmount Error", "Failed to start unmount command.");
+            return false;
+        }
+
+        if (!proc.waitForFinished(30000)) {  // 30 second timeout
+            proc.terminate();
+            proc.waitForFinished(5000);
+            QMessageBox::critical(this, "Unmount Error", "Unmount operation timed out.");
+            return false;
+        }
+
+        if (proc.exitCode() != 0) {
+            QString errorOutput = QString::fromUtf8(proc.readAllStandardError());
+
+            if (errorOutput.contains("Permission denied")) {
+                // Retry with sudo
+                return unmountDisk(mountPoint, true);
+            }
+
+            QMessageBox::critical(this, "Unmount Error",
+                QString("Failed to unmount device.\nError: %1").arg(errorOutput.isEmpty() ? "Unknown error" : errorOutput));
+            return false;
         }
-        
-        QMessageBox::critical(this, "Unmount Error", 
-            QString("Failed to unmount device.\nError: %1").arg(errorOutput.isEmpty() ? "Unknown error" : errorOutput));
-        return false;
     }
     
     // Clean up the mount point directory
@@ -435,7 +443,7 @@ bool MainWindow::sureToExit(bool manualClose)
                               QMessageBox::Yes | QMessageBox::No,
                               QMessageBox::No) != QMessageBox::Yes)
             return false;
-    if (ui->tabWidget->currentIndex() == 1 && ui->optionQuickTest->isChecked()
+    if (checkTab == 1 && ui->optionQuickTest->isChecked()
                       && ui->optionDestructive->isChecked() == false)
     {
         if (QMessageBox::warning(this,"Quit F3",
@@ -492,7 +500,14 @@ void MainWindow::on_cuiStatusChanged(F3Status status)
             progressBar->setVisible(false);
             
             // Then set the final status
-            if (report.success)
+            if (!report.FailReason.isEmpty())
+                showStatus(QString("Finished early: %1.").arg(report.FailReason));
+            else if (!report.Confidence.isEmpty() && report.availability >= 1)
+                showStatus(QString("Sample passed, %1 sure the capacity is genuine. "
+                                   "Run a full check to confirm.").arg(report.Confidence));
+            else if (!report.Confidence.isEmpty())
+                showStatus("Sample failed, some blocks lost their data.");
+            else if (report.success)
                 showStatus("Finished (without error).");
             else
                 showStatus("Finished.");
@@ -515,6 +530,7 @@ void MainWindow::on_cuiStatusChanged(F3Status status)
                                     .append("\nWrite speed: ")
                                     .append(report.WritingSpeed)
                                     );
+            ui->speedChart->setRegions(cui.getRegionMap());
             showCapacity(report.availability * 100);
             showResultPage(true);
             break;
@@ -545,9 +561,9 @@ void MainWindow::on_cuiStatusChanged(F3Status status)
     }
     else
     {
-        if (ui->tabWidget->currentIndex() == 1)
+        if (checkTab == 1)
         {
-            if (!ui->optionQuickTest->isChecked())
+            if (!ui->optionQuickTest->isChecked() && !ui->optionRaw->isChecked())
                 unmountDisk(mountPoint);
         }
         checking = false;
@@ -584,28 +600,13 @@ void MainWindow::on_cuiError(F3Error errCode)
                     "Cannot write to device.\nWould you like to retry with elevated privileges?",
                     QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes) 
                 {
-                    PasswordDialog dialog(this);
-                    if (dialog.exec() == QDialog::Accepted) {
-                        QString password = dialog.getPassword();
-                        QString command;
-                        if (ui->tabWidget->currentIndex() == 0) {
-                            // Basic mode
-                            command = QString("echo \"%1\" | sudo -S chmod a+rw %2")
-                                        .arg(password, ui->textDevPath->text());
-                        } else {
-                            // Advanced mode
-                            command = QString("echo \"%1\" | sudo -S chmod a+rw %2")
-                                        .arg(password, ui->textDev->text());
-                        }
-                        QProcess proc;
-                        proc.start("bash", QStringList() << "-c" << command);
-                        proc.waitForFinished();
-                        
-                        if (proc.exitCode() == 0) {
-                            // Retry the operation
-                            on_buttonCheck_clicked();
-                            return;
-                        }
+                    // Basic mode checks a directory, advanced mode a device
+                    QString path = ui->tabWidget->currentIndex() == 0 ? ui->textDevPath->text()
+                                                                     : ui->textDev->text();
+                    if (grantAccess(path.trimmed())) {
+                        // Retry the operation
+                        on_buttonCheck_clicked();
+                        return;
                     }
                 }
                 showStatus("Permission denied. Test cancelled.");
@@ -618,9 +619,9 @@ void MainWindow::on_cuiError(F3Error errCode)
             showStatus("No enough space for test.");
             break;
         case F3Error::NoQuick:
-            QMessageBox::warning(this,"Legacy Mode Only",
-                                 "f3probe was not found.\n"
-                                 "We are not able to test under quick mode.");
+            QMessageBox::information(this,"Built-in Quick Mode",
+                                     "f3probe was not found.\n"
+                                     "Quick mode will use the built-in probe instead.");
             break;
         case F3Error::CacheNotFound:
             showStatus("No cached data found. Test from writing...");
@@ -653,6 +654,25 @@ void MainWindow::on_cuiError(F3Error errCode)
                                   "The device specified is a directory not a valid device.\n"
                                   "Please make sure what you choose is a valid device.");
             break;
+        case F3Error::Busy:
+            QMessageBox::critical(this,"Device busy",
+                                  "The device is in use, it may still be mounted.\n"
+                                  "Please unmount it before a raw device test.");
+            break;
+        case F3Error::NoNative:
+            if (QMessageBox::question(this, "Built-in engine not supported",
+                "The built-in test engine does not work on this device.\n"
+                "Would you like to retry with f3write/f3read?",
+                QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes)
+            {
+                ui->optionLegacy->setChecked(true);
+                on_optionLegacy_clicked();
+                // Once the failed check has stopped
+                QTimer::singleShot(0, this, &MainWindow::on_buttonCheck_clicked);
+                return;
+            }
+            showStatus("The built-in engine is not supported. Test cancelled.");
+            break;
         case F3Error::NoFix:
             QMessageBox::warning(this,"Probing Only",
                              "f3fix was not found.\n"
@@ -718,20 +738,10 @@ bool MainWindow::validatePath(const QString& path, bool isDevice) {
                 "Cannot access the device. Would you like to try with elevated privileges?",
                 QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes) 
             {
-                PasswordDialog dialog(this);
-                if (dialog.exec() == QDialog::Accepted) {
-                    QString password = dialog.getPassword();
-                    QString command = QString("echo \"%1\" | sudo -S chmod a+rw %2")
-                                    .arg(password, path);
-                    QProcess proc;
-                    proc.start("bash", QStringList() << "-c" << command);
-                    proc.waitForFinished();
-                    
-                    // Try opening the device again
-                    if (device.open(QIODevice::ReadOnly)) {
-                        device.close();
-                        return true;
-                    }
+                // Try opening the device again
+                if (grantAccess(path) && device.open(QIODevice::ReadOnly)) {
+                    device.close();
+                    return true;
                 }
             }
             QMessageBox::warning(this, "Validation Error", 
@@ -758,6 +768,8 @@ bool MainWindow::validatePath(const QString& path, bool isDevice) {
 
 void MainWindow::on_buttonCheck_clicked()
 {
+    if (waitingHelper)
+        return;
     if (checking)
     {
         cui.stopCheck();
@@ -778,36 +790,42 @@ void MainWindow::on_buttonCheck_clicked()
 
     if (ui->tabWidget->currentIndex() == 0)
     {
-        cui.setOption("mode", "legacy");
+        cui.setOption("mode", ui->optionLegacy->isChecked() ? "legacy" : "native");
         cui.setOption("cache", "none");
+        cui.setOption("failfast", "no");
     }
     else
     {
-        if (ui->optionQuickTest->isChecked())
+        if (ui->optionQuickTest->isChecked() || ui->optionRaw->isChecked())
         {
-            cui.setOption("mode", "quick");
-            // For quick test mode, ensure we have write access to the device
+            if (ui->optionQuickTest->isChecked())
+                cui.setOption("mode", ui->optionSample->isChecked() ? "sample" : "quick");
+            else
+            {
+                // Cached data only reads back what an earlier raw check wrote
+                if (!ui->optionUseCache->isChecked() &&
+                    QMessageBox::question(this, "Run raw device test",
+                                          "The whole device will be overwritten, "
+                                          "filesystem included.\n"
+                                          "All data on it will be destroyed!\n"
+                                          "Continue?",
+                                          QMessageBox::Yes | QMessageBox::No,
+                                          QMessageBox::No) != QMessageBox::Yes)
+                    return;
+                cui.setOption("mode", "raw");
+            }
+            // The device is used directly, ensure we have write access to it
             QFile device(inputPath);
             if (!device.open(QIODevice::ReadWrite)) {
                 if (QMessageBox::question(this, "Permission denied",
                     "Cannot access the device. Would you like to try with elevated privileges?",
                     QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes) 
                 {
-                    PasswordDialog dialog(this);
-                    if (dialog.exec() == QDialog::Accepted) {
-                        QString password = dialog.getPassword();
-                        QString command = QString("echo \"%1\" | sudo -S chmod a+rw %2")
-                                        .arg(password, inputPath);
-                        QProcess proc;
-                        proc.start("bash", QStringList() << "-c" << command);
-                        proc.waitForFinished();
-                        
-                        if (!device.open(QIODevice::ReadWrite)) {
-                            QMessageBox::critical(this, "Error", 
-                                "Cannot access device even with elevated privileges.");
-                            return;
-                        }
-                    } else {
+                    if (!grantAccess(inputPath))
+                        return;
+                    if (!device.open(QIODevice::ReadWrite)) {
+                        QMessageBox::critical(this, "Error", 
+                            "Cannot access device even with elevated privileges.");
                         return;
                     }
                 } else {
@@ -818,18 +836,21 @@ void MainWindow::on_buttonCheck_clicked()
         }
         else
         {
+            // A running helper has already been tried
+            bool privileged = helper.isStarted();
             mountPoint = mountDisk(inputPath);
             if (mountPoint.isEmpty())
             {
                 // Try with sudo if normal mount fails
-                mountPoint = mountDisk(inputPath, true);
+                if (!privileged)
+                    mountPoint = mountDisk(inputPath, true);
                 if (mountPoint.isEmpty()) {
                     QMessageBox::critical(this, "Error", "Cannot mount selected device!");
                     return;
                 }
             }
             inputPath = mountPoint;
-            cui.setOption("mode", "legacy");
+            cui.setOption("mode", ui->optionLegacy->isChecked() ? "legacy" : "native");
         }
 
         if (ui->optionUseCache->isChecked())
@@ -837,6 +858,11 @@ void MainWindow::on_buttonCheck_clicked()
         else
             cui.setOption("cache", "none");
 
+        if (ui->optionFailFast->isChecked())
+            cui.setOption("failfast", "true");
+        else
+            cui.setOption("failfast", "no");
+
         if (ui->optionLessMem->isChecked())
             cui.setOption("memory", "minimum");
         else
@@ -857,10 +883,44 @@ void MainWindow::on_buttonCheck_clicked()
             cui.setOption("destructive", "no");
     }
 
+    // Every check keeps a checkpoint, an interrupted one can be picked up
+    if (cui.getOption("mode") != "quick" && cui.getOption("mode") != "raw")
+    {
+        cui.setOption("resume", "true");
+        if (f3_checkpoint::exists(inputPath) &&
+            QMessageBox::question(this, "Resume check",
+                                  "An interrupted check was found on this disk.\n"
+                                  "Resume it instead of starting over?",
+                                  QMessageBox::Yes | QMessageBox::No,
+                                  QMessageBox::Yes) != QMessageBox::Yes)
+            f3_checkpoint::discard(inputPath);
+    }
+
+    // The results tab fills in while the files are checked, the probes
+    // have nothing to draw until they are done
+    checkTab = ui->tabWidget->currentIndex();
+    ui->speedChart->clear();
+    if (cui.getOption("mode") != "quick" && cui.getOption("mode") != "sample")
+    {
+        ui->labelSpace->setText("Free Space: ...\nActual: ...");
+        ui->labelSpeed->setText("Read speed: ...\nWrite speed: ...");
+        ui->capacityBar->setValue(0);
+        ui->tabWidget->setTabVisible(3, true);
+    }
+
     clearStatus();
     cui.startCheck(inputPath);
 }
 
+void MainWindow::on_cuiFileRecorded(const f3_file_record& record)
+{
+    if (record.verifiedAt >= 0)
+        ui->speedChart->addRead(record.offset, record.size, record.readMs,
+                                record.sectors.lost() * F3_SECTOR_SIZE);
+    else
+        ui->speedChart->addWrite(record.offset, record.size, record.writeMs);
+}
+
 void MainWindow::saveWindowState()
 {
     QSettings settings("ChickenLegsOz", "F3-Qt");
@@ -952,7 +1012,7 @@ void MainWindow::on_timerTimeout()
     else
     {
         timer.stop();
-        if (timerTarget < 100 && ui->tabWidget->currentIndex() == 1 && ui->optionQuickTest->isChecked())
+        if (timerTarget < 100 && checkTab == 1 && cui.getOption("mode") == "quick")
             promptFix();
     }
 }
@@ -993,6 +1053,11 @@ void MainWindow::on_optionQuickTest_clicked()
         ui->optionDestructive->setEnabled(true);
         ui->optionLessMem->setEnabled(true);
         ui->optionUseCache->setEnabled(false);
+        ui->optionFailFast->setChecked(false);
+        ui->optionFailFast->setEnabled(false);
+        ui->optionSample->setEnabled(true);
+        ui->optionRaw->setChecked(false);
+        ui->optionRaw->setEnabled(false);
     }
     else
     {
@@ -1001,6 +1066,10 @@ void MainWindow::on_optionQuickTest_clicked()
         ui->optionLessMem->setChecked(false);
         ui->optionLessMem->setEnabled(false);
         ui->optionUseCache->setEnabled(true);
+        ui->optionFailFast->setEnabled(true);
+        ui->optionSample->setChecked(false);
+        ui->optionSample->setEnabled(false);
+        ui->optionRaw->setEnabled(true);
     }
 }
 
@@ -1014,55 +1083,150 @@ void MainWindow::on_optionDestructive_clicked()
     ui->optionLessMem->setChecked(false);
 }
 
+void MainWindow::on_optionLegacy_clicked()
+{
+    QSettings settings("ChickenLegsOz", "F3-Qt");
+    settings.setValue("legacy", ui->optionLegacy->isChecked());
+}
+
 void MainWindow::on_buttonHideResult_clicked()
 {
     showResultPage(false);
 }
 
-void MainWindow::executeCommand(const QString &command, bool requiresSudo)
+// The password is asked for once, the helper then stays for the session
+bool MainWindow::startHelper()
 {
-    QString finalCommand = command;
-    QString password;
-    
-    if (requiresSudo) {
-        PasswordDialog dialog(this);
-        if (dialog.exec() != QDialog::Accepted) {
+    // Another request is being waited for, see waitHelper()
+    if (waitingHelper)
+        return false;
+    if (helper.isStarted())
+        return true;
+    PasswordDialog dialog(this);
+    if (dialog.exec() != QDialog::Accepted)
+        return false;
+    if (!helper.start(dialog.getPassword())) {
+        QMessageBox::critical(this, "Error",
+            QString("Cannot start %1, please check it is installed.").arg(F3_HELPER_COMMAND));
+        return false;
+    }
+    return true;
+}
+
+// Waits for the reply with the window still repainting. A wrong password
+// shows up here as the failure of the first request. The controls are off
+// meanwhile, nothing may start a check or another request from inside.
+bool MainWindow::waitHelper(int id, QString *output)
+{
+    QEventLoop loop;
+    bool ok = false;
+    connect(&helper, &f3_helper::f3_helper_finished, &loop,
+            [&loop, &ok, id, output](int replyId, bool replyOk, const QString& text, int fd) {
+        if (replyId != id)
             return;
-        }
-        password = dialog.getPassword();
-        finalCommand = QString("echo \"%1\" | sudo -S %2").arg(password, command);
+        if (fd >= 0)
+            ::close(fd);
+        ok = replyOk;
+        if (output)
+            *output = text;
+        loop.quit();
+    });
+    waitingHelper = true;
+    ui->centralWidget->setEnabled(false);
+    ui->menuBar->setEnabled(false);
+    loop.exec();
+    ui->menuBar->setEnabled(true);
+    ui->centralWidget->setEnabled(true);
+    waitingHelper = false;
+    return ok;
+}
+
+bool MainWindow::grantAccess(const QString& path)
+{
+    QString error;
+    if (!startHelper())
+        return false;
+    if (!waitHelper(helper.chmod(path), &error)) {
+        QMessageBox::critical(this, "Error", QString("Cannot change permissions.\nError: %1").arg(error));
+        return false;
     }
+    return true;
+}
 
-    QProcess process;
-    process.start("bash", QStringList() << "-c" << finalCommand);
-    process.waitForFinished(-1);
+void MainWindow::updateDeviceOutput(const QString &output)
+{
+    ui->deviceOutput->setPlainText(output);
+}
 
-    QString output = QString::fromUtf8(process.readAllStandardOutput());
-    QString error = QString::fromUtf8(process.readAllStandardError());
+// One row per disk, kept in step with the inventory
+void MainWindow::showDevice(const QString& name)
+{
+    f3_device device;
+    if (!devices.getDevice(name, device))
+        return;
 
-    if (process.exitCode() != 0) {
-        if (error.contains("incorrect password")) {
-            QMessageBox::critical(this, "Error", "Incorrect sudo password.");
-        } else {
-            QMessageBox::critical(this, "Error", "Command failed: " + error);
+    QTreeWidgetItem *item = nullptr;
+    int row = 0;
+    for (; row < ui->deviceList->topLevelItemCount(); row++) {
+        QTreeWidgetItem *current = ui->deviceList->topLevelItem(row);
+        const QString currentName = current->data(0, Qt::UserRole).toString();
+        if (currentName == name) {
+            item = current;
+            break;
         }
-        return;
+        if (currentName > name)
+            break;
+    }
+    if (!item) {
+        item = new QTreeWidgetItem();
+        item->setData(0, Qt::UserRole, name);
+        ui->deviceList->insertTopLevelItem(row, item);
     }
 
-    updateDeviceOutput(output);
+    QString usb;
+    if (device.usbBus > 0)
+        usb = QString("%1 Mbit/s, port %2").arg(device.usbSpeed).arg(device.usbPort);
+    item->setText(0, device.path);
+    item->setText(1, locale().formattedDataSize(device.size, 1, QLocale::DataSizeSIFormat));
+    item->setText(2, QString("%1 %2").arg(device.vendor, device.model).trimmed());
+    item->setText(3, device.serial);
+    item->setText(4, device.removable ? "Yes" : "No");
+    item->setText(5, usb);
+    item->setToolTip(5, device.usbHub.isEmpty() ? QString() : QString("Hub %1").arg(device.usbHub));
 }
 
-void MainWindow::updateDeviceOutput(const QString &output)
+void MainWindow::hideDevice(const QString& name)
 {
-    ui->deviceOutput->setPlainText(output);
+    for (int row = 0; row < ui->deviceList->topLevelItemCount(); row++) {
+        if (ui->deviceList->topLevelItem(row)->data(0, Qt::UserRole).toString() == name) {
+            delete ui->deviceList->takeTopLevelItem(row);
+            return;
+        }
+    }
 }
 
-void MainWindow::on_buttonLsblk_clicked()
+void MainWindow::on_buttonRefreshDevices_clicked()
 {
-    executeCommand("lsblk -o NAME,SIZE,TYPE,MOUNTPOINT", false);
+    devices.rescan();
+}
+
+void MainWindow::on_deviceList_itemDoubleClicked(QTreeWidgetItem *item, int column)
+{
+    Q_UNUSED(column);
+    if (checking)
+        return;
+    ui->textDev->setText(item->text(0));
+    ui->tabWidget->setCurrentIndex(1);
 }
 
 void MainWindow::on_buttonFdisk_clicked()
 {
-    executeCommand("fdisk -l", true);
+    QString output;
+    if (!startHelper())
+        return;
+    if (!waitHelper(helper.listPartitions(), &output)) {
+        QMessageBox::critical(this, "Error", "Command failed: " + output);
+        return;
+    }
+    updateDeviceOutput(output);
 }
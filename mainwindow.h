@@ -8,9 +8,13 @@
 #include <QScreen>
 #include <QSettings>
 #include <memory>
+#include "f3_devices.h"
+#include "f3_helper.h"
 #include "f3_launcher.h"
 #include "helpwindow.h"
 
+class QTreeWidgetItem;
+
 namespace Ui {
 class MainWindow;
 }
@@ -34,19 +38,25 @@ private slots:
     void on_timerTimeout();
     void on_cuiStatusChanged(f3_launcher_status status);
     void on_cuiError(f3_launcher_error_code errCode);
+    void on_cuiFileRecorded(const f3_file_record& record);
     void on_buttonSelectDev_clicked();
     void on_optionQuickTest_clicked();
     void on_optionLessMem_clicked();
     void on_optionDestructive_clicked();
+    void on_optionLegacy_clicked();
     void on_buttonHideResult_clicked();
 
 private:
     std::unique_ptr<Ui::MainWindow> ui;
     f3_launcher cui;
+    f3_helper helper;
+    f3_devices devices;
     QTimer timer;
     HelpWindow help;
     bool checking;
+    bool waitingHelper;
     int timerTarget;
+    int checkTab;
     QString mountPoint;
     std::unique_ptr<QLabel> currentStatus;
     std::unique_ptr<QProgressBar> progressBar;
@@ -65,14 +75,19 @@ private:
     bool sureToExit(bool manualClose);
     void promptFix();
     bool validatePath(const QString& path, bool isDevice);
+    bool startHelper();
+    bool waitHelper(int id, QString *output = nullptr);
+    bool grantAccess(const QString& path);
+    void showDevice(const QString& name);
+    void hideDevice(const QString& name);
 
 protected:
     void closeEvent(QCloseEvent *);
 
 private slots:
-    void on_buttonLsblk_clicked();
+    void on_buttonRefreshDevices_clicked();
     void on_buttonFdisk_clicked();
-    void executeCommand(const QString &command, bool requiresSudo = false);
+    void on_deviceList_itemDoubleClicked(QTreeWidgetItem *item, int column);
     void updateDeviceOutput(const QString &output);
 };
 
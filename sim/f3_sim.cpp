@@ -0,0 +1,619 @@
+// Stand-in for the f3 tools, for load testing f3-qt without flash drives.
+// Installed as f3write, f3read, f3probe and f3fix (or run as
+// "f3-sim <tool> ..."), it prints what the real tool would for a simulated
+// drive and takes as long as the drive would. Nothing is read or written.
+//
+// The drive and the run are set through the environment:
+//   F3_SIM_VERSION     f3 version to pretend, default 8.0
+//   F3_SIM_SIZE        announced capacity, e.g. 16G, default 16G
+//   F3_SIM_USABLE      real capacity, smaller than the size for a fake drive
+//   F3_SIM_FAKE        limbo or wraparound, how a fake drive behaves
+//   F3_SIM_WRITE_SPEED MB/s, default 20, 0 to report that but not wait
+//   F3_SIM_READ_SPEED  MB/s, default 25, 0 to report that but not wait
+//   F3_SIM_PROBE_TIME  seconds f3probe takes, default 2
+//   F3_SIM_INTERVAL    milliseconds between progress redraws, default 500
+//   F3_SIM_FAIL        comma separated failures to pick from, default all
+//                      that apply to the tool: nospace nomem notdisk notroot
+//                      notusb oversize damaged missing permission notdir
+//                      isdir crash
+//   F3_SIM_FAIL_RATE   chance of a run failing, 0 to 1, default 0 or 1 if
+//                      F3_SIM_FAIL is set
+//   F3_SIM_SEED        makes runs repeatable, mixed with the path so each
+//                      simulated drive still behaves differently
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define F3_SIM_SECTOR_SIZE 512
+#define F3_SIM_FILE_SIZE (1LL << 30)
+#define F3_SIM_DEFAULT_SIZE (16LL << 30)
+#define F3_SIM_DEFAULT_VERSION 8.0
+#define F3_SIM_DEFAULT_WRITE_SPEED 20.0
+#define F3_SIM_DEFAULT_READ_SPEED 25.0
+#define F3_SIM_DEFAULT_PROBE_TIME 2.0
+#define F3_SIM_DEFAULT_INTERVAL 500
+#define F3_SIM_STEPS_UNTIMED 20
+#define F3_SIM_EXIT_USAGE 64
+
+enum class f3_sim_tool
+{
+    Write,
+    Read,
+    Probe,
+    Fix
+};
+
+struct f3_sim_config
+{
+    f3_sim_tool tool;
+    const char *name;
+    const char *title;
+    double version;
+    long long size;
+    long long usable;
+    bool wraparound;
+    double writeSpeed;
+    double readSpeed;
+    double probeTime;
+    int interval;
+    std::string failure;
+    double failurePoint;    // fraction of the run done before it fails
+    bool progress;
+    long long startAt;
+    long long endAt;
+    long long lastSector;
+    std::string path;
+};
+
+static std::mt19937_64 f3_sim_random;
+
+static const char *f3_sim_env(const char *name, const char *fallback)
+{
+    const char *value = getenv(name);
+    return value && *value ? value : fallback;
+}
+
+static double f3_sim_env_number(const char *name, double fallback)
+{
+    const char *value = getenv(name);
+    return value && *value ? atof(value) : fallback;
+}
+
+static long long f3_sim_parse_size(const char *text)
+{
+    char *end;
+    double value = strtod(text, &end);
+    switch (*end)
+    {
+        case 'T': case 't':
+            value *= 1024;
+            // fall through
+        case 'G': case 'g':
+            value *= 1024;
+            // fall through
+        case 'M': case 'm':
+            value *= 1024;
+            // fall through
+        case 'K': case 'k':
+            value *= 1024;
+    }
+    return (long long)value / F3_SIM_SECTOR_SIZE * F3_SIM_SECTOR_SIZE;
+}
+
+// Same units and rounding as f3
+static std::string f3_sim_capacity(long long bytes)
+{
+    static const char *units[] = {"Byte", "KB", "MB", "GB", "TB"};
+    double value = bytes;
+    int grade = 0;
+    while (value >= 1024 && grade < 4)
+    {
+        value /= 1024;
+        grade++;
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f %s", value, units[grade]);
+    return text;
+}
+
+static std::string f3_sim_time(double usec)
+{
+    char text[32];
+    if (usec < 1000)
+        snprintf(text, sizeof(text), "%.0fus", usec);
+    else if (usec < 1000000)
+        snprintf(text, sizeof(text), "%.1fms", usec / 1000);
+    else if (usec < 60000000)
+        snprintf(text, sizeof(text), "%.2fs", usec / 1000000);
+    else
+    {
+        long long seconds = (long long)(usec / 1000000);
+        snprintf(text, sizeof(text), "%lld'%02lld\"", seconds / 60, seconds % 60);
+    }
+    return text;
+}
+
+static void f3_sim_sleep(double seconds)
+{
+    if (seconds > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+static void f3_sim_header(FILE *out, const f3_sim_config& config)
+{
+    // Versions before 6.1 do not print one
+    if (config.version < 6.1)
+        return;
+    fprintf(out, "F3 %s %.1f\n"
+                 "Copyright (C) 2010 Digirati Internet LTDA.\n"
+                 "This is free software; see the source for copying conditions.\n\n",
+            config.title, config.version);
+}
+
+// Exits the way the f3 tools do on errors they report with err(3): the
+// exit code is the errno value
+static void f3_sim_fail_errno(const f3_sim_config& config, int error, const char *message)
+{
+    fflush(stdout);
+    fprintf(stderr, "%s: %s `%s': %s\n", config.name, message, config.path.c_str(), strerror(error));
+    exit(error);
+}
+
+static void f3_sim_fail_start(const f3_sim_config& config)
+{
+    const std::string& failure = config.failure;
+    if (failure == "missing")
+        f3_sim_fail_errno(config, ENOENT, "Can't open");
+    else if (failure == "permission")
+        f3_sim_fail_errno(config, EACCES, "Can't open");
+    else if (failure == "notdir")
+        f3_sim_fail_errno(config, ENOTDIR, "Can't change working directory to");
+    else if (failure == "isdir")
+        f3_sim_fail_errno(config, EISDIR, "Can't open device");
+    else if (failure == "nomem")
+    {
+        fprintf(stderr, "Out of memory, try `--min-memory'\n");
+        exit(1);
+    }
+    else if (failure == "notdisk")
+    {
+        std::string disk = config.path;
+        while (!disk.empty() && isdigit((unsigned char)disk.back()))
+            disk.pop_back();
+        fprintf(stderr, "Device `%s' is a partition of disk device `%s'.\n"
+                        "You must run f3probe on the disk device as follows:\n"
+                        "f3probe %s\n", config.path.c_str(), disk.c_str(), disk.c_str());
+        exit(1);
+    }
+    else if (failure == "notroot")
+    {
+        fprintf(stderr, "Your user doesn't have access to device `%s'.\n"
+                        "Try to run this program as root:\n"
+                        "sudo %s %s\n", config.path.c_str(), config.name, config.path.c_str());
+        exit(1);
+    }
+    else if (failure == "notusb")
+    {
+        fprintf(stderr, "Device `%s' is not backed by a USB device.\n"
+                        "You must run this program as follows:\n"
+                        "%s %s\n", config.path.c_str(), config.name, config.path.c_str());
+        exit(1);
+    }
+    else if (failure == "oversize")
+    {
+        fprintf(stderr, "Can't have a partition outside the disk!\n");
+        exit(1);
+    }
+}
+
+static void f3_sim_fail_midway(const f3_sim_config& config)
+{
+    fflush(stdout);
+    if (config.failure == "crash")
+        abort();
+    if (config.failure == "nospace")
+    {
+        fprintf(stderr, "\n%s: No space!\n", config.name);
+        exit(1);
+    }
+}
+
+// Draws "xx.xx% -- speed -- time left" over the previous one like f3 does,
+// backing up with '\b' before the next redraw
+class f3_sim_progress
+{
+public:
+    f3_sim_progress(const f3_sim_config& config, double speed, double shownSpeed) :
+        config(config),
+        speed(speed),
+        shownSpeed(shownSpeed),
+        drawn(0)
+    {
+    }
+
+    // Returns false once the run reached the point it is meant to fail at
+    bool transfer(long long bytes, long long done, long long total)
+    {
+        double seconds = speed > 0 ? bytes / (speed * 1024 * 1024) : 0;
+        int steps = speed > 0 ? std::max(1, int(seconds * 1000 / config.interval)) : F3_SIM_STEPS_UNTIMED;
+        for (int step = 1; step <= steps; step++)
+        {
+            f3_sim_sleep(seconds / steps);
+            long long current = done + bytes * step / steps;
+            if (!config.failure.empty() && current >= config.failurePoint * total)
+                return false;
+            if (config.progress)
+                draw(100.0 * step / steps, (total - current) / (shownSpeed * 1024 * 1024));
+        }
+        return true;
+    }
+
+    void erase()
+    {
+        if (drawn == 0)
+            return;
+        for (int i = 0; i < drawn; i++)
+            putchar('\b');
+        for (int i = 0; i < drawn; i++)
+            putchar(' ');
+        for (int i = 0; i < drawn; i++)
+            putchar('\b');
+        drawn = 0;
+    }
+
+private:
+    const f3_sim_config& config;
+    double speed;
+    double shownSpeed;
+    int drawn;
+
+    void draw(double percent, double secondsLeft)
+    {
+        // A little noise so the drives of a load test do not move in lockstep
+        std::uniform_real_distribution<double> noise(0.97, 1.03);
+        long long left = (long long)secondsLeft;
+        char text[64];
+        int length = snprintf(text, sizeof(text), "%.2f%% -- %.2f MB/s -- %lld:%02lld",
+                              percent, shownSpeed * noise(f3_sim_random), left / 60, left % 60);
+        for (int i = 0; i < drawn; i++)
+            putchar('\b');
+        fputs(text, stdout);
+        for (int i = length; i < drawn; i++)
+            putchar(' ');
+        for (int i = length; i < drawn; i++)
+            putchar('\b');
+        drawn = length;
+        fflush(stdout);
+    }
+};
+
+static long long f3_sim_file_count(const f3_sim_config& config)
+{
+    return (config.size + F3_SIM_FILE_SIZE - 1) / F3_SIM_FILE_SIZE;
+}
+
+static long long f3_sim_file_size(const f3_sim_config& config, long long number)
+{
+    return std::min(F3_SIM_FILE_SIZE, config.size - (number - 1) * F3_SIM_FILE_SIZE);
+}
+
+static int f3_sim_write(const f3_sim_config& config)
+{
+    f3_sim_header(stdout, config);
+    long long last = std::min(config.endAt, f3_sim_file_count(config));
+    long long total = 0;
+    for (long long number = config.startAt; number <= last; number++)
+        total += f3_sim_file_size(config, number);
+
+    printf("Free space: %s\n", f3_sim_capacity(config.size).c_str());
+    fflush(stdout);
+    double shownSpeed = config.writeSpeed > 0 ? config.writeSpeed : F3_SIM_DEFAULT_WRITE_SPEED;
+    f3_sim_progress progress(config, config.writeSpeed, shownSpeed);
+    long long done = 0;
+    for (long long number = config.startAt; number <= last; number++)
+    {
+        long long size = f3_sim_file_size(config, number);
+        printf("Creating file %lld.h2w ... ", number);
+        fflush(stdout);
+        if (!progress.transfer(size, done, total))
+            f3_sim_fail_midway(config);
+        done += size;
+        progress.erase();
+        printf("OK!\n");
+        fflush(stdout);
+    }
+    printf("Free space: %s\n", f3_sim_capacity(0).c_str());
+    printf("Average writing speed: %s/s\n", f3_sim_capacity((long long)(shownSpeed * 1024 * 1024)).c_str());
+    return 0;
+}
+
+static int f3_sim_read(const f3_sim_config& config)
+{
+    f3_sim_header(stdout, config);
+    long long last = std::min(config.endAt, f3_sim_file_count(config));
+    long long total = 0;
+    for (long long number = config.startAt; number <= last; number++)
+        total += f3_sim_file_size(config, number);
+
+    printf("                  SECTORS      ok/corrupted/changed/overwritten\n");
+    fflush(stdout);
+    double shownSpeed = config.readSpeed > 0 ? config.readSpeed : F3_SIM_DEFAULT_READ_SPEED;
+    f3_sim_progress progress(config, config.readSpeed, shownSpeed);
+    long long done = 0;
+    long long ok = 0, corrupted = 0, changed = 0, overwritten = 0;
+    for (long long number = config.startAt; number <= last; number++)
+    {
+        long long size = f3_sim_file_size(config, number);
+        printf("Validating file %lld.h2w ... ", number);
+        fflush(stdout);
+        if (!progress.transfer(size, done, total))
+            f3_sim_fail_midway(config);
+        done += size;
+        progress.erase();
+
+        // Everything past the real capacity is lost, a wrapping drive
+        // shows the data that overwrote it, a limbo drive garbage
+        long long start = (number - 1) * F3_SIM_FILE_SIZE;
+        long long good = std::max(0LL, std::min(size, config.usable - start)) / F3_SIM_SECTOR_SIZE;
+        long long lost = size / F3_SIM_SECTOR_SIZE - good;
+        long long fileChanged = lost > 0 && good > 0 ? std::min(lost, 12LL) : 0;
+        long long fileOk = good;
+        long long fileCorrupted = config.wraparound ? 0 : lost - fileChanged;
+        long long fileOverwritten = config.wraparound ? lost - fileChanged : 0;
+        printf("%7lld/%9lld/%7lld/%7lld\n", fileOk, fileCorrupted, fileChanged, fileOverwritten);
+        fflush(stdout);
+        ok += fileOk;
+        corrupted += fileCorrupted;
+        changed += fileChanged;
+        overwritten += fileOverwritten;
+    }
+
+    long long lost = corrupted + changed + overwritten;
+    printf("\n  Data OK: %s (%lld sectors)\n", f3_sim_capacity(ok * F3_SIM_SECTOR_SIZE).c_str(), ok);
+    printf("Data LOST: %s (%lld sectors)\n", f3_sim_capacity(lost * F3_SIM_SECTOR_SIZE).c_str(), lost);
+    printf("\t       Corrupted: %s (%lld sectors)\n",
+           f3_sim_capacity(corrupted * F3_SIM_SECTOR_SIZE).c_str(), corrupted);
+    printf("\tSlightly changed: %s (%lld sectors)\n",
+           f3_sim_capacity(changed * F3_SIM_SECTOR_SIZE).c_str(), changed);
+    printf("\t     Overwritten: %s (%lld sectors)\n",
+           f3_sim_capacity(overwritten * F3_SIM_SECTOR_SIZE).c_str(), overwritten);
+    printf("Average reading speed: %s/s\n", f3_sim_capacity((long long)(shownSpeed * 1024 * 1024)).c_str());
+    return 0;
+}
+
+static int f3_sim_probe(const f3_sim_config& config, bool timeOps)
+{
+    f3_sim_header(stdout, config);
+    printf("WARNING: Probing normally takes from a few seconds to 15 minutes, but\n"
+           "         it can take longer. Please be patient.\n\n");
+    fflush(stdout);
+
+    // f3probe has no progress, it just takes its time
+    if (config.failure == "crash")
+    {
+        f3_sim_sleep(config.probeTime * config.failurePoint);
+        f3_sim_fail_midway(config);
+    }
+    f3_sim_sleep(config.probeTime);
+
+    const char *device = config.path.c_str();
+    bool damaged = config.failure == "damaged";
+    long long usable = damaged ? 0 : config.usable;
+    long long blocks = usable / F3_SIM_SECTOR_SIZE;
+    if (damaged)
+        printf("Bad news: The device `%s' is damaged\n\n", device);
+    else if (usable >= config.size)
+        printf("Good news: The device `%s' is the real thing\n\n", device);
+    else
+        printf("Bad news: The device `%s' is a counterfeit of type %s\n\n"
+               "You can \"fix\" this device using the following command:\n"
+               "f3fix --last-sec=%lld %s\n\n",
+               device, config.wraparound ? "wraparound" : "limbo", blocks - 1, device);
+
+    long long module = config.wraparound && usable < config.size ? usable : F3_SIM_SECTOR_SIZE;
+    while (module < config.size && !(config.wraparound && usable < config.size))
+        module <<= 1;
+    int moduleOrder = 0;
+    while ((1LL << moduleOrder) < module)
+        moduleOrder++;
+    printf("Device geometry:\n");
+    printf("\t         *Usable* size: %s (%lld blocks)\n", f3_sim_capacity(usable).c_str(), blocks);
+    printf("\t        Announced size: %s (%lld blocks)\n",
+           f3_sim_capacity(config.size).c_str(), config.size / F3_SIM_SECTOR_SIZE);
+    printf("\t                Module: %s (2^%d Bytes)\n", f3_sim_capacity(module).c_str(), moduleOrder);
+    printf("\tApproximate cache size: %s (0 blocks), need-reset=no\n", f3_sim_capacity(0).c_str());
+    printf("\t   Physical block size: %s (2^9 Bytes)\n", f3_sim_capacity(F3_SIM_SECTOR_SIZE).c_str());
+
+    if (timeOps)
+    {
+        // Split the time between reads and writes with a made up count
+        double usec = config.probeTime * 1000000;
+        std::uniform_int_distribution<long long> count(2000, 40000);
+        long long reads = count(f3_sim_random);
+        long long writes = count(f3_sim_random);
+        printf("\nProbe time: %s\n", f3_sim_time(usec).c_str());
+        printf(" Operation: total time / count = avg time\n");
+        printf("      Read: %s / %lld = %s\n", f3_sim_time(usec * 0.4).c_str(), reads,
+               f3_sim_time(usec * 0.4 / reads).c_str());
+        printf("     Write: %s / %lld = %s\n", f3_sim_time(usec * 0.6).c_str(), writes,
+               f3_sim_time(usec * 0.6 / writes).c_str());
+        printf("     Reset: 0us / 1 = 0us\n");
+    }
+    return 0;
+}
+
+static int f3_sim_fix(const f3_sim_config& config)
+{
+    f3_sim_header(stdout, config);
+    if (config.lastSector >= config.size / F3_SIM_SECTOR_SIZE)
+    {
+        fprintf(stderr, "Can't have a partition outside the disk!\n");
+        return 1;
+    }
+    if (config.failure == "crash")
+        f3_sim_fail_midway(config);
+    printf("Drive `%s' was successfully fixed\n", config.path.c_str());
+    return 0;
+}
+
+static bool f3_sim_tool_from_name(const std::string& name, f3_sim_config& config)
+{
+    static const struct
+    {
+        const char *name;
+        f3_sim_tool tool;
+        const char *title;
+        const char *failures;
+    } tools[] = {
+        {"f3write", f3_sim_tool::Write, "write", "nospace,missing,permission,notdir,crash"},
+        {"f3read", f3_sim_tool::Read, "read", "missing,permission,notdir,crash"},
+        {"f3probe", f3_sim_tool::Probe, "probe",
+         "nomem,notdisk,notroot,notusb,damaged,missing,permission,isdir,crash"},
+        {"f3fix", f3_sim_tool::Fix, "fix", "oversize,notroot,missing,crash"},
+    };
+
+    for (const auto& tool : tools)
+    {
+        if (name == tool.name)
+        {
+            config.tool = tool.tool;
+            config.name = tool.name;
+            config.title = tool.title;
+            // Only failures the tool can run into are drawn
+            std::vector<std::string> choices;
+            std::string wanted = std::string(",") + f3_sim_env("F3_SIM_FAIL", tool.failures) + ",";
+            std::string known = std::string(tool.failures) + ",";
+            for (size_t start = 0, end; (end = known.find(',', start)) != std::string::npos; start = end + 1)
+            {
+                std::string failure = known.substr(start, end - start);
+                if (wanted.find("," + failure + ",") != std::string::npos)
+                    choices.push_back(failure);
+            }
+            double rate = f3_sim_env_number("F3_SIM_FAIL_RATE", getenv("F3_SIM_FAIL") ? 1 : 0);
+            std::uniform_real_distribution<double> chance(0, 1);
+            if (!choices.empty() && chance(f3_sim_random) < rate)
+            {
+                std::uniform_int_distribution<size_t> pick(0, choices.size() - 1);
+                config.failure = choices[pick(f3_sim_random)];
+            }
+            config.failurePoint = chance(f3_sim_random);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void f3_sim_usage(const f3_sim_config& config)
+{
+    f3_sim_header(stderr, config);
+    fprintf(stderr, "Usage: %s [OPTION...] <PATH>\n", config.name);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string name = argv[0];
+    name = name.substr(name.rfind('/') + 1);
+    int first = 1;
+    if (name.compare(0, 6, "f3-sim") == 0 && argc > 1)
+    {
+        name = argv[1];
+        first = 2;
+    }
+
+    std::vector<std::string> args;
+    for (int i = first; i < argc; i++)
+        args.push_back(argv[i]);
+    std::string path;
+    for (const std::string& arg : args)
+    {
+        if (arg[0] != '-')
+            path = arg;
+    }
+
+    std::seed_seq seed{(unsigned long long)strtoull(f3_sim_env("F3_SIM_SEED", "0"), nullptr, 10),
+                       (unsigned long long)std::hash<std::string>()(path),
+                       (unsigned long long)(getenv("F3_SIM_SEED") ? 0 :
+                           std::chrono::steady_clock::now().time_since_epoch().count() ^ getpid())};
+    f3_sim_random.seed(seed);
+
+    f3_sim_config config;
+    if (!f3_sim_tool_from_name(name, config))
+    {
+        fprintf(stderr, "Usage: f3-sim f3write|f3read|f3probe|f3fix [OPTION...] <PATH>\n");
+        return F3_SIM_EXIT_USAGE;
+    }
+    config.version = f3_sim_env_number("F3_SIM_VERSION", F3_SIM_DEFAULT_VERSION);
+    if (config.version <= 0)
+        config.version = F3_SIM_DEFAULT_VERSION;
+    config.size = getenv("F3_SIM_SIZE") ? f3_sim_parse_size(getenv("F3_SIM_SIZE")) : F3_SIM_DEFAULT_SIZE;
+    config.usable = getenv("F3_SIM_USABLE") ? f3_sim_parse_size(getenv("F3_SIM_USABLE")) : config.size;
+    config.usable = std::min(config.usable, config.size);
+    config.wraparound = strcmp(f3_sim_env("F3_SIM_FAKE", "limbo"), "wraparound") == 0;
+    config.writeSpeed = f3_sim_env_number("F3_SIM_WRITE_SPEED", F3_SIM_DEFAULT_WRITE_SPEED);
+    config.readSpeed = f3_sim_env_number("F3_SIM_READ_SPEED", F3_SIM_DEFAULT_READ_SPEED);
+    config.probeTime = f3_sim_env_number("F3_SIM_PROBE_TIME", F3_SIM_DEFAULT_PROBE_TIME);
+    config.interval = std::max(1, int(f3_sim_env_number("F3_SIM_INTERVAL", F3_SIM_DEFAULT_INTERVAL)));
+    config.progress = false;
+    config.startAt = 1;
+    config.endAt = LLONG_MAX;
+    config.lastSector = -1;
+    config.path = path;
+
+    bool timeOps = false;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        const std::string& arg = args[i];
+        if (arg == "--show-progress=1")
+            config.progress = true;
+        else if (arg.compare(0, 11, "--start-at=") == 0)
+            config.startAt = std::max(1LL, atoll(arg.c_str() + 11));
+        else if (arg.compare(0, 9, "--end-at=") == 0)
+            config.endAt = atoll(arg.c_str() + 9);
+        else if (arg == "--time-ops")
+            timeOps = true;
+        else if (arg.compare(0, 11, "--last-sec=") == 0)
+            config.lastSector = atoll(arg.c_str() + 11);
+        else if (arg == "-l" && i + 1 < args.size())
+            config.lastSector = atoll(args[++i].c_str());
+    }
+    // --show-progress came after 6.0
+    if (config.progress && config.version <= 6.0)
+    {
+        fprintf(stderr, "%s: unrecognized option '--show-progress=1'\n", config.name);
+        return F3_SIM_EXIT_USAGE;
+    }
+    if (path.empty())
+    {
+        f3_sim_usage(config);
+        return F3_SIM_EXIT_USAGE;
+    }
+
+    f3_sim_fail_start(config);
+    switch (config.tool)
+    {
+        case f3_sim_tool::Write:
+            return f3_sim_write(config);
+        case f3_sim_tool::Read:
+            return f3_sim_read(config);
+        case f3_sim_tool::Probe:
+            return f3_sim_probe(config, timeOps);
+        case f3_sim_tool::Fix:
+            return f3_sim_fix(config);
+    }
+    return 0;
+}
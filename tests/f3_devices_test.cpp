@@ -0,0 +1,165 @@
+#include "f3_devices.h"
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QtTest>
+
+// A /sys of its own: the disks under devices/, block/ linking to them and
+// each disk's device link pointing at the device it sits on, so the real
+// paths walk up to the USB device the way they do in sysfs
+class f3_devices_test : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir sys;
+
+    bool write(const QString& fileName, const QString& text)
+    {
+        QFile file(sys.filePath(fileName));
+        return QDir().mkpath(QFileInfo(file).path()) && file.open(QFile::WriteOnly) &&
+               file.write(text.toUtf8()) == text.toUtf8().size();
+    }
+
+    bool link(const QString& target, const QString& linkName)
+    {
+        return QDir().mkpath(QFileInfo(sys.filePath(linkName)).path()) &&
+               QFile::link(sys.filePath(target), sys.filePath(linkName));
+    }
+
+    // A disk on a device directory, both under devices/
+    bool addDisk(const QString& devicePath, const QString& name, qint64 sectors, bool removable)
+    {
+        const QString disk = QString("%1/block/%2").arg(devicePath, name);
+        return write(disk + "/size", QString::number(sectors)) &&
+               write(disk + "/removable", removable ? "1" : "0") &&
+               link(devicePath, disk + "/device") &&
+               link(disk, "block/" + name);
+    }
+
+    // A USB stick on port 2-1 of bus 2, a SuperSpeed root hub
+    bool addUsbDisk(const QString& name)
+    {
+        const QString hub = "devices/pci0000:00/0000:00:14.0/usb2";
+        const QString port = hub + "/2-1";
+        const QString scsi = port + "/2-1:1.0/host6/target6:0:0/6:0:0:0";
+        return write(hub + "/busnum", "2") && write(hub + "/speed", "5000") &&
+               link(hub, "bus/usb/devices/usb2") &&
+               write(port + "/busnum", "2") && write(port + "/speed", "480") &&
+               write(port + "/serial", "0123456789AB") &&
+               write(scsi + "/vendor", "Generic ") && write(scsi + "/model", "Flash Disk\n") &&
+               addDisk(scsi, name, 15633408, true);
+    }
+
+    static QByteArray uevent(const QString& action, const QString& name, const QString& type)
+    {
+        QByteArray message = QString("%1@/devices/virtual/block/%2").arg(action, name).toUtf8();
+        message += '\0' + QString("ACTION=%1").arg(action).toUtf8();
+        message += '\0' + QString("DEVPATH=/devices/virtual/block/%1").arg(name).toUtf8();
+        message += QByteArray("\0SUBSYSTEM=block", 16);
+        message += '\0' + QString("DEVNAME=%1").arg(name).toUtf8();
+        message += '\0' + QString("DEVTYPE=%1").arg(type).toUtf8();
+        message += '\0';
+        return message;
+    }
+
+private slots:
+    void init()
+    {
+        QVERIFY(sys.isValid());
+        QDir(sys.path()).removeRecursively();
+        QVERIFY(QDir().mkpath(sys.filePath("block")));
+    }
+
+    void usbDisk()
+    {
+        QVERIFY(addUsbDisk("sdb"));
+        f3_devices devices;
+        devices.setSysRoot(sys.path());
+        QSignalSpy updated(&devices, &f3_devices::f3_devices_updated);
+        devices.rescan();
+
+        QCOMPARE(updated.count(), 1);
+        f3_device device;
+        QVERIFY(devices.getDevice("sdb", device));
+        QCOMPARE(device.path, QString("/dev/sdb"));
+        QCOMPARE(device.size, Q_INT64_C(15633408) * 512);
+        QVERIFY(device.removable);
+        QCOMPARE(device.vendor, QString("Generic"));
+        QCOMPARE(device.model, QString("Flash Disk"));
+        QCOMPARE(device.serial, QString("0123456789AB"));
+        QCOMPARE(device.usbBus, 2);
+        QCOMPARE(device.usbSpeed, 480);
+        QCOMPARE(device.usbBusSpeed, 5000);
+        QCOMPARE(device.usbPort, QString("2-1"));
+        QCOMPARE(device.usbHub, QString("usb2"));
+    }
+
+    void removableDisk()
+    {
+        const QString card = "devices/platform/mmc0/mmc_host/mmc0/mmc0:0001";
+        QVERIFY(write(card + "/name", "SD32G"));
+        QVERIFY(addDisk(card, "mmcblk0", 62333952, true));
+        // No device behind it, not a disk to check
+        QVERIFY(write("devices/virtual/block/loop0/size", "0"));
+        QVERIFY(link("devices/virtual/block/loop0", "block/loop0"));
+        f3_devices devices;
+        devices.setSysRoot(sys.path());
+        devices.rescan();
+
+        QCOMPARE(devices.getDevices().size(), 1);
+        f3_device device;
+        QVERIFY(devices.getDevice("mmcblk0", device));
+        QVERIFY(device.removable);
+        QCOMPARE(device.model, QString("SD32G"));
+        QCOMPARE(device.usbBus, 0);
+        QVERIFY(device.usbPort.isEmpty());
+        QVERIFY(!devices.getDevice("loop0", device));
+    }
+
+    void removal()
+    {
+        QVERIFY(addUsbDisk("sdb"));
+        f3_devices devices;
+        devices.setSysRoot(sys.path());
+        devices.rescan();
+        QSignalSpy removed(&devices, &f3_devices::f3_devices_removed);
+
+        QVERIFY(QFile::remove(sys.filePath("block/sdb")));
+        devices.rescan();
+        QCOMPARE(removed.count(), 1);
+        QCOMPARE(removed.at(0).at(0).toString(), QString("sdb"));
+        QVERIFY(devices.getDevices().isEmpty());
+    }
+
+    void uevents()
+    {
+        f3_devices devices;
+        devices.setSysRoot(sys.path());
+        devices.rescan();
+        QSignalSpy updated(&devices, &f3_devices::f3_devices_updated);
+        QSignalSpy removed(&devices, &f3_devices::f3_devices_removed);
+
+        QVERIFY(addUsbDisk("sdc"));
+        devices.handleUevent(uevent("add", "sdc1", "partition"));
+        QCOMPARE(updated.count(), 0);
+        devices.handleUevent(uevent("add", "sdc", "disk"));
+        QCOMPARE(updated.count(), 1);
+        QCOMPARE(updated.at(0).at(0).toString(), QString("sdc"));
+        f3_device device;
+        QVERIFY(devices.getDevice("sdc", device));
+        QCOMPARE(device.usbPort, QString("2-1"));
+
+        devices.handleUevent(uevent("remove", "sdc", "disk"));
+        QCOMPARE(removed.count(), 1);
+        QCOMPARE(removed.at(0).at(0).toString(), QString("sdc"));
+        QVERIFY(!devices.getDevice("sdc", device));
+        // Gone already, nothing more to tell
+        devices.handleUevent(uevent("remove", "sdc", "disk"));
+        QCOMPARE(removed.count(), 1);
+    }
+};
+
+QTEST_GUILESS_MAIN(f3_devices_test)
+#include "f3_devices_test.moc"